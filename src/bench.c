@@ -0,0 +1,431 @@
+#include "scheduler.h"
+#include "syscall.h"
+#include "timer.h"
+#include "string.h"
+#include "uart.h"
+#include "sbi.h"
+#include "fs.h"
+#include "chan.h"
+#include "virtio_blk.h"
+#include "hart.h"
+#include "vdso.h"
+#include "klog.h"
+#include <stdint.h>
+
+/*
+ * Kernel microbenchmarks, built into build/bench/kernel.elf by 'make bench'.
+ * Each result is printed as one machine-readable line:
+ *   BENCH <name> <value> <unit>
+ * Units ending in "/s" are throughputs (higher is better), everything else
+ * is a cost (lower is better). tools/bench_compare.py checks the lines
+ * against a stored baseline.
+ */
+
+#define BENCH_ITERS 1000
+#define BENCH_BUF_SIZE 4096
+#define BENCH_UART_LINES 16
+#define BENCH_SLEEPS 100
+#define BENCH_SLEEP_US 100
+#define BENCH_BLK_IOS 2048       /* Requests per disk benchmark */
+#define BENCH_BLK_DEPTH 32       /* 4KiB random reads kept in flight */
+#define BENCH_BLK_SEQ_DEPTH 2    /* 64KiB sequential reads kept in flight */
+#define BENCH_EDF_MS 500         /* Length of the deadline task set run */
+#define BENCH_EDF_HOGS 2         /* Background tasks competing for the CPU */
+#define BENCH_EDF_HOG_US 200     /* CPU time a background task takes between yields */
+#define BENCH_FS_READERS 4       /* Tasks reading one file side by side */
+
+static char bench_src[BENCH_BUF_SIZE];
+static char bench_dst[BENCH_BUF_SIZE];
+static volatile int yield_done;
+static int bench_pipe_fd;
+static volatile uint32_t *bench_chan;
+static char bench_blk_pages[BENCH_BLK_DEPTH][4096] __attribute__((aligned(4096)));
+static virtio_blk_req_t bench_blk_reqs[BENCH_BLK_DEPTH];
+static volatile int edf_done;
+static char bench_reader_bufs[BENCH_FS_READERS][BENCH_BUF_SIZE];
+static volatile int bench_reader_next;
+
+/* The deadline task set: runtime, period and relative deadline in us, and
+ * the CPU time each job actually uses. Together they reserve 55% of the CPU. */
+static const struct {
+    uint32_t runtime, period, deadline, work;
+} bench_edf_set[] = {
+    {1000, 5000, 5000, 700},
+    {2000, 10000, 8000, 1500},
+    {3000, 20000, 20000, 2500},
+};
+#define BENCH_EDF_TASKS ((int)(sizeof(bench_edf_set) / sizeof(bench_edf_set[0])))
+static int bench_edf_tids[BENCH_EDF_TASKS];
+
+// Helper function to make system calls
+static inline int syscall(int num, uint64_t a0, uint64_t a1, uint64_t a2) {
+    register long a7 asm("a7") = num;
+    register long a0_reg asm("a0") = a0;
+    register long a1_reg asm("a1") = a1;
+    register long a2_reg asm("a2") = a2;
+    asm volatile("ecall" : "+r"(a0_reg) : "r"(a7), "r"(a1_reg), "r"(a2_reg) : "memory");
+    return (int)a0_reg;
+}
+
+static void bench_report(const char *name, uint64_t value, const char *unit) {
+    uart_puts("BENCH ");
+    uart_puts(name);
+    uart_puts(" ");
+    uart_put_dec(value);
+    uart_puts(" ");
+    uart_puts(unit);
+    uart_puts("\n");
+}
+
+/* Converts 'bytes' moved in 'ticks' of the time CSR into KiB per second. */
+static uint64_t kib_per_sec(uint64_t bytes, uint64_t ticks) {
+    if (ticks == 0) ticks = 1;
+    return bytes * TIMER_FREQ / ticks / 1024;
+}
+
+/* Partner task for the yield benchmark: bounces the CPU straight back. */
+static void bench_yield_partner(void) {
+    while (!yield_done) scheduler_yield();
+}
+
+static void bench_yield(void) {
+    yield_done = 0;
+    if (scheduler_spawn(bench_yield_partner) < 0) return;
+    scheduler_yield(); /* Let the partner start before measuring. */
+
+    uint64_t start = rdcycle();
+    for (int i = 0; i < BENCH_ITERS; i++) scheduler_yield();
+    uint64_t cycles = rdcycle() - start;
+
+    yield_done = 1;
+    scheduler_yield(); /* Let the partner run to completion. */
+    bench_report("yield_roundtrip", cycles / BENCH_ITERS, "cycles");
+}
+
+static void bench_null_syscall(void) {
+    uint64_t start = rdcycle();
+    for (int i = 0; i < BENCH_ITERS; i++) syscall(SYS_GETTID, 0, 0, 0);
+    uint64_t cycles = rdcycle() - start;
+    bench_report("null_syscall", cycles / BENCH_ITERS, "cycles");
+}
+
+/* The same query answered from the vDSO page, and a clock read through it. */
+static void bench_vdso(void) {
+    const volatile vdso_data_t *d = vdso_kernel();
+    if (!d) return;
+    volatile int tid;
+    uint64_t start = rdcycle();
+    for (int i = 0; i < BENCH_ITERS; i++) tid = vdso_gettid(d);
+    uint64_t cycles = rdcycle() - start;
+    (void)tid;
+    bench_report("vdso_gettid", cycles / BENCH_ITERS, "cycles");
+
+    volatile uint64_t t;
+    start = rdcycle();
+    for (int i = 0; i < BENCH_ITERS; i++) t = vdso_uptime(d);
+    cycles = rdcycle() - start;
+    (void)t;
+    bench_report("vdso_uptime", cycles / BENCH_ITERS, "cycles");
+}
+
+static void bench_fs(void) {
+    fs_create("benchfile");
+
+    uint64_t start = rdcycle();
+    for (int i = 0; i < BENCH_ITERS; i++) fs_close(fs_open("benchfile", FD_READ));
+    bench_report("fs_open_close", (rdcycle() - start) / BENCH_ITERS, "cycles");
+
+    int fd = fs_open("benchfile", FD_READ | FD_WRITE);
+    start = timer_now();
+    for (int i = 0; i < BENCH_ITERS; i++) {
+        fs_seek(fd, 0);
+        fs_write(fd, bench_src, BENCH_BUF_SIZE);
+    }
+    bench_report("fs_write", kib_per_sec((uint64_t)BENCH_ITERS * BENCH_BUF_SIZE, timer_now() - start), "KiB/s");
+
+    start = timer_now();
+    for (int i = 0; i < BENCH_ITERS; i++) {
+        fs_seek(fd, 0);
+        fs_read(fd, bench_dst, BENCH_BUF_SIZE);
+    }
+    bench_report("fs_read", kib_per_sec((uint64_t)BENCH_ITERS * BENCH_BUF_SIZE, timer_now() - start), "KiB/s");
+
+    fs_close(fd);
+    fs_delete("benchfile");
+}
+
+/* One of the parallel readers: reads its share of BENCH_ITERS pages of
+ * benchfile through a descriptor of its own, yielding after each read. */
+static void bench_fs_reader(void) {
+    int me = __atomic_fetch_add(&bench_reader_next, 1, __ATOMIC_RELAXED);
+    int fd = fs_open("benchfile", FD_READ);
+    for (int i = 0; i < BENCH_ITERS / BENCH_FS_READERS; i++) {
+        fs_seek(fd, 0);
+        fs_read(fd, bench_reader_bufs[me], BENCH_BUF_SIZE);
+        scheduler_yield();
+    }
+    fs_close(fd);
+}
+
+/* Aggregate read throughput of several tasks reading the same file at once,
+ * which share the file lock. */
+static void bench_fs_parallel(void) {
+    int fd = fs_create("benchfile") < 0 ? -1 : fs_open("benchfile", FD_WRITE);
+    if (fd < 0) return;
+    fs_write(fd, bench_src, BENCH_BUF_SIZE);
+    fs_close(fd);
+
+    int tids[BENCH_FS_READERS];
+    uint64_t bytes = 0;
+    bench_reader_next = 0;
+    uint64_t start = timer_now();
+    for (int i = 0; i < BENCH_FS_READERS; i++) tids[i] = scheduler_spawn(bench_fs_reader);
+    for (int i = 0; i < BENCH_FS_READERS; i++) {
+        if (tids[i] < 0) continue;
+        scheduler_wait(tids[i]);
+        bytes += (uint64_t)BENCH_ITERS / BENCH_FS_READERS * BENCH_BUF_SIZE;
+    }
+    bench_report("fs_read_parallel", kib_per_sec(bytes, timer_now() - start), "KiB/s");
+    fs_delete("benchfile");
+}
+
+/* Producer for the pipe benchmark: streams BENCH_ITERS buffers, then hangs up. */
+static void bench_pipe_writer(void) {
+    for (int i = 0; i < BENCH_ITERS; i++) fs_write(bench_pipe_fd, bench_src, 512);
+    fs_close(bench_pipe_fd);
+}
+
+static void bench_pipe(void) {
+    int fds[2];
+    if (fs_pipe(fds) < 0) return;
+    bench_pipe_fd = fds[1];
+    if (scheduler_spawn(bench_pipe_writer) < 0) return;
+
+    uint64_t bytes = 0;
+    int n;
+    uint64_t start = timer_now();
+    while ((n = fs_read(fds[0], bench_dst, 512)) > 0) bytes += n;
+    bench_report("pipe_throughput", kib_per_sec(bytes, timer_now() - start), "KiB/s");
+    fs_close(fds[0]);
+}
+
+/*
+ * Partner for the channel benchmark. Word 0 of the channel holds a turn
+ * counter: even means it is the partner's turn, odd the benchmark's.
+ */
+static void bench_chan_partner(void) {
+    for (uint32_t turn = 0; turn < 2 * BENCH_ITERS; turn += 2) {
+        while (bench_chan[0] != turn) chan_wait(bench_chan, bench_chan[0]);
+        bench_chan[0] = turn + 1;
+        chan_wake(bench_chan);
+    }
+}
+
+/* Ping-pong through shared memory: a blocking handoff with no data copied. */
+static void bench_chan_pingpong(void) {
+    bench_chan = (volatile uint32_t *)chan_map(0);
+    if (!bench_chan) return;
+    bench_chan[0] = 0;
+    if (scheduler_spawn(bench_chan_partner) < 0) return;
+
+    uint64_t start = rdcycle();
+    for (uint32_t turn = 1; turn < 2 * BENCH_ITERS; turn += 2) {
+        while (bench_chan[0] != turn) chan_wait(bench_chan, bench_chan[0]);
+        bench_chan[0] = turn + 1;
+        chan_wake(bench_chan);
+    }
+    bench_report("chan_pingpong", (rdcycle() - start) / BENCH_ITERS, "cycles");
+}
+
+/* How late a timer sleep wakes up, averaged; one timer tick is 100 ns. */
+static void bench_sleep(void) {
+    uint64_t late = 0;
+    for (int i = 0; i < BENCH_SLEEPS; i++) {
+        uint64_t deadline = timer_now() + TIMER_US(BENCH_SLEEP_US);
+        timer_sleep_until(deadline);
+        late += timer_now() - deadline;
+    }
+    bench_report("sleep_overshoot", late * (1000000000 / TIMER_FREQ) / BENCH_SLEEPS, "ns");
+}
+
+/* Busy-waits for 'us' microseconds of CPU time. */
+static void bench_spin(uint64_t us) {
+    uint64_t end = timer_now() + TIMER_US(us);
+    while (timer_now() < end) {
+    }
+}
+
+/* Background load: takes the CPU in BENCH_EDF_HOG_US slices. */
+static void bench_edf_hog(void) {
+    while (!edf_done) {
+        bench_spin(BENCH_EDF_HOG_US);
+        scheduler_yield();
+    }
+}
+
+/* One periodic task of the set; its slot in bench_edf_set is found by id. */
+static void bench_edf_task(void) {
+    int me = 0;
+    while (bench_edf_tids[me] != scheduler_current()) me++;
+    while (!edf_done) {
+        bench_spin(bench_edf_set[me].work);
+        scheduler_end_job();
+    }
+}
+
+/*
+ * Runs the deadline task set next to BENCH_EDF_HOGS tasks that want all of
+ * the CPU, for BENCH_EDF_MS, and reports the rate of completed jobs and
+ * how many missed their deadline (0 when EDF and the budgets work).
+ */
+static void bench_edf(void) {
+    int hogs[BENCH_EDF_HOGS];
+    edf_done = 0;
+    for (int i = 0; i < BENCH_EDF_HOGS; i++) hogs[i] = scheduler_spawn(bench_edf_hog);
+    for (int i = 0; i < BENCH_EDF_TASKS; i++) {
+        bench_edf_tids[i] = scheduler_spawn(bench_edf_task);
+        if (bench_edf_tids[i] < 0 ||
+            scheduler_set_deadline(bench_edf_tids[i], bench_edf_set[i].runtime,
+                                   bench_edf_set[i].period, bench_edf_set[i].deadline) < 0) {
+            uart_puts("bench_edf: task set not admitted\n");
+        }
+    }
+
+    timer_sleep_us(BENCH_EDF_MS * 1000);
+    edf_done = 1;
+    uint64_t jobs = 0, misses = 0;
+    for (int i = 0; i < BENCH_EDF_TASKS; i++) {
+        task_info_t info;
+        if (bench_edf_tids[i] < 0 || scheduler_task_info(bench_edf_tids[i], &info) < 0) continue;
+        jobs += info.dl_jobs;
+        misses += info.dl_misses;
+    }
+    for (int i = 0; i < BENCH_EDF_TASKS; i++) {
+        if (bench_edf_tids[i] >= 0) scheduler_wait(bench_edf_tids[i]);
+    }
+    for (int i = 0; i < BENCH_EDF_HOGS; i++) {
+        if (hogs[i] >= 0) scheduler_wait(hogs[i]);
+    }
+    bench_report("edf_jobs", jobs * 1000 / BENCH_EDF_MS, "jobs/s");
+    bench_report("edf_missed", misses, "jobs");
+}
+
+/*
+ * Random 4KiB reads from the virtio disk with BENCH_BLK_DEPTH requests in
+ * flight: each completed request is resubmitted at once, and submissions
+ * made while waiting share one kick.
+ */
+static void bench_blk_rand(void) {
+    uint64_t sectors = virtio_blk_capacity();
+    if (sectors < 8) return;
+    uint64_t blocks = sectors / 8;
+    uint64_t seed = 1;
+
+    uint64_t start = timer_now();
+    int submitted = 0;
+    for (int i = 0; i < BENCH_BLK_IOS + BENCH_BLK_DEPTH; i++) {
+        virtio_blk_req_t *req = &bench_blk_reqs[i % BENCH_BLK_DEPTH];
+        if (i >= BENCH_BLK_DEPTH) virtio_blk_wait(req);
+        if (submitted == BENCH_BLK_IOS) continue;
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        req->write = 0;
+        req->sector = (seed >> 33) % blocks * 8;
+        req->nseg = 1;
+        req->seg[0].addr = bench_blk_pages[i % BENCH_BLK_DEPTH];
+        req->seg[0].len = 4096;
+        if (virtio_blk_submit(req) < 0) return;
+        submitted++;
+    }
+    uint64_t ticks = timer_now() - start;
+    if (ticks == 0) ticks = 1;
+    bench_report("blk_rand_read_4k", (uint64_t)BENCH_BLK_IOS * TIMER_FREQ / ticks, "ops/s");
+}
+
+/*
+ * Sequential 64KiB reads, each one request whose buffer is scattered over
+ * 16 separate pages.
+ */
+static void bench_blk_seq(void) {
+    const int segs = 16;
+    uint64_t sectors = virtio_blk_capacity();
+    uint64_t per_req = segs * 4096 / 512;
+    if (sectors < per_req * BENCH_BLK_SEQ_DEPTH) return;
+
+    uint64_t start = timer_now();
+    uint64_t sector = 0;
+    for (int i = 0; i < BENCH_BLK_IOS / segs + BENCH_BLK_SEQ_DEPTH; i++) {
+        virtio_blk_req_t *req = &bench_blk_reqs[i % BENCH_BLK_SEQ_DEPTH];
+        if (i >= BENCH_BLK_SEQ_DEPTH) virtio_blk_wait(req);
+        if (i >= BENCH_BLK_IOS / segs) continue;
+        if (sector + per_req > sectors) sector = 0;
+        req->write = 0;
+        req->sector = sector;
+        req->nseg = segs;
+        for (int j = 0; j < segs; j++) {
+            /* Pages in reverse order: the device does the gathering */
+            req->seg[j].addr = bench_blk_pages[(i % BENCH_BLK_SEQ_DEPTH) * segs + segs - 1 - j];
+            req->seg[j].len = 4096;
+        }
+        if (virtio_blk_submit(req) < 0) return;
+        sector += per_req;
+    }
+    bench_report("blk_seq_read", kib_per_sec((uint64_t)BENCH_BLK_IOS * 4096, timer_now() - start), "KiB/s");
+}
+
+static void bench_memcpy(void) {
+    uint64_t start = timer_now();
+    for (int i = 0; i < BENCH_ITERS; i++) memcpy(bench_dst, bench_src, BENCH_BUF_SIZE);
+    bench_report("memcpy", kib_per_sec((uint64_t)BENCH_ITERS * BENCH_BUF_SIZE, timer_now() - start), "KiB/s");
+}
+
+static void bench_uart(void) {
+    const char *line = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde\n";
+    uint64_t len = strlen(line);
+
+    uint64_t start = timer_now();
+    for (int i = 0; i < BENCH_UART_LINES; i++) uart_puts(line);
+    bench_report("uart_puts", kib_per_sec(BENCH_UART_LINES * len, timer_now() - start), "KiB/s");
+}
+
+/* Cost of a kernel message to the code that logs it: recorded (at a level
+ * kept off the console, so klogd has nothing to print), and filtered out
+ * by level. uart_puts above is what printing it synchronously costs. */
+static void bench_klog(void) {
+    int saved = klog_level;
+    klog_level = KLOG_DEBUG;
+    uint64_t start = rdcycle();
+    for (int i = 0; i < BENCH_ITERS; i++) klog(KLOG_DEBUG, "bench message %d at %p", i, (void *)bench_src);
+    bench_report("klog", (rdcycle() - start) / BENCH_ITERS, "cycles");
+
+    klog_level = KLOG_INFO;
+    start = rdcycle();
+    for (int i = 0; i < BENCH_ITERS; i++) klog(KLOG_DEBUG, "bench message %d at %p", i, (void *)bench_src);
+    bench_report("klog_filtered", (rdcycle() - start) / BENCH_ITERS, "cycles");
+    klog_level = saved;
+}
+
+/* Entry point of the benchmark kernel: runs every benchmark, then powers off. */
+void bench_run(void) {
+    extern uint64_t boot_time_start;
+    bench_report("boot_to_bench", (timer_now() - boot_time_start) / (TIMER_FREQ / 1000000), "us");
+
+    memset(bench_src, 'x', sizeof(bench_src));
+
+    bench_yield();
+    bench_null_syscall();
+    bench_vdso();
+    bench_fs();
+    bench_fs_parallel();
+    bench_pipe();
+    bench_chan_pingpong();
+    bench_sleep();
+    bench_edf();
+    bench_blk_rand();
+    bench_blk_seq();
+    bench_memcpy();
+    bench_uart();
+    bench_klog();
+
+    uart_puts("BENCH done\n");
+    sbi_call(SBI_SHUTDOWN, 0);
+}
@@ -0,0 +1,42 @@
+#include "chan.h"
+#include "futex.h"
+#include "kalloc.h"
+#include "scheduler.h"
+#include "string.h"
+#include "vm.h"
+#include <stdint.h>
+
+// Physical base of each channel's memory, allocated on first use. Channels
+// live as long as the kernel; the pages are contiguous so kernel tasks, which
+// run unpaged, can use them as one buffer.
+static uint64_t channels[MAX_CHANNELS];
+
+// Map channel 'id' into the calling task and return its address, or 0.
+// Kernel tasks get the physical address; programs get CHAN_USER_BASE + id * CHAN_SIZE.
+uint64_t chan_map(int id) {
+    if (id < 0 || id >= MAX_CHANNELS) return 0;
+    if (!channels[id]) {
+        void *mem = kalloc_pages(CHAN_PAGES);
+        if (!mem) return 0;
+        memset(mem, 0, CHAN_SIZE);
+        channels[id] = (uint64_t)mem;
+    }
+
+    task_t *task = scheduler_current_task();
+    if (!task || !task->space) return channels[id];
+    uint64_t va = CHAN_USER_BASE + id * CHAN_SIZE;
+    if (vm_map_shared(task->space, va, channels[id], CHAN_PAGES, VM_READ | VM_WRITE) < 0) return 0;
+    return va;
+}
+
+// Sleep until chan_wake on 'word', unless it no longer holds 'expected'.
+// Returns 0 after a wakeup, -1 if the value had already changed or the
+// task was killed meanwhile.
+int chan_wait(volatile uint32_t *word, uint32_t expected) {
+    return futex_wait(word, expected);
+}
+
+// Wake every task waiting on 'word'; returns how many were woken
+int chan_wake(volatile uint32_t *word) {
+    return futex_wake(word, MAX_TASKS);
+}
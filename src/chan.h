@@ -0,0 +1,20 @@
+#ifndef CHAN_H
+#define CHAN_H
+
+#include <stdint.h>
+
+// Shared-memory channels: numbered blocks of memory that every task mapping
+// the same channel id sees, so large messages need no copy at all. Tasks
+// agree on a protocol in the memory itself and use chan_wait/chan_wake on a
+// 32-bit word to sleep until the other side has made progress.
+#define MAX_CHANNELS 4
+#define CHAN_PAGES 16
+#define CHAN_SIZE (CHAN_PAGES * 4096UL)
+// Where channel i appears in a program's address space
+#define CHAN_USER_BASE 0x70000000UL
+
+uint64_t chan_map(int id);
+int chan_wait(volatile uint32_t *word, uint32_t expected);
+int chan_wake(volatile uint32_t *word);
+
+#endif
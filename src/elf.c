@@ -0,0 +1,96 @@
+#include "elf.h"
+#include "vm.h"
+#include "fs.h"
+#include "kalloc.h"
+#include "scheduler.h"
+#include "string.h"
+#include "vdso.h"
+#include "trap.h"
+#include <stdint.h>
+
+// First code of a loaded program's task: enter the program in U-mode on its
+// own stack. Returning from the program's entry point ends the task, with
+// the return value as its exit status. From here on traps go to the top of
+// the task's kernel stack; nothing on it is needed any more.
+static void elf_task_start(void) {
+    task_t *task = scheduler_current_task();
+    trap_enter_program(task->arg, 0, USER_STACK_TOP, (uint64_t)&task->stack[TASK_STACK_SIZE]);
+}
+
+// Describe one PT_LOAD segment as a demand-paged region of file 'ino'
+static int elf_add_segment(vm_space_t *space, const elf64_phdr_t *ph,
+                           int size, uint32_t ino) {
+    if (ph->p_filesz > ph->p_memsz ||
+        ph->p_offset + ph->p_filesz > (uint64_t)size ||
+        ph->p_vaddr < USER_BASE ||
+        ph->p_vaddr + ph->p_memsz > USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE ||
+        (ph->p_vaddr % PAGE_SIZE) != (ph->p_offset % PAGE_SIZE)) {
+        return -1;
+    }
+
+    int prot = 0;
+    if (ph->p_flags & PF_R) prot |= VM_READ;
+    if (ph->p_flags & PF_W) prot |= VM_WRITE;
+    if (ph->p_flags & PF_X) prot |= VM_EXEC;
+
+    return vm_add_region(space, ph->p_vaddr, ph->p_vaddr + ph->p_memsz, prot,
+                         ino, ph->p_offset, ph->p_filesz);
+}
+
+// Start the ELF executable stored in file 'name' as a new task.
+// Segments are only described here and paged in through the page cache on
+// first touch; read-only pages are the cache's own, shared by all instances
+// of a program and by readers of the file. Pages of a file deleted while
+// the program runs can no longer be paged in, and touching one is a fault.
+// Returns the task id, or -1 if the file is missing or not a loadable ELF.
+int elf_spawn(const char *name) {
+    int size;
+    const char *data = fs_get_file_content(name, &size);
+    uint32_t ino = fs_get_inode(name);
+    if (!data || !ino || size < (int)sizeof(elf64_ehdr_t)) {
+        return -1;
+    }
+
+    // File data has no alignment guarantee, so copy the headers out
+    elf64_ehdr_t eh;
+    memcpy(&eh, data, sizeof(eh));
+    uint32_t magic;
+    memcpy(&magic, eh.e_ident, sizeof(magic));
+    if (magic != ELF_MAGIC || eh.e_ident[4] != ELFCLASS64 || eh.e_ident[5] != ELFDATA2LSB ||
+        eh.e_type != ET_EXEC || eh.e_machine != EM_RISCV ||
+        eh.e_phentsize != sizeof(elf64_phdr_t) ||
+        eh.e_phoff + (uint64_t)eh.e_phnum * sizeof(elf64_phdr_t) > (uint64_t)size) {
+        return -1;
+    }
+
+    vm_space_t *space = vm_space_create();
+    if (!space) {
+        return -1;
+    }
+
+    for (int i = 0; i < eh.e_phnum; i++) {
+        elf64_phdr_t ph;
+        memcpy(&ph, data + eh.e_phoff + i * sizeof(ph), sizeof(ph));
+        if (ph.p_type == PT_LOAD && ph.p_memsz && elf_add_segment(space, &ph, size, ino) < 0) {
+            vm_space_put(space);
+            return -1;
+        }
+    }
+
+    // The stack fills in on first touch; the kernel's read-only data page
+    // (vdso.h) is mapped right away
+    uint64_t stack_base = USER_STACK_TOP - USER_STACK_PAGES * PAGE_SIZE;
+    if (vm_add_region(space, stack_base, USER_STACK_TOP, VM_READ | VM_WRITE | VM_STACK, 0, 0, 0) < 0 ||
+        vdso_map(space) < 0) {
+        vm_space_put(space);
+        return -1;
+    }
+
+    int tid = scheduler_spawn_in(space, elf_task_start, eh.e_entry);
+    if (tid < 0) {
+        vm_space_put(space);
+    } else {
+        scheduler_set_name(tid, name);
+    }
+    return tid;
+}
@@ -0,0 +1,49 @@
+#ifndef ELF_H
+#define ELF_H
+
+#include <stdint.h>
+
+// ELF64 definitions needed to load statically linked RISC-V executables
+#define ELF_MAGIC 0x464c457fU   // "\x7fELF" read as a little-endian word
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+#define ET_EXEC 2
+#define EM_RISCV 243
+#define PT_LOAD 1
+
+// Segment permission flags
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+typedef struct {
+    uint8_t e_ident[16];
+    uint16_t e_type;
+    uint16_t e_machine;
+    uint32_t e_version;
+    uint64_t e_entry;
+    uint64_t e_phoff;
+    uint64_t e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize;
+    uint16_t e_phentsize;
+    uint16_t e_phnum;
+    uint16_t e_shentsize;
+    uint16_t e_shnum;
+    uint16_t e_shstrndx;
+} elf64_ehdr_t;
+
+typedef struct {
+    uint32_t p_type;
+    uint32_t p_flags;
+    uint64_t p_offset;
+    uint64_t p_vaddr;
+    uint64_t p_paddr;
+    uint64_t p_filesz;
+    uint64_t p_memsz;
+    uint64_t p_align;
+} elf64_phdr_t;
+
+int elf_spawn(const char *name);
+
+#endif
@@ -0,0 +1,183 @@
+#include "fdt.h"
+#include "string.h"
+#include <stdint.h>
+
+// Flattened device tree format (devicetree specification, chapter 5)
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_BEGIN_NODE 1
+#define FDT_END_NODE 2
+#define FDT_PROP 3
+#define FDT_NOP 4
+#define FDT_END 9
+
+// Deepest node nesting we track; the QEMU virt tree goes four levels deep
+#define FDT_MAX_DEPTH 8
+
+// Header at the start of the blob; all fields are big-endian
+typedef struct {
+    uint32_t magic;
+    uint32_t totalsize;
+    uint32_t off_dt_struct;
+    uint32_t off_dt_strings;
+    uint32_t off_mem_rsvmap;
+    uint32_t version;
+    uint32_t last_comp_version;
+    uint32_t boot_cpuid_phys;
+    uint32_t size_dt_strings;
+    uint32_t size_dt_struct;
+} fdt_header_t;
+
+// Properties of the node being scanned that we care about
+typedef struct {
+    char compatible[FDT_MAX_COMPAT];
+    int is_memory;
+    int is_cpu;
+    int disabled;
+    int has_reg;
+    uint64_t reg_base;
+    uint64_t reg_size;
+    uint32_t irq;
+} fdt_node_t;
+
+fdt_info_t boot_fdt;
+
+static uint32_t be32(const void *p) {
+    const uint8_t *b = p;
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+// Reads a value made of 'cells' big-endian 32-bit cells
+static uint64_t read_cells(const uint8_t *p, int cells) {
+    uint64_t v = 0;
+    for (int i = 0; i < cells; i++) v = (v << 32) | be32(p + 4 * i);
+    return v;
+}
+
+static uint32_t align4(uint32_t x) {
+    return (x + 3) & ~3u;
+}
+
+// Returns 1 if 'ext' occurs in an ISA string or extension list property.
+// Extension names are separated by '_' or NUL, so a substring check is enough
+// for the multi-letter names we look for.
+static int fdt_has_ext(const uint8_t *val, uint32_t len, const char *ext) {
+    uint64_t n = strlen(ext);
+    for (uint32_t i = 0; i + n <= len; i++) {
+        if (strncmp((const char *)val + i, ext, n) == 0) return 1;
+    }
+    return 0;
+}
+
+// Files a finished node into 'info'
+static void fdt_finish_node(fdt_info_t *info, const fdt_node_t *node) {
+    if (node->disabled) return;
+    if (node->is_cpu) {
+        info->nharts++;
+    } else if (node->is_memory) {
+        if (node->has_reg && !info->ram_size) {
+            info->ram_base = node->reg_base;
+            info->ram_size = node->reg_size;
+        }
+    } else if (node->has_reg && node->compatible[0] && info->ndevices < FDT_MAX_DEVICES) {
+        fdt_device_t *dev = &info->devices[info->ndevices++];
+        strncpy(dev->compatible, node->compatible, FDT_MAX_COMPAT - 1);
+        dev->compatible[FDT_MAX_COMPAT - 1] = 0;
+        dev->base = node->reg_base;
+        dev->size = node->reg_size;
+        dev->irq = node->irq;
+    }
+}
+
+// Parses the device tree blob in one pass over the structure block.
+// Records RAM, the number of harts, the timebase and every device node
+// that has both 'compatible' and 'reg'. Returns 0 on success, -1 if the
+// blob is missing or malformed.
+int fdt_parse(const void *dtb, fdt_info_t *info) {
+    const fdt_header_t *hdr = dtb;
+    if (!dtb || be32(&hdr->magic) != FDT_MAGIC) {
+        return -1;
+    }
+
+    const uint8_t *base = dtb;
+    const uint8_t *p = base + be32(&hdr->off_dt_struct);
+    const uint8_t *end = p + be32(&hdr->size_dt_struct);
+    const char *strings = (const char *)base + be32(&hdr->off_dt_strings);
+
+    // #address-cells/#size-cells a node declares for its children,
+    // indexed by the node's depth (spec defaults: 2 and 1)
+    int addr_cells[FDT_MAX_DEPTH + 1];
+    int size_cells[FDT_MAX_DEPTH + 1];
+    fdt_node_t nodes[FDT_MAX_DEPTH + 1];
+    int depth = -1;
+
+    while (p < end) {
+        uint32_t token = be32(p);
+        p += 4;
+
+        if (token == FDT_BEGIN_NODE) {
+            const char *name = (const char *)p;
+            p += align4(strlen(name) + 1);
+            if (++depth > FDT_MAX_DEPTH) return -1;
+            addr_cells[depth] = 2;
+            size_cells[depth] = 1;
+            memset(&nodes[depth], 0, sizeof(fdt_node_t));
+            // /memory@... nodes are identified by name as well as device_type
+            nodes[depth].is_memory = strncmp(name, "memory", 6) == 0;
+        } else if (token == FDT_END_NODE) {
+            if (depth < 0) return -1;
+            fdt_finish_node(info, &nodes[depth]);
+            depth--;
+        } else if (token == FDT_PROP) {
+            uint32_t len = be32(p);
+            const char *pname = strings + be32(p + 4);
+            const uint8_t *val = p + 8;
+            p += 8 + align4(len);
+            if (depth < 0) return -1;
+
+            fdt_node_t *node = &nodes[depth];
+            int pac = depth > 0 ? addr_cells[depth - 1] : 2;
+            int psc = depth > 0 ? size_cells[depth - 1] : 1;
+
+            if (strcmp(pname, "#address-cells") == 0) {
+                addr_cells[depth] = be32(val);
+            } else if (strcmp(pname, "#size-cells") == 0) {
+                size_cells[depth] = be32(val);
+            } else if (strcmp(pname, "compatible") == 0) {
+                strncpy(node->compatible, (const char *)val, FDT_MAX_COMPAT - 1);
+            } else if (strcmp(pname, "device_type") == 0) {
+                if (strcmp((const char *)val, "memory") == 0) node->is_memory = 1;
+                if (strcmp((const char *)val, "cpu") == 0) node->is_cpu = 1;
+            } else if (strcmp(pname, "status") == 0) {
+                node->disabled = strcmp((const char *)val, "okay") != 0 &&
+                                 strcmp((const char *)val, "ok") != 0;
+            } else if (strcmp(pname, "reg") == 0 && len >= 4u * (pac + psc)) {
+                node->has_reg = 1;
+                node->reg_base = read_cells(val, pac);
+                node->reg_size = read_cells(val + 4 * pac, psc);
+            } else if (strcmp(pname, "interrupts") == 0 && len >= 4) {
+                node->irq = be32(val);
+            } else if (strcmp(pname, "riscv,isa") == 0 || strcmp(pname, "riscv,isa-extensions") == 0) {
+                if (fdt_has_ext(val, len, "sstc")) info->has_sstc = 1;
+            } else if (strcmp(pname, "timebase-frequency") == 0) {
+                info->timebase_freq = read_cells(val, len >= 8 ? 2 : 1);
+            }
+        } else if (token == FDT_NOP) {
+            continue;
+        } else if (token == FDT_END) {
+            return 0;
+        } else {
+            return -1;  // Unknown token
+        }
+    }
+    return 0;
+}
+
+// Returns the index-th device whose compatible string matches, or 0
+const fdt_device_t *fdt_find_device(const fdt_info_t *info, const char *compatible, int index) {
+    for (int i = 0; i < info->ndevices; i++) {
+        if (strcmp(info->devices[i].compatible, compatible) == 0 && index-- == 0) {
+            return &info->devices[i];
+        }
+    }
+    return 0;
+}
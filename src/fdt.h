@@ -0,0 +1,35 @@
+#ifndef FDT_H
+#define FDT_H
+
+#include <stdint.h>
+
+// Limits for what the boot-time device tree scan records
+#define FDT_MAX_DEVICES 32
+#define FDT_MAX_COMPAT 32
+
+// One memory-mapped device found under the device tree
+typedef struct {
+    char compatible[FDT_MAX_COMPAT];  // First string of the 'compatible' property
+    uint64_t base;                    // First 'reg' entry
+    uint64_t size;
+    uint32_t irq;                     // First 'interrupts' cell, 0 if none
+} fdt_device_t;
+
+// Machine description gathered from the flattened device tree
+typedef struct {
+    uint64_t ram_base;
+    uint64_t ram_size;
+    int nharts;
+    uint64_t timebase_freq;
+    int has_sstc;                     // Harts implement Sstc (stimecmp CSR)
+    int ndevices;
+    fdt_device_t devices[FDT_MAX_DEVICES];
+} fdt_info_t;
+
+// Filled in by kmain from the device tree OpenSBI hands over
+extern fdt_info_t boot_fdt;
+
+int fdt_parse(const void *dtb, fdt_info_t *info);
+const fdt_device_t *fdt_find_device(const fdt_info_t *info, const char *compatible, int index);
+
+#endif
@@ -0,0 +1,128 @@
+#include "fpu.h"
+#include "kalloc.h"
+#include "string.h"
+#include "trap.h"
+#include <stdint.h>
+
+#ifdef CONFIG_FPU
+
+// Lazy FP and vector switching. A task switched in starts with FS and VS
+// Off, so integer-only tasks never have their registers saved or loaded.
+// The first FP or vector instruction traps as illegal, and fpu_first_use
+// loads the task's registers. On the way out they are saved only if
+// sstatus says they were written.
+
+// In fpu_regs.S
+extern void fpu_save_regs(fpu_state_t *s);
+extern void fpu_load_regs(const fpu_state_t *s);
+#ifdef CONFIG_VECTOR
+extern void vec_save_regs(fpu_state_t *s);
+extern void vec_load_regs(const fpu_state_t *s);
+#define SSTATUS_LAZY (SSTATUS_FS | SSTATUS_VS)
+#else
+#define SSTATUS_LAZY SSTATUS_FS
+#endif
+
+// Task whose values are in the registers. Only it can run with FS on.
+static task_t *owner;
+// Bits turned on for a task using the registers: FS, plus VS if the hart
+// has a vector unit whose registers fit the page (found on first use)
+static uint64_t clean_bits;
+
+static inline uint64_t sstatus_read(void) {
+    uint64_t s;
+    asm volatile("csrr %0, sstatus" : "=r"(s));
+    return s;
+}
+
+static inline void sstatus_set(uint64_t bits) {
+    asm volatile("csrs sstatus, %0" :: "r"(bits) : "memory");
+}
+
+static inline void sstatus_clear(uint64_t bits) {
+    asm volatile("csrc sstatus, %0" :: "r"(bits) : "memory");
+}
+
+static void fpu_probe(void) {
+    clean_bits = SSTATUS_FS_CLEAN;
+#ifdef CONFIG_VECTOR
+    // VS is WARL: it reads back as 0 without a vector unit
+    sstatus_set(SSTATUS_VS_CLEAN);
+    if (sstatus_read() & SSTATUS_VS) {
+        uint64_t vlenb;
+        asm volatile("csrr %0, 0xc22" : "=r"(vlenb));  // vlenb
+        if (FPU_VEC_OFFSET + 32 * vlenb <= PAGE_SIZE) clean_bits |= SSTATUS_VS_CLEAN;
+    }
+    sstatus_clear(SSTATUS_VS);
+#endif
+}
+
+// Save the owner's registers if it wrote them, leaving them clean
+static void fpu_save(task_t *t) {
+    uint64_t s = sstatus_read();
+    if ((s & SSTATUS_FS) == SSTATUS_FS_DIRTY) fpu_save_regs(t->fpu);
+#ifdef CONFIG_VECTOR
+    if ((s & SSTATUS_VS) == SSTATUS_VS_DIRTY) vec_save_regs(t->fpu);
+#endif
+    sstatus_clear(SSTATUS_LAZY);
+    sstatus_set(s & clean_bits);
+}
+
+// Called by the scheduler on every switch, with interrupts off
+void fpu_switch(task_t *prev, task_t *next) {
+    if (prev && prev == owner) fpu_save(prev);
+    sstatus_clear(SSTATUS_LAZY);
+    // Back to the owner: its registers are still loaded, so no trap needed
+    if (next && next == owner) sstatus_set(clean_bits);
+}
+
+// Illegal instruction trap: if it came from a program whose FP and vector
+// registers are off, load them and return 1 so the instruction is retried.
+int fpu_first_use(uint64_t *tf) {
+    (void)tf;
+    task_t *t = scheduler_current_task();
+    if (!t || !t->space || (sstatus_read() & SSTATUS_FS)) return 0;
+    if (!clean_bits) fpu_probe();
+    if (!t->fpu && !(t->fpu = kzalloc())) return 0;
+
+    sstatus_set(clean_bits);
+    if (owner != t) {
+        fpu_load_regs(t->fpu);
+#ifdef CONFIG_VECTOR
+        if (clean_bits & SSTATUS_VS) vec_load_regs(t->fpu);
+#endif
+        owner = t;
+    }
+    // Loading marked them dirty, but they match the saved copy
+    sstatus_clear(SSTATUS_LAZY);
+    sstatus_set(clean_bits);
+    return 1;
+}
+
+// sret restores sstatus from the trap frame. Whatever happened during the
+// trap (a first use, a switch away and back), FS and VS must come back as
+// they are now.
+void fpu_trap_return(uint64_t *tf) {
+    uint64_t *st = &tf[TF_SSTATUS/8];
+    *st = (*st & ~SSTATUS_LAZY) | (sstatus_read() & SSTATUS_LAZY);
+}
+
+// Give a forked child a copy of the parent's registers. Returns -1 if there
+// is no memory for it.
+int fpu_fork(task_t *parent, task_t *child) {
+    if (!parent->fpu) return 0;
+    if (parent == owner) fpu_save(parent);
+    child->fpu = kalloc();
+    if (!child->fpu) return -1;
+    memcpy(child->fpu, parent->fpu, PAGE_SIZE);
+    return 0;
+}
+
+// The task slot is reused: forget the old task's registers
+void fpu_release(task_t *t) {
+    if (owner == t) owner = 0;
+    if (t->fpu) kfree(t->fpu);
+    t->fpu = 0;
+}
+
+#endif
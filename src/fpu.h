@@ -0,0 +1,40 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "scheduler.h"
+#include <stdint.h>
+
+// sstatus.FS and sstatus.VS track the FP and vector registers: Off (any
+// use traps), Initial, Clean (loaded, unchanged) or Dirty (written since).
+#define SSTATUS_FS (3UL << 13)
+#define SSTATUS_FS_CLEAN (2UL << 13)
+#define SSTATUS_FS_DIRTY (3UL << 13)
+#define SSTATUS_VS (3UL << 9)
+#define SSTATUS_VS_CLEAN (2UL << 9)
+#define SSTATUS_VS_DIRTY (3UL << 9)
+
+// Saved FP and vector registers of a task: one page, allocated when the
+// task first uses either. fpu_regs.S hard-codes this layout.
+#define FPU_VEC_OFFSET 512  // Vector registers start here, 32 x vlenb bytes
+typedef struct fpu_state {
+    uint64_t f[32];
+    uint64_t fcsr;
+    uint64_t vl, vtype, vstart, vcsr;
+} fpu_state_t;
+
+#ifdef CONFIG_FPU
+void fpu_switch(task_t *prev, task_t *next);
+int fpu_first_use(uint64_t *tf);
+void fpu_trap_return(uint64_t *tf);
+int fpu_fork(task_t *parent, task_t *child);
+void fpu_release(task_t *t);
+#else
+// Integer-only build: FS and VS stay Off and there is nothing to switch
+static inline void fpu_switch(task_t *prev, task_t *next) { (void)prev; (void)next; }
+static inline int fpu_first_use(uint64_t *tf) { (void)tf; return 0; }
+static inline void fpu_trap_return(uint64_t *tf) { (void)tf; }
+static inline int fpu_fork(task_t *parent, task_t *child) { (void)parent; (void)child; return 0; }
+static inline void fpu_release(task_t *t) { (void)t; }
+#endif
+
+#endif
@@ -1,5 +1,13 @@
 #include "fs.h"
+#include "initramfs.h"
+#include "pipe.h"
+#include "net.h"
+#include "pcache.h"
+#include "lz4.h"
+#include "kalloc.h"
+#include "rwlock.h"
 #include "string.h"
+#include "uaccess.h"
 #include <stdint.h>
 
 // File metadata structure
@@ -9,7 +17,10 @@ typedef struct {
     int size;
     int capacity;
     int in_use;
-    int is_embedded;  // 1 if data points to embedded (read-only) data
+    int is_embedded;  // 1 while data points into the initramfs image (copied on the first write)
+    int compressed;   // Contents live in the compressed store; data is 0
+    uint32_t ino;     // Inode number: names the file's pages in the page cache
+    rwlock_t lock;    // Shared by reads; exclusive for writes and storage changes
 } file_t;
 
 // File descriptor entry
@@ -18,68 +29,110 @@ typedef struct {
     int position;        // Current read/write position
     int flags;           // Open flags (read/write)
     int in_use;          // Whether this FD is in use
+    int pipe;            // Pipe index + 1 for pipe ends, 0 for files
+    int sock;            // Socket index + 1 for UDP sockets, 0 otherwise
+    int ra_next;         // Position a sequential read would continue from
+    int ra_window;       // Current read-ahead window in pages
+    rwlock_t lock;       // Held exclusively across each call on the descriptor
 } fd_entry_t;
 
+// Locks, outermost first:
+// - ns_lock covers the namespace: names, in_use and ino of files[], and the
+//   buffers of free slots. Lookups by name share it; create and delete take
+//   it exclusively.
+// - An fd's lock keeps its position consistent across a read, write or seek.
+//   Pipes and sockets let go of it before they block.
+// - A file's lock covers its size and contents, so any number of tasks can
+//   read the same or different files at once while writes stay whole.
+// - zstore_lock covers the compressed store; the page cache has its own.
+// The page cache calls back in (fs_fill_page) with the file lock possibly
+// held shared, never with a lock of its own held.
+static rwlock_t ns_lock;
+
 // File system storage
 static file_t files[MAX_FILES];
 static fd_entry_t fd_table[MAX_OPEN_FDS];
-static int next_fd = 3;  // Start at 3 (0,1,2 reserved for stdin, stdout, stderr)
+static uint32_t next_ino = 1;  // Never reused, so stale cached pages can't match
 
 // File data storage pool (one buffer per file slot)
 static char file_data_pool[MAX_FILES][MAX_FILE_SIZE];
 static int pool_allocated[MAX_FILES];  // Track which slots are allocated
 
-// External program data (for initial files)
-extern const char _prog_hello[];
-extern const char _prog_echo[];
+// One block of a compressed file in the store; len 0 if not stored
+typedef struct {
+    uint32_t off;
+    uint16_t len;
+    uint16_t raw;     // Stored as is: compression would not have saved anything
+} zblock_t;
 
+#define ZSTORE_UNITS (FS_ZSTORE_SIZE / FS_ZUNIT)
+#if FS_ZBLOCK_SIZE != PAGE_SIZE
+#error "compressed blocks are filled in as page cache pages"
+#endif
 
-// Initialize file system
-int fs_init(void) {
-    // Clear all files
-    for (int i = 0; i < MAX_FILES; i++) {
-        files[i].in_use = 0;
-        files[i].name[0] = 0;
-        files[i].data = 0;
-        files[i].size = 0;
-        files[i].capacity = 0;
-        files[i].is_embedded = 0;
-    }
-    
-    // Clear allocation tracking
-    for (int i = 0; i < MAX_FILES; i++) {
-        pool_allocated[i] = 0;
-    }
-    
-    // Clear file descriptor table
-    for (int i = 0; i < MAX_OPEN_FDS; i++) {
-        fd_table[i].in_use = 0;
-        fd_table[i].file_index = -1;
-        fd_table[i].position = 0;
-        fd_table[i].flags = 0;
+// Compressed store: block tables per file slot and the space they point to
+static zblock_t zblocks[MAX_FILES][FS_ZMAX_BLOCKS];
+static char zstore[FS_ZSTORE_SIZE];
+static uint64_t zstore_map[ZSTORE_UNITS / 64];  // One bit per allocated unit
+static int zstore_used;
+// Scratch for compressing and patching one block. zstore_lock covers them
+// along with the store, so one of each is enough (and kernel stacks are too
+// small).
+static char zbuf[FS_ZBLOCK_SIZE];
+static char zscratch[FS_ZBLOCK_SIZE];
+static rwlock_t zstore_lock;  // Only ever taken exclusively
+
+// Set once fs_init has run; every entry point initializes on first use
+static int fs_ready;
+
+// Seed the tables from the initramfs archive; the namespace is locked
+static int fs_seed(void) {
+    const initramfs_header_t *hdr = (const initramfs_header_t *)fs_initramfs_start;
+    uint64_t len = fs_initramfs_end - fs_initramfs_start;
+    if (len < sizeof(*hdr) || hdr->magic != INITRAMFS_MAGIC || hdr->size > len ||
+        hdr->count > (hdr->size - sizeof(*hdr)) / sizeof(initramfs_entry_t)) {
+        return -1;
     }
-    
-    // Create initial files from embedded data
-    const char *initial_names[] = {"hello", "echo"};
-    const char *initial_data[] = {_prog_hello, _prog_echo};
-    
-    for (int i = 0; i < 2; i++) {
-        int idx = i;
-        strncpy(files[idx].name, initial_names[i], MAX_FILENAME_LEN - 1);
+    const initramfs_entry_t *ent = (const initramfs_entry_t *)(hdr + 1);
+    int idx = 0;
+    for (uint32_t i = 0; i < hdr->count && idx < MAX_FILES; i++) {
+        if (ent[i].offset > hdr->size || ent[i].size > hdr->size - ent[i].offset ||
+            ent[i].size > 0x7fffffff) {
+            continue;  // Points outside the archive
+        }
+        strncpy(files[idx].name, ent[i].name, MAX_FILENAME_LEN - 1);
         files[idx].name[MAX_FILENAME_LEN - 1] = 0;
-        
-        int len = strlen(initial_data[i]);
-        files[idx].size = len;
-        files[idx].capacity = len + 1;
-        files[idx].data = (char *)initial_data[i];  // Point to embedded data
-        files[idx].is_embedded = 1;  // Mark as read-only embedded data
+        files[idx].size = ent[i].size;
+        files[idx].capacity = ent[i].size;
+        files[idx].data = (char *)fs_initramfs_start + ent[i].offset;
+        files[idx].is_embedded = 1;
+        files[idx].ino = next_ino++;
         files[idx].in_use = 1;
+        idx++;
     }
-    
     return 0;
 }
 
-// Find a file by name
+// Initialize file system
+// The tables start out zeroed in .bss, so only the initial files need seeding:
+// one pass over the entry table of the initramfs archive. The file data stays
+// where it is in the image. Only the first call seeds. Returns -1 if the
+// archive is missing or damaged.
+int fs_init(void) {
+    rwlock_write_lock(&ns_lock);
+    int r = fs_ready ? 0 : fs_seed();
+    __atomic_store_n(&fs_ready, 1, __ATOMIC_RELEASE);
+    rwlock_write_unlock(&ns_lock);
+    return r;
+}
+
+// Initialize the file system on first use. Calls that take an fd skip
+// this, since an fd can only come from fs_open.
+static inline void fs_lazy_init(void) {
+    if (!__atomic_load_n(&fs_ready, __ATOMIC_ACQUIRE)) fs_init();
+}
+
+// Find a file by name; the namespace is locked
 static int find_file(const char *name) {
     for (int i = 0; i < MAX_FILES; i++) {
         if (files[i].in_use && strcmp(files[i].name, name) == 0) {
@@ -99,12 +152,53 @@ static int find_empty_file_slot(void) {
     return -1;
 }
 
-// Find an empty file descriptor slot
-static int find_empty_fd_slot(void) {
+// Claim a free file descriptor and set it up; returns the fd or -1
+static int fd_alloc(int file_index, int flags, int pipe, int sock) {
     for (int i = 0; i < MAX_OPEN_FDS; i++) {
-        if (!fd_table[i].in_use) {
-            return i;
+        fd_entry_t *f = &fd_table[i];
+        if (__atomic_load_n(&f->in_use, __ATOMIC_RELAXED)) continue;
+        rwlock_write_lock(&f->lock);
+        if (f->in_use) {
+            rwlock_write_unlock(&f->lock);  // Taken meanwhile
+            continue;
         }
+        f->file_index = file_index;
+        f->position = 0;
+        f->flags = flags;
+        f->pipe = pipe;
+        f->sock = sock;
+        f->ra_next = 0;
+        f->ra_window = 0;
+        __atomic_store_n(&f->in_use, 1, __ATOMIC_RELAXED);
+        rwlock_write_unlock(&f->lock);
+        return i + 3;
+    }
+    return -1;
+}
+
+// Lock the entry of an open 'fd' and return it, or 0 if it is not open
+static fd_entry_t *fd_lock(int fd) {
+    if (fd < 3 || fd >= 3 + MAX_OPEN_FDS) {
+        return 0;
+    }
+    fd_entry_t *f = &fd_table[fd - 3];
+    rwlock_write_lock(&f->lock);
+    if (!f->in_use) {
+        rwlock_write_unlock(&f->lock);
+        return 0;
+    }
+    return f;
+}
+
+// Find a live file by inode number without the namespace lock and return
+// its index with the file locked shared, or -1. A slot can be reused while
+// it is scanned, so the match is checked again under the lock.
+static int lock_inode(uint32_t ino) {
+    for (int i = 0; i < MAX_FILES; i++) {
+        if (__atomic_load_n(&files[i].ino, __ATOMIC_RELAXED) != ino) continue;
+        rwlock_read_lock(&files[i].lock);
+        if (files[i].in_use && files[i].ino == ino) return i;
+        rwlock_read_unlock(&files[i].lock);
     }
     return -1;
 }
@@ -113,6 +207,9 @@ static int find_empty_fd_slot(void) {
 static char file_data_pool[MAX_FILES][MAX_FILE_SIZE];
 static int pool_allocated[MAX_FILES];  // Track which slots are allocated
 
+// A slot's pool entry belongs to the namespace lock while the slot is free
+// and to the file lock while it is in use.
+
 // Allocate memory for file data (returns pointer to a file's buffer)
 static char* allocate_file_data(int file_index) {
     if (file_index < 0 || file_index >= MAX_FILES) {
@@ -134,224 +231,578 @@ static void free_file_data(int file_index) {
     }
 }
 
+// Copy-on-write for a file still served from the initramfs image: move its
+// data into the slot's own buffer. Pages of the image that are already
+// mapped somewhere keep the original contents. The file is locked
+// exclusively.
+static int promote_file(int idx) {
+    file_t *file = &files[idx];
+    if (file->size > MAX_FILE_SIZE) {
+        return -1;  // Too big for a file buffer
+    }
+    char *data = allocate_file_data(idx);
+    if (!data) {
+        return -1;
+    }
+    memcpy(data, file->data, file->size);
+    file->data = data;
+    file->capacity = MAX_FILE_SIZE;
+    file->is_embedded = 0;
+    return 0;
+}
+
+// First fit of 'len' bytes in the compressed store; returns the offset or -1.
+// The zstore_* and zblock_* helpers run with zstore_lock held.
+static int zstore_alloc(int len) {
+    int n = (len + FS_ZUNIT - 1) / FS_ZUNIT;
+    int run = 0;
+    for (int u = 0; u < ZSTORE_UNITS; u++) {
+        if (zstore_map[u / 64] & (1ull << (u % 64))) {
+            run = 0;
+            continue;
+        }
+        if (++run < n) continue;
+        for (int v = u - n + 1; v <= u; v++) {
+            zstore_map[v / 64] |= 1ull << (v % 64);
+        }
+        zstore_used += n * FS_ZUNIT;
+        return (u - n + 1) * FS_ZUNIT;
+    }
+    return -1;
+}
+
+static void zblock_free(zblock_t *zb) {
+    if (!zb->len) return;
+    int n = (zb->len + FS_ZUNIT - 1) / FS_ZUNIT;
+    for (int u = zb->off / FS_ZUNIT; n > 0; u++, n--) {
+        zstore_map[u / 64] &= ~(1ull << (u % 64));
+    }
+    zstore_used -= (zb->len + FS_ZUNIT - 1) / FS_ZUNIT * FS_ZUNIT;
+    zb->len = 0;
+}
+
+static void zfile_free(int idx) {
+    for (int b = 0; b < FS_ZMAX_BLOCKS; b++) zblock_free(&zblocks[idx][b]);
+}
+
+// Bytes of block 'b' that lie within the file
+static int zblock_bytes(const file_t *file, int b) {
+    int n = file->size - b * FS_ZBLOCK_SIZE;
+    if (n < 0) return 0;
+    return n < FS_ZBLOCK_SIZE ? n : FS_ZBLOCK_SIZE;
+}
+
+// Replace block 'b' of file 'idx' with the 'len' bytes at 'src'. The old
+// block is only released once the new one is in, so a full store leaves
+// the file as it was. Returns -1 if the store is full.
+static int zblock_store(int idx, int b, const char *src, int len) {
+    zblock_t *zb = &zblocks[idx][b];
+    // Keep the block raw unless compressing saves at least a byte
+    int clen = lz4_compress(src, len, zbuf, len - 1);
+    int raw = clen < 0;
+    if (raw) clen = len;
+    int off = zstore_alloc(clen);
+    if (off < 0) return -1;
+    memcpy(zstore + off, raw ? src : zbuf, clen);
+    zblock_free(zb);
+    zb->off = off;
+    zb->len = clen;
+    zb->raw = raw;
+    return 0;
+}
+
+// Decompress block 'b' of file 'idx' into a whole block at 'out'; bytes
+// past the stored data are zero. Returns -1 if the block is damaged.
+static int zblock_load(int idx, int b, char *out) {
+    const zblock_t *zb = &zblocks[idx][b];
+    int n = 0;
+    if (zb->len && zb->raw) {
+        memcpy(out, zstore + zb->off, zb->len);
+        n = zb->len;
+    } else if (zb->len) {
+        n = lz4_decompress(zstore + zb->off, zb->len, out, FS_ZBLOCK_SIZE);
+        if (n < 0) return -1;
+    }
+    memset(out + n, 0, FS_ZBLOCK_SIZE - n);
+    return 0;
+}
+
+// Write to a compressed file: every block the write touches is
+// decompressed, patched and compressed again. Returns the bytes written,
+// or -1 if the store had no room for any of them.
+static int zfile_write(int idx, int pos, const char *buf, int len) {
+    file_t *file = &files[idx];
+    int done = 0;
+    while (done < len) {
+        int b = (pos + done) / FS_ZBLOCK_SIZE;
+        int off = (pos + done) % FS_ZBLOCK_SIZE;
+        int n = FS_ZBLOCK_SIZE - off;
+        if (n > len - done) n = len - done;
+        int old = zblock_bytes(file, b);
+        if (zblock_load(idx, b, zscratch) < 0) break;
+        memcpy(zscratch + off, buf + done, n);
+        if (zblock_store(idx, b, zscratch, off + n > old ? off + n : old) < 0) break;
+        done += n;
+        if (pos + done > file->size) file->size = pos + done;
+    }
+    return done ? done : -1;
+}
+
+// Switch a file between plain and compressed storage. A compressed file
+// gives up its buffer (or its place in the initramfs image) and may grow
+// to FS_ZMAX_BLOCKS blocks; reads decompress only the blocks they touch,
+// and the page cache keeps the decompressed ones. It can go back to plain
+// storage while it fits a file buffer. Compressed files have no contiguous
+// contents, so they can't be run as programs.
+// Returns -1 if there is no such file, it is too big, or the store is full.
+int fs_compress(const char *name, int on) {
+    fs_lazy_init();
+    rwlock_read_lock(&ns_lock);
+    int idx = find_file(name);
+    if (idx < 0) {
+        rwlock_read_unlock(&ns_lock);
+        return -1;
+    }
+    file_t *file = &files[idx];
+    rwlock_write_lock(&file->lock);
+    rwlock_write_lock(&zstore_lock);
+    int r = 0;
+    int nblocks = (file->size + FS_ZBLOCK_SIZE - 1) / FS_ZBLOCK_SIZE;
+    if (!on == !file->compressed) {
+        // Nothing to do
+    } else if (on) {
+        for (int b = 0; b < nblocks && r == 0; b++) {
+            if (nblocks > FS_ZMAX_BLOCKS ||
+                zblock_store(idx, b, file->data + b * FS_ZBLOCK_SIZE, zblock_bytes(file, b)) < 0) {
+                zfile_free(idx);
+                r = -1;  // Too big, or the store is full
+            }
+        }
+        if (r == 0) {
+            if (!file->is_embedded) {
+                free_file_data(idx);
+            }
+            file->data = 0;
+            file->is_embedded = 0;
+            file->compressed = 1;
+            file->capacity = FS_ZMAX_BLOCKS * FS_ZBLOCK_SIZE;
+        }
+    } else {
+        // Too big for a file buffer, or no buffer
+        char *data = file->size > MAX_FILE_SIZE ? 0 : allocate_file_data(idx);
+        if (!data) {
+            r = -1;
+        }
+        for (int b = 0; b < nblocks && r == 0; b++) {
+            if (zblock_load(idx, b, zscratch) < 0) {
+                free_file_data(idx);
+                r = -1;
+            } else {
+                memcpy(data + b * FS_ZBLOCK_SIZE, zscratch, zblock_bytes(file, b));
+            }
+        }
+        if (r == 0) {
+            zfile_free(idx);
+            file->data = data;
+            file->compressed = 0;
+            file->capacity = MAX_FILE_SIZE;
+        }
+    }
+    rwlock_write_unlock(&zstore_lock);
+    rwlock_write_unlock(&file->lock);
+    rwlock_read_unlock(&ns_lock);
+    return r;
+}
+
+// Storage of a compressed file; returns -1 if 'name' is not one
+int fs_compress_info(const char *name, fs_zinfo_t *info) {
+    fs_lazy_init();
+    rwlock_read_lock(&ns_lock);
+    int idx = find_file(name);
+    if (idx >= 0) {
+        rwlock_read_lock(&files[idx].lock);
+    }
+    rwlock_read_unlock(&ns_lock);
+    if (idx < 0) {
+        return -1;
+    }
+    if (!files[idx].compressed) {
+        rwlock_read_unlock(&files[idx].lock);
+        return -1;
+    }
+    info->size = files[idx].size;
+    info->stored = 0;
+    info->blocks = 0;
+    info->raw = 0;
+    for (int b = 0; b < FS_ZMAX_BLOCKS; b++) {
+        const zblock_t *zb = &zblocks[idx][b];
+        if (!zb->len) continue;
+        info->stored += zb->len;
+        info->blocks++;
+        info->raw += zb->raw;
+    }
+    rwlock_read_unlock(&files[idx].lock);
+    return 0;
+}
+
+// Bytes of the compressed store in use (of FS_ZSTORE_SIZE)
+int fs_zstore_used(void) {
+    return __atomic_load_n(&zstore_used, __ATOMIC_RELAXED);
+}
+
 // Create a new file
 int fs_create(const char *name) {
+    fs_lazy_init();
     if (!name || strlen(name) == 0 || strlen(name) >= MAX_FILENAME_LEN) {
         return -1;  // Invalid name
     }
+    rwlock_write_lock(&ns_lock);
     
     // Check if file already exists
     if (find_file(name) >= 0) {
+        rwlock_write_unlock(&ns_lock);
         return -1;  // File already exists
     }
     
     // Find empty slot
     int idx = find_empty_file_slot();
     if (idx < 0) {
+        rwlock_write_unlock(&ns_lock);
         return -1;  // No space for new file
     }
     
     // Allocate data buffer for this file slot
     char *data = allocate_file_data(idx);
     if (!data) {
+        rwlock_write_unlock(&ns_lock);
         return -1;  // Out of memory
     }
     
-    // Initialize file
+    // Initialize file; lock-free inode lookups may look at it meanwhile
+    rwlock_write_lock(&files[idx].lock);
     strncpy(files[idx].name, name, MAX_FILENAME_LEN - 1);
     files[idx].name[MAX_FILENAME_LEN - 1] = 0;
     files[idx].data = data;
     files[idx].size = 0;
     files[idx].capacity = MAX_FILE_SIZE;
     files[idx].is_embedded = 0;  // Writable file
+    __atomic_store_n(&files[idx].ino, next_ino++, __ATOMIC_RELAXED);
     files[idx].in_use = 1;
+    rwlock_write_unlock(&files[idx].lock);
+    rwlock_write_unlock(&ns_lock);
     
     return 0;
 }
 
 // Delete a file
 int fs_delete(const char *name) {
+    fs_lazy_init();
+    rwlock_write_lock(&ns_lock);
     int idx = find_file(name);
     if (idx < 0) {
+        rwlock_write_unlock(&ns_lock);
         return -1;  // File not found
     }
     
     // Close all file descriptors pointing to this file
     for (int i = 0; i < MAX_OPEN_FDS; i++) {
-        if (fd_table[i].in_use && fd_table[i].file_index == idx) {
-            fd_table[i].in_use = 0;
+        fd_entry_t *f = &fd_table[i];
+        if (!__atomic_load_n(&f->in_use, __ATOMIC_RELAXED)) continue;
+        rwlock_write_lock(&f->lock);
+        if (f->in_use && !f->pipe && !f->sock && f->file_index == idx) {
+            __atomic_store_n(&f->in_use, 0, __ATOMIC_RELAXED);
         }
+        rwlock_write_unlock(&f->lock);
     }
     
     // Mark file as unused
-    if (!files[idx].is_embedded) {
+    file_t *file = &files[idx];
+    rwlock_write_lock(&file->lock);
+    pcache_invalidate(file->ino);
+    if (file->compressed) {
+        rwlock_write_lock(&zstore_lock);
+        zfile_free(idx);
+        rwlock_write_unlock(&zstore_lock);
+    } else if (!file->is_embedded) {
         free_file_data(idx);  // Free the buffer if it was allocated
     }
-    files[idx].in_use = 0;
-    files[idx].name[0] = 0;
-    files[idx].size = 0;
-    files[idx].is_embedded = 0;
+    file->in_use = 0;
+    file->compressed = 0;
+    file->name[0] = 0;
+    file->size = 0;
+    file->is_embedded = 0;
+    rwlock_write_unlock(&file->lock);
+    rwlock_write_unlock(&ns_lock);
     
     return 0;
 }
 
 // Open a file
 int fs_open(const char *name, int flags) {
+    fs_lazy_init();
+    rwlock_read_lock(&ns_lock);
     int idx = find_file(name);
-    if (idx < 0) {
-        return -1;  // File not found
-    }
-    
-    // Find empty FD slot
-    int fd_slot = find_empty_fd_slot();
-    if (fd_slot < 0) {
-        return -1;  // Too many open files
-    }
-    
-    // Allocate FD number
-    next_fd++;
-    if (next_fd >= MAX_OPEN_FDS) {
-        next_fd = 3;  // Wrap around (skip 0,1,2)
-    }
     
-    // Initialize FD entry
-    fd_table[fd_slot].in_use = 1;
-    fd_table[fd_slot].file_index = idx;
-    fd_table[fd_slot].position = 0;
-    fd_table[fd_slot].flags = flags;
-    
-    // Store FD number in the slot (we'll use a simple mapping)
-    // For simplicity, we'll use the slot index as the FD
-    // In a real OS, this would be more sophisticated
-    return fd_slot + 3;  // Return FD >= 3
+    // The slot index is the FD, less the 3 reserved for stdin, stdout and
+    // stderr. The namespace lock keeps the file from going away meanwhile.
+    int fd = idx < 0 ? -1 : fd_alloc(idx, flags, 0, 0);
+    rwlock_read_unlock(&ns_lock);
+    return fd;  // -1 if there is no such file or too many are open
 }
 
 // Close a file descriptor
 int fs_close(int fd) {
-    if (fd < 3 || fd >= 3 + MAX_OPEN_FDS) {
-        return -1;  // Invalid FD
-    }
-    
-    int fd_slot = fd - 3;
-    if (!fd_table[fd_slot].in_use) {
+    fd_entry_t *f = fd_lock(fd);
+    if (!f) {
         return -1;  // FD not open
     }
     
-    fd_table[fd_slot].in_use = 0;
-    fd_table[fd_slot].file_index = -1;
-    fd_table[fd_slot].position = 0;
+    int pipe = f->pipe, sock = f->sock, flags = f->flags;
+    f->pipe = 0;
+    f->sock = 0;
+    f->file_index = -1;
+    f->position = 0;
+    __atomic_store_n(&f->in_use, 0, __ATOMIC_RELAXED);
+    rwlock_write_unlock(&f->lock);
     
+    if (pipe) {
+        pipe_close(pipe - 1, flags & FD_WRITE);
+    }
+    if (sock) {
+        net_close(sock - 1);
+    }
     return 0;
 }
 
 // Read from a file
+// Any number of tasks may read the same or different files at once: a
+// read holds its file's lock shared and copies out of pinned cache pages.
+// 'buf' may be a program's (checked) buffer: a page of it that can't be
+// mapped ends the read, with -EFAULT if nothing was copied yet.
 int fs_read(int fd, char *buf, int len) {
-    if (fd < 3 || fd >= 3 + MAX_OPEN_FDS || !buf || len <= 0) {
+    if (!buf || len <= 0) {
         return -1;
     }
     
-    int fd_slot = fd - 3;
-    if (!fd_table[fd_slot].in_use) {
+    fd_entry_t *f = fd_lock(fd);
+    if (!f) {
         return -1;  // FD not open
     }
     
-    if (!(fd_table[fd_slot].flags & FD_READ)) {
+    if (!(f->flags & FD_READ)) {
+        rwlock_write_unlock(&f->lock);
         return -1;  // Not opened for reading
     }
     
-    int file_idx = fd_table[fd_slot].file_index;
-    if (file_idx < 0 || !files[file_idx].in_use) {
-        return -1;
+    // Pipes and sockets may block, so they go on without the fd lock
+    int pipe = f->pipe, sock = f->sock;
+    if (pipe || sock) {
+        rwlock_write_unlock(&f->lock);
+        return pipe ? pipe_read(pipe - 1, buf, len) : net_recv(sock - 1, buf, len);
     }
     
-    file_t *file = &files[file_idx];
-    int pos = fd_table[fd_slot].position;
+    file_t *file = &files[f->file_index];
+    rwlock_read_lock(&file->lock);
+    int pos = f->position;
     int remaining = file->size - pos;
     int to_read = len < remaining ? len : remaining;
     
     if (to_read <= 0) {
+        rwlock_read_unlock(&file->lock);
+        rwlock_write_unlock(&f->lock);
         return 0;  // EOF
     }
     
-    memcpy(buf, file->data + pos, to_read);
-    fd_table[fd_slot].position += to_read;
+    // A read continuing where the last one stopped doubles the read-ahead
+    // window; anything else (a seek) turns read-ahead off again
+    int window = 0;
+    if (pos == f->ra_next) {
+        window = f->ra_window ? f->ra_window * 2 : 1;
+        if (window > PCACHE_RA_MAX) window = PCACHE_RA_MAX;
+    }
+    
+    // Copy out of the page cache, one page at a time. The page is pinned
+    // for the copy, so other readers can't evict it meanwhile.
+    int done = 0, fault = 0;
+    while (done < to_read) {
+        uint64_t page = pcache_pin(file->ino, (pos + done) / PAGE_SIZE);
+        if (!page) break;
+        int off = (pos + done) % PAGE_SIZE;
+        int n = PAGE_SIZE - off;
+        if (n > to_read - done) n = to_read - done;
+        fault = __uaccess_copy(buf + done, (const char *)page + off, n) < 0;
+        pcache_unpin(page);
+        if (fault) break;
+        done += n;
+    }
+    
+    if (done > 0) {
+        if (window) {
+            pcache_readahead(file->ino, (pos + done - 1) / PAGE_SIZE + 1, window);
+        }
+        f->ra_window = window;
+        f->ra_next = pos + done;
+        f->position += done;
+    }
+    rwlock_read_unlock(&file->lock);
+    rwlock_write_unlock(&f->lock);
     
-    return to_read;
+    if (done) return done;
+    return fault ? -EFAULT : -1;  // -1 if the cache is full of pinned pages
+}
+
+// Touch a byte of every page of a caller's buffer, so copying from it
+// later can't fault while a file is locked: the fault could need that
+// very file to fill a mapped page. Returns -EFAULT if a page can't be mapped.
+static int fault_in(const char *buf, int len) {
+    const char *end = buf + len;
+    for (const char *a = buf; a < end; a = (const char *)(((uint64_t)a | (PAGE_SIZE - 1)) + 1)) {
+        char c;
+        if (__uaccess_copy(&c, a, 1) < 0) return -EFAULT;
+    }
+    return 0;
 }
 
 // Write to a file
 int fs_write(int fd, const char *buf, int len) {
-    if (fd < 3 || fd >= 3 + MAX_OPEN_FDS || !buf || len <= 0) {
+    if (!buf || len <= 0) {
         return -1;
     }
     
-    int fd_slot = fd - 3;
-    if (!fd_table[fd_slot].in_use) {
+    fd_entry_t *f = fd_lock(fd);
+    if (!f) {
         return -1;  // FD not open
     }
     
-    if (!(fd_table[fd_slot].flags & FD_WRITE)) {
+    if (!(f->flags & FD_WRITE)) {
+        rwlock_write_unlock(&f->lock);
         return -1;  // Not opened for writing
     }
     
-    int file_idx = fd_table[fd_slot].file_index;
-    if (file_idx < 0 || !files[file_idx].in_use) {
-        return -1;
+    int pipe = f->pipe, sock = f->sock;
+    if (pipe || sock) {
+        rwlock_write_unlock(&f->lock);
+        return pipe ? pipe_write(pipe - 1, buf, len) : net_send(sock - 1, buf, len);
     }
     
+    int file_idx = f->file_index;
     file_t *file = &files[file_idx];
-    
-    // Don't allow writing to embedded (read-only) files
-    if (file->is_embedded) {
-        return -1;  // Cannot write to embedded file
+    if (fault_in(buf, len) < 0) {
+        rwlock_write_unlock(&f->lock);
+        return -EFAULT;
     }
-    int pos = fd_table[fd_slot].position;
+    rwlock_write_lock(&file->lock);
+    // 'buf' is read in place below, by the copy and the page cache update
+    uaccess_enable();
+    
+    // The first write to a file from the initramfs copies it out of the image
+    int promoted = !file->is_embedded || promote_file(file_idx) == 0;
+    int pos = f->position;
     int remaining = file->capacity - pos;
     int to_write = len < remaining ? len : remaining;
     
-    if (to_write <= 0) {
-        return -1;  // No space
-    }
-    
-    memcpy(file->data + pos, buf, to_write);
-    fd_table[fd_slot].position += to_write;
-    
-    // Update file size if we wrote past the end
-    if (pos + to_write > file->size) {
-        file->size = pos + to_write;
+    if (!promoted) {
+        to_write = -1;
+    } else if (to_write <= 0) {
+        to_write = -1;  // No space
+    } else if (file->compressed) {
+        rwlock_write_lock(&zstore_lock);
+        to_write = zfile_write(file_idx, pos, buf, to_write);  // -1 if the store is full
+        rwlock_write_unlock(&zstore_lock);
+    } else {
+        memcpy(file->data + pos, buf, to_write);
+    }
+    if (to_write > 0) {
+        pcache_update(file->ino, pos, buf, to_write);
+        f->position += to_write;
+        
+        // Update file size if we wrote past the end
+        if (pos + to_write > file->size) {
+            file->size = pos + to_write;
+        }
     }
+    uaccess_disable();
+    rwlock_write_unlock(&file->lock);
+    rwlock_write_unlock(&f->lock);
     
     return to_write;
 }
 
-// Seek in a file
-int fs_seek(int fd, int offset) {
-    if (fd < 3 || fd >= 3 + MAX_OPEN_FDS) {
+// Create a pipe: fds[0] becomes the read end, fds[1] the write end
+int fs_pipe(int fds[2]) {
+    int p = pipe_alloc();
+    if (p < 0) {
         return -1;
     }
     
-    int fd_slot = fd - 3;
-    if (!fd_table[fd_slot].in_use) {
+    for (int end = 0; end < 2; end++) {
+        fds[end] = fd_alloc(-1, end ? FD_WRITE : FD_READ, p + 1, 0);
+        if (fds[end] < 0) {
+            if (end == 1) fs_close(fds[0]);
+            else pipe_close(p, 0);
+            pipe_close(p, 1);
+            return -1;  // Too many open files
+        }
+    }
+    return 0;
+}
+
+// Open a UDP socket on local 'port' (0 for any) as a descriptor. Reads
+// and writes on it receive and send whole datagrams once it is connected.
+int fs_socket(int port) {
+    int s = net_socket(port);
+    if (s < 0) {
         return -1;
     }
-    
-    int file_idx = fd_table[fd_slot].file_index;
-    if (file_idx < 0 || !files[file_idx].in_use) {
+    int fd = fd_alloc(-1, FD_READ | FD_WRITE, 0, s + 1);
+    if (fd < 0) {
+        net_close(s);
+        return -1;  // Too many open files
+    }
+    return fd;
+}
+
+// Socket open on 'fd', or -1 if 'fd' is not a socket
+int fs_fd_socket(int fd) {
+    fd_entry_t *f = fd_lock(fd);
+    if (!f) {
+        return -1;
+    }
+    int sock = f->sock;
+    rwlock_write_unlock(&f->lock);
+    return sock - 1;
+}
+
+// Seek in a file
+int fs_seek(int fd, int offset) {
+    fd_entry_t *f = fd_lock(fd);
+    if (!f) {
         return -1;
     }
     
+    int file_idx = f->file_index;
+    if (file_idx < 0) {
+        rwlock_write_unlock(&f->lock);
+        return -1;  // Pipe or socket
+    }
+    
     file_t *file = &files[file_idx];
     int new_pos = offset;
     
     if (new_pos < 0) new_pos = 0;
+    rwlock_read_lock(&file->lock);
     if (new_pos > file->size) new_pos = file->size;
+    rwlock_read_unlock(&file->lock);
     
-    fd_table[fd_slot].position = new_pos;
+    f->position = new_pos;
+    rwlock_write_unlock(&f->lock);
     return new_pos;
 }
 
-// List all files
+// List all files. Sizes are as of the moment each one is looked at.
 int fs_list_files(char *buf, int maxlen) {
+    fs_lazy_init();
+    rwlock_read_lock(&ns_lock);
     int pos = 0;
     for (int i = 0; i < MAX_FILES; i++) {
         if (files[i].in_use) {
@@ -368,7 +819,7 @@ int fs_list_files(char *buf, int maxlen) {
             buf[pos++] = '(';
             
             // Convert size to string (simple implementation)
-            int size = files[i].size;
+            int size = __atomic_load_n(&files[i].size, __ATOMIC_RELAXED);
             char size_buf[16];
             int size_pos = 0;
             if (size == 0) {
@@ -392,26 +843,136 @@ int fs_list_files(char *buf, int maxlen) {
             buf[pos++] = '\n';
         }
     }
+    rwlock_read_unlock(&ns_lock);
     if (pos < maxlen) buf[pos] = 0;
     return pos;
 }
 
+// Name of the file in slot 'index' (0 to MAX_FILES - 1), or 0 if the slot
+// is free. The name stays put until the file is deleted.
+const char *fs_file_name(int index) {
+    fs_lazy_init();
+    if (index < 0 || index >= MAX_FILES) {
+        return 0;
+    }
+    rwlock_read_lock(&ns_lock);
+    const char *name = files[index].in_use ? files[index].name : 0;
+    rwlock_read_unlock(&ns_lock);
+    return name;
+}
+
 // Get file size by name
 int fs_get_file_size(const char *name) {
+    fs_lazy_init();
+    rwlock_read_lock(&ns_lock);
     int idx = find_file(name);
-    if (idx < 0) {
-        return -1;
-    }
-    return files[idx].size;
+    int size = -1;
+    if (idx >= 0) {
+        rwlock_read_lock(&files[idx].lock);
+        size = files[idx].size;
+        rwlock_read_unlock(&files[idx].lock);
+    }
+    rwlock_read_unlock(&ns_lock);
+    return size;
 }
 
 // Legacy compatibility: get file content (for backward compatibility)
+// Compressed files have no contiguous contents to point at. The contents
+// are not locked: they stay put until the file is written, compressed or
+// deleted.
 const char* fs_get_file_content(const char *name, int *len) {
+    fs_lazy_init();
+    rwlock_read_lock(&ns_lock);
     int idx = find_file(name);
-    if (idx < 0) {
-        *len = 0;
+    const char *data = 0;
+    *len = 0;
+    if (idx >= 0) {
+        rwlock_read_lock(&files[idx].lock);
+        if (!files[idx].compressed) {
+            *len = files[idx].size;
+            data = files[idx].data;
+        }
+        rwlock_read_unlock(&files[idx].lock);
+    }
+    rwlock_read_unlock(&ns_lock);
+    return data;
+}
+
+// Inode number of a file, or 0 if there is no such file
+uint32_t fs_get_inode(const char *name) {
+    fs_lazy_init();
+    rwlock_read_lock(&ns_lock);
+    int idx = find_file(name);
+    uint32_t ino = idx < 0 ? 0 : files[idx].ino;
+    rwlock_read_unlock(&ns_lock);
+    return ino;
+}
+
+// Inode number of the file open on 'fd'; returns the file size, or -1 if
+// 'fd' is not an open file
+int fs_fd_inode(int fd, uint32_t *ino) {
+    fd_entry_t *f = fd_lock(fd);
+    if (!f) {
+        return -1;
+    }
+    int size = -1;
+    if (f->file_index >= 0) {
+        file_t *file = &files[f->file_index];
+        rwlock_read_lock(&file->lock);
+        *ino = file->ino;
+        size = file->size;
+        rwlock_read_unlock(&file->lock);
+    }
+    rwlock_write_unlock(&f->lock);
+    return size;
+}
+
+// Page cache backend: read page 'index' of inode 'ino' into 'page'
+// (decompressing it for a compressed file, whose blocks are pages).
+// Bytes past the end of the file are zero. Returns -1 if the page lies
+// wholly past the end or the file is gone.
+int fs_fill_page(uint32_t ino, uint32_t index, char *page) {
+    int i = lock_inode(ino);
+    if (i < 0) {
+        return -1;
+    }
+    file_t *file = &files[i];
+    uint64_t off = (uint64_t)index * PAGE_SIZE;
+    int r = 0;
+    if (off > 0 && off >= (uint64_t)file->size) {
+        r = -1;
+    } else if (file->compressed) {
+        rwlock_write_lock(&zstore_lock);
+        r = zblock_load(i, index, page);
+        rwlock_write_unlock(&zstore_lock);
+    } else {
+        uint64_t n = file->size - off;
+        if (n > PAGE_SIZE) n = PAGE_SIZE;
+        memcpy(page, file->data + off, n);
+        memset(page + n, 0, PAGE_SIZE - n);
+    }
+    rwlock_read_unlock(&file->lock);
+    return r;
+}
+
+// Page 'index' of 'ino' where it lies in the initramfs image, for the page
+// cache to hand out instead of a copy. The archive keeps file data page
+// aligned and zero-padded, so the page reads like a filled one. Returns 0
+// if the file is not (or no longer) served from the image.
+const char *fs_image_page(uint32_t ino, uint32_t index) {
+    int i = lock_inode(ino);
+    if (i < 0) {
         return 0;
     }
-    *len = files[idx].size;
-    return files[idx].data;
+    file_t *file = &files[i];
+    uint64_t off = (uint64_t)index * PAGE_SIZE;
+    const char *page = 0;
+    if (file->is_embedded && (off == 0 || off < (uint64_t)file->size)) {
+        page = file->data + off;
+        if ((uint64_t)page % PAGE_SIZE || page + PAGE_SIZE > fs_initramfs_end) {
+            page = 0;
+        }
+    }
+    rwlock_read_unlock(&file->lock);
+    return page;
 }
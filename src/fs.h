@@ -9,10 +9,30 @@
 #define MAX_FILE_SIZE 4096
 #define MAX_OPEN_FDS 16
 
+// Compressed files (fs_compress) keep their contents as LZ4 blocks of one
+// page each in a shared store, so they may grow past MAX_FILE_SIZE
+#define FS_ZBLOCK_SIZE 4096
+#define FS_ZMAX_BLOCKS 16
+#define FS_ZSTORE_SIZE (96 * 1024)
+#define FS_ZUNIT 64             // Store allocation granularity
+
 // File descriptor flags
 #define FD_READ 0x1
 #define FD_WRITE 0x2
 
+// The initramfs archive fs_init seeds the file system with (see
+// initramfs.h; defined in user_programs.c)
+extern const char *const fs_initramfs_start;
+extern const char *const fs_initramfs_end;
+
+// Storage of a compressed file (fs_compress_info)
+typedef struct {
+    int size;       // Uncompressed bytes
+    int stored;     // Store bytes its blocks take
+    int blocks;
+    int raw;        // Blocks kept uncompressed because they did not shrink
+} fs_zinfo_t;
+
 // File system operations
 int fs_init(void);
 int fs_create(const char *name);
@@ -22,8 +42,21 @@ int fs_close(int fd);
 int fs_read(int fd, char *buf, int len);
 int fs_write(int fd, const char *buf, int len);
 int fs_list_files(char *buf, int maxlen);
+const char *fs_file_name(int index);
 int fs_get_file_size(const char *name);
 int fs_seek(int fd, int offset);
+int fs_pipe(int fds[2]);
+int fs_socket(int port);
+int fs_fd_socket(int fd);
+uint32_t fs_get_inode(const char *name);
+int fs_fd_inode(int fd, uint32_t *ino);
+int fs_compress(const char *name, int on);
+int fs_compress_info(const char *name, fs_zinfo_t *info);
+int fs_zstore_used(void);
+
+// Page cache backend (see pcache.c)
+int fs_fill_page(uint32_t ino, uint32_t index, char *page);
+const char *fs_image_page(uint32_t ino, uint32_t index);
 
 // Legacy compatibility functions
 const char* fs_get_file_content(const char *name, int *len);
@@ -0,0 +1,95 @@
+#include "futex.h"
+#include "scheduler.h"
+#include "vm.h"
+#include "uaccess.h"
+#include <stdint.h>
+
+// A task waiting on a futex. Every task has exactly one node, since a task
+// waits on at most one word at a time.
+typedef struct futex_waiter {
+    uint64_t key;                 // Physical address of the word
+    struct futex_waiter *next;    // Next waiter in the same bucket
+    int queued;                   // In a bucket; cleared by futex_wake
+} futex_waiter_t;
+
+static futex_waiter_t waiters[MAX_TASKS];
+// Waiters hashed by key, each list in arrival order so wakeups are FIFO
+static futex_waiter_t *buckets[FUTEX_BUCKETS];
+
+// Waiters are keyed by the word's physical address, which is the same in
+// every task mapping it, wherever it appears in their address spaces.
+static uint64_t futex_key(volatile uint32_t *word) {
+    task_t *task = scheduler_current_task();
+    return vm_translate(task ? task->space : 0, (uint64_t)word);
+}
+
+static futex_waiter_t **futex_bucket(uint64_t key) {
+    return &buckets[(key >> 2) % FUTEX_BUCKETS];
+}
+
+// Take 'w' out of its bucket if it is still there
+static void futex_unlink(futex_waiter_t *w) {
+    if (!w->queued) return;
+    futex_waiter_t **pp = futex_bucket(w->key);
+    while (*pp && *pp != w) pp = &(*pp)->next;
+    if (*pp) *pp = w->next;
+    w->next = 0;
+    w->queued = 0;
+}
+
+// Sleep until futex_wake on 'word', unless it no longer holds 'expected'.
+// Nothing runs between the check and the sleep, so no wakeup is lost.
+// Returns 0 after a wakeup, -1 if the value had already changed or the
+// task was woken for another reason (scheduler_kill), -EFAULT if the word's
+// page can't be mapped.
+int futex_wait(volatile uint32_t *word, uint32_t expected) {
+    // Read first: for a program this may fault the page in
+    uint32_t value;
+    if (__uaccess_copy(&value, (const void *)word, sizeof(value)) < 0) return -EFAULT;
+    if (value != expected) return -1;
+    uint64_t key = futex_key(word);
+    if (!key) return -1;
+
+    // A node left behind by an earlier task in this slot must not stay
+    // linked, or appending it again would loop the bucket
+    futex_waiter_t *w = &waiters[scheduler_current()];
+    futex_unlink(w);
+    w->key = key;
+    w->next = 0;
+    w->queued = 1;
+    futex_waiter_t **pp = futex_bucket(key);
+    while (*pp) pp = &(*pp)->next;
+    *pp = w;
+
+    // The waker unlinks the node before making the task ready. Any other
+    // wakeup leaves it queued, and it must go before it could be counted
+    // as woken in place of a live waiter.
+    scheduler_sleep(w);
+    if (w->queued) {
+        futex_unlink(w);
+        return -1;
+    }
+    return 0;
+}
+
+// Wake up to 'count' tasks waiting on 'word'; returns how many were woken
+int futex_wake(volatile uint32_t *word, int count) {
+    uint64_t key = futex_key(word);
+    if (!key) return 0;
+
+    int woken = 0;
+    futex_waiter_t **pp = futex_bucket(key);
+    while (*pp && woken < count) {
+        futex_waiter_t *w = *pp;
+        if (w->key != key) {
+            pp = &w->next;
+            continue;
+        }
+        *pp = w->next;
+        w->next = 0;
+        w->queued = 0;
+        scheduler_wakeup(w);
+        woken++;
+    }
+    return woken;
+}
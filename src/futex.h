@@ -0,0 +1,16 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+
+// Futex operations (SYS_FUTEX)
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+// Number of hash buckets waiters are spread over
+#define FUTEX_BUCKETS 16
+
+int futex_wait(volatile uint32_t *word, uint32_t expected);
+int futex_wake(volatile uint32_t *word, int count);
+
+#endif
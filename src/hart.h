@@ -0,0 +1,48 @@
+#ifndef HART_H
+#define HART_H
+
+#include <stdint.h>
+
+/* Upper bound on the number of harts the kernel keeps per-hart state for. */
+#define MAX_HARTS 4
+
+/*
+ * Returns the id of the hart we are running on.
+ * start.s stashes the hart id handed over by OpenSBI in 'tp'; nothing in
+ * the freestanding kernel uses thread-local storage, so it stays put.
+ */
+static inline uint64_t hart_id(void) {
+    uint64_t id;
+    asm volatile("mv %0, tp" : "=r"(id));
+    return id;
+}
+
+/* sstatus.SIE: interrupts are taken on this hart. */
+#define SSTATUS_SIE (1UL << 1)
+/* sstatus.SUM: kernel code may access pages of U-mode programs. */
+#define SSTATUS_SUM (1UL << 18)
+
+/* Disables interrupts on this hart; returns whether they were enabled. */
+static inline int intr_off(void) {
+    uint64_t s;
+    asm volatile("csrrc %0, sstatus, %1" : "=r"(s) : "r"(SSTATUS_SIE) : "memory");
+    return (s & SSTATUS_SIE) != 0;
+}
+
+static inline void intr_on(void) {
+    asm volatile("csrs sstatus, %0" :: "r"(SSTATUS_SIE) : "memory");
+}
+
+/* Re-enables interrupts if 'on', the value an earlier intr_off() returned. */
+static inline void intr_restore(int on) {
+    if (on) intr_on();
+}
+
+/* Cycles this hart has run, for benchmarks and CPU accounting. */
+static inline uint64_t rdcycle(void) {
+    uint64_t c;
+    asm volatile("rdcycle %0" : "=r"(c));
+    return c;
+}
+
+#endif
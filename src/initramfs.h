@@ -0,0 +1,32 @@
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+#include <stdint.h>
+
+// Layout of the initramfs archive written by tools/mkinitramfs.py and
+// indexed by fs_init. All fields are little-endian.
+//
+//   header, then 'count' entries, padded to a page
+//   the data of each file, starting on a page boundary and zero-padded
+//   to the next one
+//
+// Page-aligned, zero-padded data lets the page cache hand out pages of the
+// image itself instead of copies.
+
+#define INITRAMFS_MAGIC 0x31534652  // "RFS1"
+#define INITRAMFS_NAME_LEN 32       // Including the terminating zero
+#define INITRAMFS_ALIGN 4096
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;         // Entries following the header
+    uint64_t size;          // Bytes in the whole archive
+} initramfs_header_t;
+
+typedef struct {
+    char name[INITRAMFS_NAME_LEN];
+    uint64_t offset;        // From the start of the archive
+    uint64_t size;
+} initramfs_entry_t;
+
+#endif
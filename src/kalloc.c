@@ -0,0 +1,118 @@
+#include "kalloc.h"
+#include "fdt.h"
+#include "string.h"
+#include <stdint.h>
+
+// RAM end to use when the device tree did not report any memory
+// (QEMU virt default of 128 MiB at 0x80000000)
+#define KALLOC_DEFAULT_RAM_END 0x88000000UL
+
+// Most pages the allocator manages (1 GiB); RAM beyond that is left unused
+#define KALLOC_MAX_PAGES (1UL << 18)
+
+// End of the kernel image, including .bss (see link.ld)
+extern char __kernel_end[];
+
+// Freed pages are chained through their first word
+typedef struct free_page {
+    struct free_page *next;
+} free_page_t;
+
+static free_page_t *free_list;
+// Pages between next_unused and ram_end have never been handed out.
+// Carving them off on demand keeps boot from touching every page of RAM.
+static uint64_t next_unused;
+static uint64_t ram_end;
+static uint64_t freed_pages;
+// Reference count of every managed page, indexed from first_page
+static uint64_t first_page;
+static uint8_t page_refs[KALLOC_MAX_PAGES];
+
+// Set up the allocator on first use
+static void kalloc_lazy_init(void) {
+    if (ram_end) return;
+    first_page = next_unused = PAGE_ROUND_UP(__kernel_end);
+    ram_end = boot_fdt.ram_size ? boot_fdt.ram_base + boot_fdt.ram_size : KALLOC_DEFAULT_RAM_END;
+    ram_end = PAGE_ROUND_DOWN(ram_end);
+    if (ram_end > first_page + KALLOC_MAX_PAGES * PAGE_SIZE) {
+        ram_end = first_page + KALLOC_MAX_PAGES * PAGE_SIZE;
+    }
+}
+
+static uint8_t *page_ref(uint64_t pa) {
+    return &page_refs[(pa - first_page) / PAGE_SIZE];
+}
+
+// Allocate one page; its contents are undefined. Returns 0 when out of memory.
+void *kalloc(void) {
+    kalloc_lazy_init();
+    if (free_list) {
+        free_page_t *page = free_list;
+        free_list = page->next;
+        freed_pages--;
+        *page_ref((uint64_t)page) = 1;
+        return page;
+    }
+    if (next_unused >= ram_end) {
+        return 0;  // Out of memory
+    }
+    void *page = (void *)next_unused;
+    next_unused += PAGE_SIZE;
+    *page_ref((uint64_t)page) = 1;
+    return page;
+}
+
+// Allocate one zero-filled page
+void *kzalloc(void) {
+    void *page = kalloc();
+    if (page) memset(page, 0, PAGE_SIZE);
+    return page;
+}
+
+// Allocate 'n' physically contiguous pages, each with one reference.
+// They come from the never-used part of RAM, since the free list is not
+// kept in address order. Returns 0 when out of memory.
+void *kalloc_pages(int n) {
+    kalloc_lazy_init();
+    if (n <= 0 || next_unused + (uint64_t)n * PAGE_SIZE > ram_end) {
+        return 0;
+    }
+    void *pages = (void *)next_unused;
+    for (int i = 0; i < n; i++) {
+        *page_ref(next_unused) = 1;
+        next_unused += PAGE_SIZE;
+    }
+    return pages;
+}
+
+// Return a page to the allocator, regardless of its reference count
+void kfree(void *page) {
+    *page_ref((uint64_t)page) = 0;
+    free_page_t *p = page;
+    p->next = free_list;
+    free_list = p;
+    freed_pages++;
+}
+
+// Number of pages still available
+uint64_t kalloc_free_pages(void) {
+    kalloc_lazy_init();
+    return freed_pages + (ram_end - next_unused) / PAGE_SIZE;
+}
+
+// Add a reference to a page that is about to be shared
+void kpage_get(uint64_t pa) {
+    (*page_ref(pa))++;
+}
+
+// Drop a reference; the page is freed when the last one goes
+void kpage_put(uint64_t pa) {
+    uint8_t *refs = page_ref(pa);
+    if (*refs <= 1) kfree((void *)pa);
+    else (*refs)--;
+}
+
+// Number of address spaces mapping the page
+int kpage_refs(uint64_t pa) {
+    return *page_ref(pa);
+}
@@ -0,0 +1,23 @@
+#ifndef KALLOC_H
+#define KALLOC_H
+
+#include <stdint.h>
+
+#define PAGE_SIZE 4096
+#define PAGE_ROUND_UP(x) (((uint64_t)(x) + PAGE_SIZE - 1) & ~(uint64_t)(PAGE_SIZE - 1))
+#define PAGE_ROUND_DOWN(x) ((uint64_t)(x) & ~(uint64_t)(PAGE_SIZE - 1))
+
+// Physical page allocator for the RAM above the kernel image
+void *kalloc(void);
+void *kzalloc(void);
+void kfree(void *page);
+uint64_t kalloc_free_pages(void);
+void *kalloc_pages(int n);
+
+// Reference counts for pages shared between address spaces (copy-on-write).
+// kalloc hands out pages with one reference; kpage_put frees on the last one.
+void kpage_get(uint64_t pa);
+void kpage_put(uint64_t pa);
+int kpage_refs(uint64_t pa);
+
+#endif
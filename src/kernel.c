@@ -1,22 +1,41 @@
 #include <stdint.h>
 #include "uart.h"
+#include "klog.h"
 #include "trap.h"
 #include "scheduler.h"
 #include "timer.h"
 #include "fs.h"
+#include "fdt.h"
+#include "hart.h"
+
+/* Value of the time CSR when _start ran; the shell reports the boot time from it. */
+uint64_t boot_time_start;
 
 /*
  * The main function of the kernel.
- * This function is called by the assembly startup code in start.s
+ * This function is called by the assembly startup code in start.s with the
+ * hart id, the device tree pointer from OpenSBI and the time read at _start.
+ * .bss has already been cleared by then.
  */
-void kmain(void) {
+void kmain(uint64_t hartid, const void *dtb, uint64_t boot_time) {
+    (void)hartid;
+    boot_time_start = boot_time;
+
     /*
      * Initialize the UART (Universal Asynchronous Receiver/Transmitter)
-     * for serial communication. This allows the kernel to print messages
-     * to the console.
+     * for serial communication. Kernel messages go to the log (klog.c)
+     * and reach the console once klogd runs.
      */
     uart_init();
-    uart_puts("RISC-V Teaching Kernel starting (with preemption).\n");
+    klog(KLOG_INFO, "RISC-V Teaching Kernel starting (with preemption).");
+
+    /* Find RAM, harts and MMIO devices in the flattened device tree. */
+    if (fdt_parse(dtb, &boot_fdt) == 0) {
+        klog(KLOG_INFO, "RAM %p + %lu MiB, %d hart(s), %d devices", (void *)boot_fdt.ram_base,
+             boot_fdt.ram_size >> 20, boot_fdt.nharts, boot_fdt.ndevices);
+    } else {
+        klog(KLOG_ERR, "No valid device tree");
+    }
 
     /*
      * Set up the trap vector.
@@ -30,31 +49,46 @@ void kmain(void) {
     uintptr_t stvec = (uintptr_t)&trap_vector;
     asm volatile("csrw stvec, %0" :: "r"(stvec));
 
+    /*
+     * Programs run in U-mode. They may read the cycle, time and instret
+     * counters themselves (scounteren), and kernel code may only touch
+     * their pages inside the uaccess routines, which set sstatus.SUM.
+     */
+    asm volatile("csrw scounteren, %0" :: "r"(7UL));
+    asm volatile("csrc sstatus, %0" :: "r"(SSTATUS_SUM));
+
     /* Initialize the scheduler, which is responsible for managing tasks. */
     scheduler_init();
 
     /*
-     * Initialize the timer. This is used for preemptive multitasking.
-     * The timer will periodically generate interrupts, which will trigger
-     * the scheduler to switch tasks.
+     * The timer and the file system are set up lazily: the timer on the
+     * first timer_add(), the file system on the first fs_* call, and
+     * console receive interrupts on the first read.
      */
-    timer_init();
-    
-    /* Initialize the file system. */
-    fs_init();
 
+#ifdef BENCH
+    /* The benchmark kernel runs the benchmarks instead of the shell. */
+    extern void bench_run(void);
+    scheduler_set_name(scheduler_spawn(bench_run), "bench");
+#else
     /* Spawn the initial tasks. */
     /* 'scheduler_spawn' adds a function to the scheduler's list of tasks to be run. */
     extern void shell_run(void);
-    scheduler_spawn(shell_run); /* The interactive shell */
+    scheduler_set_name(scheduler_spawn(shell_run), "shell"); /* The interactive shell */
 
-    /* Spawn some other user programs */
+    /* Spawn some other user programs, named for the shell's ps and top */
     extern void user_prog_hello(void);
     extern void user_prog_echo(void);
     extern void user_prog_fstest(void);
-    scheduler_spawn(user_prog_hello);
-    scheduler_spawn(user_prog_echo);
-    scheduler_spawn(user_prog_fstest);
+    scheduler_set_name(scheduler_spawn(user_prog_hello), "hello");
+    scheduler_set_name(scheduler_spawn(user_prog_echo), "echo");
+    scheduler_set_name(scheduler_spawn(user_prog_fstest), "fstest");
+#endif
+
+    /* klogd writes kernel messages to the console, when nothing else wants the CPU. */
+    int klogd = scheduler_spawn(klog_task);
+    scheduler_set_name(klogd, "klogd");
+    scheduler_set_nice(klogd, NICE_MAX);
 
     /*
      * Start the scheduler. This function will start running the spawned tasks
@@ -66,7 +100,8 @@ void kmain(void) {
      * This part is reached only if scheduler_run() returns, which means
      * there are no more tasks in the ready state.
      */
-    uart_puts("No more ready tasks - kernel idle\n");
+    klog(KLOG_INFO, "No more ready tasks - kernel idle");
+    klog_flush();
     /*
      * Enter an infinite loop and wait for interrupts.
      * 'wfi' (Wait For Interrupt) is a low-power instruction that halts the CPU
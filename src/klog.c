@@ -0,0 +1,215 @@
+#include "klog.h"
+#include "uart.h"
+#include "timer.h"
+#include "scheduler.h"
+#include "hart.h"
+#include "string.h"
+#include <stdarg.h>
+#include <stdint.h>
+
+// Kernel message log: klog() formats into a fixed-size record of a ring,
+// and the klogd task writes records out to the console later, so code
+// that logs never waits for the (one SBI call per character) console.
+//
+// Writers claim a record by bumping klog_head atomically, so they need no
+// lock and can interrupt each other. A record's seq is 0 while it is
+// being written and the claimed position + 1 once it is complete; readers
+// copy a record and check seq before and after, the way a seqlock works,
+// so a writer lapping the ring under them is noticed.
+
+typedef struct {
+    volatile uint32_t seq;
+    uint8_t level;
+    uint8_t len;
+    uint64_t time;          // timer ticks
+    char text[KLOG_MSG_MAX];
+} klog_record_t;
+
+int klog_level = KLOG_INFO;
+int klog_console_level = KLOG_INFO;
+
+static klog_record_t ring[KLOG_RECORDS];
+static uint32_t klog_head;          // Positions handed out so far
+static uint32_t console_pos;        // Next position for the console
+static volatile int klogd_waiting;  // klogd sleeps until there is output
+
+// Formatted output into a bounded buffer
+typedef struct {
+    char *buf;
+    int len;
+    int cap;
+} klog_out_t;
+
+static void out_char(klog_out_t *o, char c) {
+    if (o->len < o->cap) o->buf[o->len++] = c;
+}
+
+// 'v' in 'base', padded to 'width' with 'pad'; a minus sign goes before
+// zeros but after spaces
+static void out_num(klog_out_t *o, uint64_t v, int neg, int base, int width, char pad) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = "0123456789abcdef"[v % base];
+        v /= base;
+    } while (v);
+    width -= n + neg;
+    if (neg && pad == '0') out_char(o, '-');
+    while (width-- > 0) out_char(o, pad);
+    if (neg && pad != '0') out_char(o, '-');
+    while (n) out_char(o, tmp[--n]);
+}
+
+// The minimal formatter: see klog.h for what it understands
+static void klog_vformat(klog_out_t *o, const char *fmt, va_list ap) {
+    for (; *fmt; fmt++) {
+        if (*fmt != '%') {
+            out_char(o, *fmt);
+            continue;
+        }
+        fmt++;
+        char pad = ' ';
+        int width = 0, is_long = 0;
+        if (*fmt == '0') {
+            pad = '0';
+            fmt++;
+        }
+        while (*fmt >= '0' && *fmt <= '9') width = width * 10 + (*fmt++ - '0');
+        while (*fmt == 'l') {
+            is_long = 1;
+            fmt++;
+        }
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            int64_t v = is_long ? va_arg(ap, int64_t) : va_arg(ap, int);
+            out_num(o, v < 0 ? -(uint64_t)v : (uint64_t)v, v < 0, 10, width, pad);
+            break;
+        }
+        case 'u':
+            out_num(o, is_long ? va_arg(ap, uint64_t) : va_arg(ap, unsigned), 0, 10, width, pad);
+            break;
+        case 'x':
+            out_num(o, is_long ? va_arg(ap, uint64_t) : va_arg(ap, unsigned), 0, 16, width, pad);
+            break;
+        case 'p':
+            out_char(o, '0');
+            out_char(o, 'x');
+            out_num(o, (uint64_t)va_arg(ap, void *), 0, 16, width, pad);
+            break;
+        case 's': {
+            const char *s = va_arg(ap, const char *);
+            if (!s) s = "(null)";
+            while (*s) out_char(o, *s++);
+            break;
+        }
+        case 'c':
+            out_char(o, (char)va_arg(ap, int));
+            break;
+        case '%':
+            out_char(o, '%');
+            break;
+        case 0:
+            return;
+        default:  // Unknown: show it as written
+            out_char(o, '%');
+            out_char(o, *fmt);
+        }
+    }
+}
+
+// The unfiltered half of klog()
+void klog_write(int level, const char *fmt, ...) {
+    uint32_t pos = __atomic_fetch_add(&klog_head, 1, __ATOMIC_RELAXED);
+    klog_record_t *r = &ring[pos % KLOG_RECORDS];
+    r->seq = 0;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    klog_out_t o = {r->text, 0, KLOG_MSG_MAX - 1};
+    va_list ap;
+    va_start(ap, fmt);
+    klog_vformat(&o, fmt, ap);
+    va_end(ap);
+    if (o.len && r->text[o.len - 1] == '\n') o.len--;  // Records are lines
+    r->text[o.len] = 0;
+    r->len = o.len;
+    r->level = level;
+    r->time = timer_now();
+    __atomic_store_n(&r->seq, pos + 1, __ATOMIC_RELEASE);
+
+    if (klogd_waiting && level <= klog_console_level) {
+        klogd_waiting = 0;
+        scheduler_wakeup((void *)&klogd_waiting);
+    }
+}
+
+// Position of the oldest record still in the ring
+uint32_t klog_oldest(void) {
+    uint32_t head = __atomic_load_n(&klog_head, __ATOMIC_RELAXED);
+    return head > KLOG_RECORDS ? head - KLOG_RECORDS : 0;
+}
+
+// Copy the record at *pos out as "[seconds.micros] text\n" and advance
+// *pos past it. Records overwritten before they were read are skipped.
+// Returns the length and the record's level, or 0 if there is no
+// complete record at *pos yet; a record a writer is still filling in
+// holds up the ones after it.
+int klog_read(uint32_t *pos, char *buf, int len, int *level) {
+    klog_record_t copy;
+    while (1) {
+        if ((int32_t)(*pos - klog_oldest()) < 0) *pos = klog_oldest();
+        if (*pos == __atomic_load_n(&klog_head, __ATOMIC_RELAXED)) return 0;
+        klog_record_t *r = &ring[*pos % KLOG_RECORDS];
+        uint32_t seq = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+        if (seq != *pos + 1) {
+            if ((int32_t)(seq - (*pos + 1)) > 0) continue;  // Lapped: oldest moved on
+            return 0;  // Not complete yet
+        }
+        memcpy(&copy, r, sizeof(copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (r->seq == seq) break;
+    }
+    (*pos)++;
+
+    uint64_t us = copy.time / TIMER_US(1);
+    klog_out_t o = {buf, 0, len - 1};
+    copy.text[KLOG_MSG_MAX - 1] = 0;
+    out_char(&o, '[');
+    out_num(&o, us / 1000000, 0, 10, 5, ' ');
+    out_char(&o, '.');
+    out_num(&o, us % 1000000, 0, 10, 6, '0');
+    out_char(&o, ']');
+    out_char(&o, ' ');
+    for (const char *s = copy.text; *s; s++) out_char(&o, *s);
+    out_char(&o, '\n');
+    buf[o.len] = 0;
+    *level = copy.level;
+    return o.len;
+}
+
+// Write every complete record the console has not had yet, skipping
+// those above klog_console_level. Runs in klogd, or directly before the
+// kernel halts.
+void klog_flush(void) {
+    char line[KLOG_MSG_MAX + 24];
+    int level;
+    while (klog_read(&console_pos, line, sizeof(line), &level) > 0) {
+        if (level <= klog_console_level) uart_puts(line);
+    }
+}
+
+// klogd: sleeps until a message for the console comes in, then writes it
+// out. Under the fair policy it runs at the lowest priority.
+void klog_task(void) {
+    while (1) {
+        klog_flush();
+        int s = intr_off();
+        int idle = console_pos == __atomic_load_n(&klog_head, __ATOMIC_RELAXED);
+        if (idle) {
+            klogd_waiting = 1;
+            scheduler_sleep((void *)&klogd_waiting);
+        }
+        intr_restore(s);
+        if (!idle) scheduler_yield();  // A record is still being written
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+
+// Message levels, most severe first
+#define KLOG_ERR 0
+#define KLOG_WARN 1
+#define KLOG_INFO 2
+#define KLOG_DEBUG 3
+
+// The ring keeps the last KLOG_RECORDS messages of up to KLOG_MSG_MAX - 1
+// characters each (longer ones are cut)
+#define KLOG_RECORDS 64
+#define KLOG_MSG_MAX 112
+
+// Messages above klog_level are dropped on the spot; those above
+// klog_console_level are recorded for dmesg but not printed
+extern int klog_level;
+extern int klog_console_level;
+
+// Log a message: printf-style, with %d %i %u %x %p %s %c and %%, an 'l'
+// size prefix (64-bit arguments) and a zero-padded width. A level that
+// is filtered out costs the one comparison. Lock-free and safe from
+// interrupt handlers, though not from inside the scheduler (a message for
+// the console wakes klogd). The message reaches the console when klogd,
+// or a flush, gets to it.
+#define klog(level, ...)                                        \
+    do {                                                        \
+        if ((level) <= klog_level) klog_write((level), __VA_ARGS__); \
+    } while (0)
+
+void klog_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+int klog_read(uint32_t *pos, char *buf, int len, int *level);
+uint32_t klog_oldest(void);
+void klog_flush(void);
+void klog_task(void);
+
+#endif
@@ -0,0 +1,136 @@
+#include "lz4.h"
+#include "string.h"
+#include <stdint.h>
+
+// Greedy single-pass LZ4 compressor with a small hash table of recent
+// positions, and a decoder that checks every length and offset against
+// its buffers.
+
+#define LZ4_HASH_LOG 10
+#define LZ4_MIN_MATCH 4
+#define LZ4_LAST_LITERALS 5     // The format ends every block with literals
+#define LZ4_MF_LIMIT 12         // No match may start closer to the end
+
+// Position + 1 of the last 4-byte sequence with each hash, 0 if none.
+// Static rather than on the stack: kernel stacks are small. Callers
+// serialize (the file system is the only one).
+static uint16_t lz4_table[1 << LZ4_HASH_LOG];
+
+static inline uint32_t lz4_read32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint32_t lz4_hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+// Extra length bytes for a length that did not fit its 4-bit field
+static uint8_t *lz4_put_len(uint8_t *op, int n) {
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = n;
+    return op;
+}
+
+// One sequence: 'lit' literals from 'anchor', then a match of 'mlen' bytes
+// at 'off' back (mlen 0 ends the block with literals only). Returns the
+// new output position, or 0 if it does not fit before 'oend'.
+static uint8_t *lz4_sequence(uint8_t *op, uint8_t *oend, const uint8_t *anchor,
+                             int lit, int off, int mlen) {
+    int need = 1 + lit + lit / 255 + 1 + (mlen ? 2 + (mlen - LZ4_MIN_MATCH) / 255 + 1 : 0);
+    if (need > oend - op) return 0;
+    uint8_t *token = op++;
+    *token = (lit < 15 ? lit : 15) << 4;
+    if (lit >= 15) op = lz4_put_len(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    if (mlen) {
+        *op++ = off;
+        *op++ = off >> 8;
+        mlen -= LZ4_MIN_MATCH;
+        *token |= mlen < 15 ? mlen : 15;
+        if (mlen >= 15) op = lz4_put_len(op, mlen - 15);
+    }
+    return op;
+}
+
+// Compress 'len' bytes into at most 'cap' bytes at 'dst'. Returns the
+// compressed size, or -1 if it does not fit (the data does not compress).
+int lz4_compress(const void *src, int len, void *dst, int cap) {
+    const uint8_t *base = src;
+    const uint8_t *ip = base, *anchor = base, *iend = base + len;
+    uint8_t *op = dst, *oend = op + cap;
+    if (len < 0 || len > LZ4_MAX_INPUT) return -1;
+
+    if (len > LZ4_MF_LIMIT) {
+        const uint8_t *mflimit = iend - LZ4_MF_LIMIT;
+        const uint8_t *matchlimit = iend - LZ4_LAST_LITERALS;
+        memset(lz4_table, 0, sizeof(lz4_table));
+        while (ip <= mflimit) {
+            uint32_t h = lz4_hash(lz4_read32(ip));
+            int cand = lz4_table[h];
+            lz4_table[h] = ip - base + 1;
+            const uint8_t *ref = base + cand - 1;
+            if (!cand || lz4_read32(ref) != lz4_read32(ip)) {
+                ip++;
+                continue;
+            }
+            // Grow the match backwards into the pending literals, then forwards
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t *end = ip + LZ4_MIN_MATCH;
+            while (end < matchlimit && *end == ref[end - ip]) end++;
+
+            op = lz4_sequence(op, oend, anchor, ip - anchor, ip - ref, end - ip);
+            if (!op) return -1;
+            ip = anchor = end;
+        }
+    }
+    op = lz4_sequence(op, oend, anchor, iend - anchor, 0, 0);
+    return op ? op - (uint8_t *)dst : -1;
+}
+
+// Length continuation bytes; returns -1 if they run past 'iend'
+static int lz4_get_len(const uint8_t **ip, const uint8_t *iend, int *len) {
+    int b;
+    do {
+        if (*ip >= iend) return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 0;
+}
+
+// Decompress the 'len'-byte block at 'src' into at most 'cap' bytes at
+// 'dst'. Returns the decompressed size, or -1 if the block is malformed
+// or does not fit.
+int lz4_decompress(const void *src, int len, void *dst, int cap) {
+    const uint8_t *ip = src, *iend = ip + len;
+    uint8_t *op = dst, *ostart = op, *oend = op + cap;
+    while (ip < iend) {
+        int token = *ip++;
+        int lit = token >> 4;
+        if (lit == 15 && lz4_get_len(&ip, iend, &lit) < 0) return -1;
+        if (lit > iend - ip || lit > oend - op) return -1;
+        memcpy(op, ip, lit);
+        op += lit;
+        ip += lit;
+        if (ip == iend) break;  // The last sequence has no match
+
+        if (iend - ip < 2) return -1;
+        int off = ip[0] | ip[1] << 8;
+        ip += 2;
+        int mlen = token & 15;
+        if (mlen == 15 && lz4_get_len(&ip, iend, &mlen) < 0) return -1;
+        mlen += LZ4_MIN_MATCH;
+        if (off == 0 || off > op - ostart || mlen > oend - op) return -1;
+        // Byte by byte: the match may overlap what it produces
+        const uint8_t *m = op - off;
+        while (mlen--) *op++ = *m++;
+    }
+    return op - ostart;
+}
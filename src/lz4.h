@@ -0,0 +1,11 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+// LZ4 block format (no frame header or checksums), for blocks of at most
+// LZ4_MAX_INPUT bytes so every match offset fits the format's 16 bits.
+#define LZ4_MAX_INPUT 65535
+
+int lz4_compress(const void *src, int len, void *dst, int cap);
+int lz4_decompress(const void *src, int len, void *dst, int cap);
+
+#endif
@@ -0,0 +1,500 @@
+#include "net.h"
+#include "virtio_net.h"
+#include "scheduler.h"
+#include "timer.h"
+#include "hart.h"
+#include "vm.h"
+#include "kalloc.h"
+#include "string.h"
+#include "uaccess.h"
+#include <stdint.h>
+
+// Frames are parsed and built in place, a byte at a time, so nothing here
+// depends on structure packing or alignment.
+#define ETH_HLEN 14
+#define ETH_P_IP 0x0800
+#define ETH_P_ARP 0x0806
+#define ARP_LEN 28
+#define ARP_REQUEST 1
+#define ARP_REPLY 2
+#define IP_HLEN 20
+#define IP_PROTO_UDP 17
+#define IP_TTL 64
+#define UDP_HLEN 8
+// Ethernet, IPv4 and UDP headers in front of a payload
+#define NET_HDRS (ETH_HLEN + IP_HLEN + UDP_HLEN)
+
+// A datagram waiting on a socket. It stays in the driver's receive buffer
+// until it is read.
+typedef struct {
+    int buf;                // Receive buffer to give back afterwards
+    const uint8_t *data;
+    int len;
+    uint32_t ip;            // Sender
+    uint16_t port;
+} net_dgram_t;
+
+typedef struct {
+    int in_use;
+    uint16_t port;          // Local port
+    uint32_t peer_ip;       // Set by net_connect, for net_send
+    uint16_t peer_port;
+    net_dgram_t queue[NET_SOCK_QUEUE];
+    int head;
+    int count;
+} socket_t;
+
+typedef struct {
+    uint32_t ip;            // 0 for a free entry
+    uint8_t mac[6];
+} arp_entry_t;
+
+// Sockets and the ARP table are shared with the receive path, which runs
+// in the interrupt handler; tasks change them with interrupts off.
+static socket_t sockets[NET_MAX_SOCKETS];
+static arp_entry_t arp_table[NET_ARP_ENTRIES];
+static int arp_next;                // Entry replaced next when the table is full
+static int net_state;               // 0: not started, 1: up, -1: no device
+static uint16_t next_port = NET_EPHEMERAL_BASE;
+static uint16_t ip_id;
+static net_stats_t stats;
+// ARP replies are sent from the interrupt handler out of this buffer. A
+// request that comes in while the last reply is still queued goes
+// unanswered; the asker tries again.
+static virtio_net_tx_t arp_tx = {.done = 1};
+static uint8_t arp_frame[ETH_HLEN + ARP_LEN];
+
+static const uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+
+static int net_input(int buf, const uint8_t *frame, int len);
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int mac_equal(const uint8_t *a, const uint8_t *b) {
+    for (int i = 0; i < 6; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+// Internet checksum: add 'len' bytes as big-endian 16-bit words to 'sum'
+static uint32_t csum_add(uint32_t sum, const uint8_t *p, int len) {
+    for (; len > 1; p += 2, len -= 2) sum += get16(p);
+    if (len) sum += p[0] << 8;
+    return sum;
+}
+
+static uint16_t csum_fold(uint32_t sum) {
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+// Bring the device up on first use
+static int net_up(void) {
+    if (!net_state) net_state = virtio_net_init(net_input) == 0 ? 1 : -1;
+    return net_state > 0 ? 0 : -1;
+}
+
+static int valid_socket(int s) {
+    return s >= 0 && s < NET_MAX_SOCKETS && sockets[s].in_use;
+}
+
+// Wakes whatever waits on ev->arg once a wait has timed out
+static void net_timeout(timer_event_t *ev, uint64_t *tf) {
+    (void)tf;
+    scheduler_wakeup(ev->arg);
+}
+
+static int killed(void) {
+    task_t *t = scheduler_current_task();
+    return t && t->killed;
+}
+
+// ARP
+
+static int arp_lookup(uint32_t ip, uint8_t mac[6]) {
+    for (int i = 0; i < NET_ARP_ENTRIES; i++) {
+        if (arp_table[i].ip == ip) {
+            memcpy(mac, arp_table[i].mac, 6);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void arp_learn(uint32_t ip, const uint8_t *mac) {
+    int e = -1;
+    for (int i = 0; i < NET_ARP_ENTRIES && e < 0; i++) {
+        if (arp_table[i].ip == ip) e = i;
+    }
+    if (e < 0) {
+        e = arp_next;
+        arp_next = (arp_next + 1) % NET_ARP_ENTRIES;
+    }
+    arp_table[e].ip = ip;
+    memcpy(arp_table[e].mac, mac, 6);
+    scheduler_wakeup(arp_table);
+}
+
+// Fill in an ARP request or reply from us to 'dst'
+static void arp_build(uint8_t *f, int op, const uint8_t *dst, uint32_t target_ip,
+                      const uint8_t *target_mac) {
+    const uint8_t *mac = virtio_net_mac();
+    memcpy(f, dst, 6);
+    memcpy(f + 6, mac, 6);
+    put16(f + 12, ETH_P_ARP);
+    uint8_t *a = f + ETH_HLEN;
+    put16(a, 1);                // Ethernet
+    put16(a + 2, ETH_P_IP);
+    a[4] = 6;
+    a[5] = 4;
+    put16(a + 6, op);
+    memcpy(a + 8, mac, 6);
+    put32(a + 14, NET_IP);
+    memcpy(a + 18, target_mac, 6);
+    put32(a + 24, target_ip);
+}
+
+// Learn the sender of every ARP packet, and answer requests for our address
+static void arp_input(const uint8_t *a, int len) {
+    if (len < ARP_LEN || get16(a) != 1 || get16(a + 2) != ETH_P_IP || a[4] != 6 || a[5] != 4) {
+        stats.rx_dropped++;
+        return;
+    }
+    uint32_t sender = get32(a + 14);
+    if (sender) arp_learn(sender, a + 8);
+    if (get16(a + 6) != ARP_REQUEST || get32(a + 24) != NET_IP || !arp_tx.done) return;
+
+    arp_build(arp_frame, ARP_REPLY, a + 8, sender, a + 8);
+    arp_tx.nseg = 1;
+    arp_tx.seg[0].addr = (uint64_t)arp_frame;
+    arp_tx.seg[0].len = sizeof(arp_frame);
+    if (virtio_net_send(&arp_tx, 0) == 0) {
+        stats.tx_frames++;
+    } else {
+        arp_tx.done = 1;
+    }
+}
+
+// MAC address to send a packet for 'ip' to: its own on the local network,
+// the gateway's otherwise. Asks with ARP if it is not known yet.
+// Returns -1 if nobody answered.
+static int arp_resolve(uint32_t ip, uint8_t mac[6]) {
+    if (ip == 0xffffffff) {
+        memcpy(mac, broadcast, 6);
+        return 0;
+    }
+    uint32_t hop = (ip & NET_NETMASK) == (NET_IP & NET_NETMASK) ? ip : NET_GATEWAY;
+    for (int tries = 0; tries < NET_ARP_TRIES && !killed(); tries++) {
+        int s = intr_off();
+        int found = arp_lookup(hop, mac) == 0;
+        intr_restore(s);
+        if (found) return 0;
+
+        static const uint8_t unknown[6];
+        uint8_t frame[ETH_HLEN + ARP_LEN];
+        virtio_net_tx_t tx;
+        arp_build(frame, ARP_REQUEST, broadcast, hop, unknown);
+        tx.nseg = 1;
+        tx.seg[0].addr = (uint64_t)frame;
+        tx.seg[0].len = sizeof(frame);
+        if (virtio_net_send(&tx, 1) < 0) return -1;
+        stats.tx_frames++;
+        stats.arp_requests++;
+
+        timer_event_t ev = {0};
+        ev.fn = net_timeout;
+        ev.arg = arp_table;
+        s = intr_off();
+        if (timer_add(&ev, timer_now() + TIMER_US(NET_ARP_TIMEOUT_US)) == 0) {
+            while (ev.slot && arp_lookup(hop, mac) < 0 && !killed()) virtio_net_idle(arp_table);
+            timer_cancel(&ev);
+        }
+        intr_restore(s);
+    }
+    int s = intr_off();
+    int r = arp_lookup(hop, mac);
+    intr_restore(s);
+    return r;
+}
+
+// Receive path, in the interrupt handler
+
+static int udp_input(int buf, uint32_t src, const uint8_t *u, int len) {
+    int ulen = len >= UDP_HLEN ? get16(u + 4) : 0;
+    if (ulen < UDP_HLEN || ulen > len) return 0;
+    uint16_t port = get16(u + 2);
+    for (int s = 0; s < NET_MAX_SOCKETS; s++) {
+        socket_t *so = &sockets[s];
+        if (!so->in_use || so->port != port) continue;
+        if (so->count == NET_SOCK_QUEUE) return 0;
+        net_dgram_t *d = &so->queue[(so->head + so->count) % NET_SOCK_QUEUE];
+        d->buf = buf;
+        d->data = u + UDP_HLEN;
+        d->len = ulen - UDP_HLEN;
+        d->ip = src;
+        d->port = get16(u);
+        so->count++;
+        stats.rx_udp++;
+        scheduler_wakeup(so);
+        return 1;
+    }
+    return 0;
+}
+
+static int ip_input(int buf, const uint8_t *p, int len) {
+    if (len < IP_HLEN || (p[0] >> 4) != 4) return 0;
+    int hlen = (p[0] & 0xf) * 4;
+    int total = get16(p + 2);
+    if (hlen < IP_HLEN || total < hlen || total > len || csum_fold(csum_add(0, p, hlen)) != 0) {
+        return 0;
+    }
+    // Fragments (more to come, or a nonzero offset) are not reassembled
+    if (get16(p + 6) & 0x3fff) return 0;
+    if (get32(p + 16) != NET_IP || p[9] != IP_PROTO_UDP) return 0;
+    return udp_input(buf, get32(p + 12), p + hlen, total - hlen);
+}
+
+// Receive handler of the driver: returns 1 if a socket kept the buffer
+static int net_input(int buf, const uint8_t *frame, int len) {
+    stats.rx_frames++;
+    if (len >= ETH_HLEN && (mac_equal(frame, virtio_net_mac()) || mac_equal(frame, broadcast))) {
+        uint16_t type = get16(frame + 12);
+        if (type == ETH_P_ARP) {
+            arp_input(frame + ETH_HLEN, len - ETH_HLEN);
+            return 0;
+        }
+        if (type == ETH_P_IP && ip_input(buf, frame + ETH_HLEN, len - ETH_HLEN)) return 1;
+    }
+    stats.rx_dropped++;
+    return 0;
+}
+
+// Sockets
+
+// Open a UDP socket on local 'port', or on a free ephemeral port if it is
+// 0. Returns the socket, or -1 if the port is taken, no socket is free or
+// there is no network device.
+int net_socket(int port) {
+    if (port < 0 || port > 0xffff || net_up() < 0) return -1;
+    int s = intr_off();
+    int free = -1;
+    for (int tries = 0; tries <= NET_MAX_SOCKETS; tries++) {
+        int want = port ? port : next_port;
+        int taken = 0;
+        free = -1;
+        for (int i = 0; i < NET_MAX_SOCKETS; i++) {
+            if (sockets[i].in_use && sockets[i].port == want) taken = 1;
+            if (!sockets[i].in_use && free < 0) free = i;
+        }
+        if (!port) next_port = next_port == 0xffff ? NET_EPHEMERAL_BASE : next_port + 1;
+        if (free < 0 || (taken && port)) {
+            free = -1;
+            break;
+        }
+        if (!taken) {
+            socket_t *so = &sockets[free];
+            so->port = want;
+            so->peer_ip = 0;
+            so->peer_port = 0;
+            so->head = 0;
+            so->count = 0;
+            so->in_use = 1;
+            break;
+        }
+        free = -1;
+    }
+    intr_restore(s);
+    return free;
+}
+
+// Set the destination net_send uses
+int net_connect(int s, uint32_t ip, int port) {
+    if (!valid_socket(s) || port <= 0 || port > 0xffff) return -1;
+    sockets[s].peer_ip = ip;
+    sockets[s].peer_port = port;
+    return 0;
+}
+
+// Describe [buf, buf + len) by physical address, one segment for each
+// physically contiguous run, faulting in pages of the caller's address
+// space that were never touched. Returns the number of segments, or -1.
+static int phys_segs(const uint8_t *buf, int len, virtio_net_seg_t *seg, int max) {
+    task_t *task = scheduler_current_task();
+    struct vm_space *space = task ? task->space : 0;
+    int n = 0;
+    while (len > 0) {
+        uint64_t va = (uint64_t)buf;
+        uint64_t pa = vm_translate(space, va);
+        if (!pa && (vm_handle_fault(space, va, 0) < 0 || !(pa = vm_translate(space, va)))) {
+            return -1;
+        }
+        int chunk = PAGE_SIZE - (va % PAGE_SIZE);
+        if (chunk > len) chunk = len;
+        if (n && seg[n - 1].addr + seg[n - 1].len == pa) {
+            seg[n - 1].len += chunk;
+        } else {
+            if (n == max) return -1;
+            seg[n].addr = pa;
+            seg[n].len = chunk;
+            n++;
+        }
+        buf += chunk;
+        len -= chunk;
+    }
+    return n;
+}
+
+// Send 'len' bytes at 'buf' as one datagram to 'ip':'port'. Only the
+// headers are built here; the device reads the payload straight from the
+// caller's pages, so the call returns once it is out.
+// Returns 'len', or -1.
+int net_sendto(int s, const void *buf, int len, uint32_t ip, int port) {
+    if (!valid_socket(s) || len < 0 || len > NET_UDP_MAX || port <= 0 || port > 0xffff) {
+        return -1;
+    }
+    uint8_t h[NET_HDRS];
+    if (arp_resolve(ip, h) < 0) return -1;
+
+    virtio_net_tx_t tx;
+    tx.seg[0].addr = (uint64_t)h;
+    tx.seg[0].len = sizeof(h);
+    int nseg = phys_segs(buf, len, &tx.seg[1], VIRTIO_NET_MAX_SEGS - 1);
+    if (nseg < 0) return -1;
+    tx.nseg = 1 + nseg;
+
+    memcpy(h + 6, virtio_net_mac(), 6);
+    put16(h + 12, ETH_P_IP);
+
+    uint8_t *p = h + ETH_HLEN;
+    p[0] = 0x45;                // Version 4, no options
+    p[1] = 0;
+    put16(p + 2, IP_HLEN + UDP_HLEN + len);
+    put16(p + 4, ip_id++);
+    put16(p + 6, 0x4000);       // Don't fragment
+    p[8] = IP_TTL;
+    p[9] = IP_PROTO_UDP;
+    put16(p + 10, 0);
+    put32(p + 12, NET_IP);
+    put32(p + 16, ip);
+    put16(p + 10, csum_fold(csum_add(0, p, IP_HLEN)));
+
+    uint8_t *u = p + IP_HLEN;
+    put16(u, sockets[s].port);
+    put16(u + 2, port);
+    put16(u + 4, UDP_HLEN + len);
+    put16(u + 6, 0);
+    // Over the pseudo-header (addresses, protocol, length), header and payload
+    uint32_t sum = csum_add(0, p + 12, 8) + IP_PROTO_UDP + UDP_HLEN + len;
+    sum = csum_add(sum, u, UDP_HLEN);
+    // phys_segs mapped every page of the payload, so it reads in place
+    uaccess_enable();
+    uint16_t csum = csum_fold(csum_add(sum, buf, len));
+    uaccess_disable();
+    put16(u + 6, csum ? csum : 0xffff);
+
+    if (virtio_net_send(&tx, 1) < 0) return -1;
+    stats.tx_frames++;
+    stats.tx_udp++;
+    return len;
+}
+
+// Send to the address given to net_connect
+int net_send(int s, const void *buf, int len) {
+    if (!valid_socket(s) || !sockets[s].peer_port) return -1;
+    return net_sendto(s, buf, len, sockets[s].peer_ip, sockets[s].peer_port);
+}
+
+// Receive one datagram into 'buf', blocking until one arrives, or at most
+// 'timeout_us' if that is not 0. A datagram longer than 'len' is cut short.
+// Its payload is copied once, from the receive buffer the device wrote it
+// to, and the buffer goes back to the device right after.
+// Returns the bytes received, or -1 on a timeout or if the socket closed.
+// A datagram that can't be copied to 'buf' is dropped with -EFAULT.
+int net_recvfrom(int s, void *buf, int len, uint32_t *ip, uint16_t *port, uint32_t timeout_us) {
+    if (!valid_socket(s) || len < 0) return -1;
+    socket_t *so = &sockets[s];
+    timer_event_t ev = {0};
+    ev.fn = net_timeout;
+    ev.arg = so;
+
+    int irq = intr_off();
+    int timed = timeout_us && timer_add(&ev, timer_now() + TIMER_US(timeout_us)) == 0;
+    while (so->in_use && !so->count && (!timed || ev.slot) && !killed()) virtio_net_idle(so);
+    if (timed) timer_cancel(&ev);
+    if (!so->in_use || !so->count) {
+        intr_restore(irq);
+        return -1;
+    }
+    net_dgram_t d = so->queue[so->head];
+    so->head = (so->head + 1) % NET_SOCK_QUEUE;
+    so->count--;
+    intr_restore(irq);
+
+    int n = d.len < len ? d.len : len;
+    int r = __uaccess_copy(buf, d.data, n);
+    virtio_net_rx_release(d.buf);
+    if (r < 0) return r;
+    if (ip) *ip = d.ip;
+    if (port) *port = d.port;
+    return n;
+}
+
+int net_recv(int s, void *buf, int len) {
+    return net_recvfrom(s, buf, len, 0, 0, 0);
+}
+
+// Close a socket: datagrams not read yet are dropped, and tasks waiting
+// on it return -1
+void net_close(int s) {
+    if (!valid_socket(s)) return;
+    int irq = intr_off();
+    socket_t *so = &sockets[s];
+    so->in_use = 0;
+    for (; so->count; so->count--) {
+        virtio_net_rx_release(so->queue[so->head].buf);
+        so->head = (so->head + 1) % NET_SOCK_QUEUE;
+    }
+    scheduler_wakeup(so);
+    intr_restore(irq);
+}
+
+// Local port of socket 's', or -1 if it is not open
+int net_socket_port(int s) {
+    return valid_socket(s) ? sockets[s].port : -1;
+}
+
+// Our MAC address, or 0 if there is no network device
+const uint8_t *net_mac(void) {
+    return net_up() < 0 ? 0 : virtio_net_mac();
+}
+
+const net_stats_t *net_stats(void) {
+    return &stats;
+}
+
+// Entry 'i' of the ARP table; returns -1 if it is free
+int net_arp_entry(int i, uint32_t *ip, uint8_t mac[6]) {
+    if (i < 0 || i >= NET_ARP_ENTRIES || !arp_table[i].ip) return -1;
+    *ip = arp_table[i].ip;
+    memcpy(mac, arp_table[i].mac, 6);
+    return 0;
+}
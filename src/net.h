@@ -0,0 +1,58 @@
+#ifndef NET_H
+#define NET_H
+
+#include <stdint.h>
+
+// A minimal IPv4 stack over virtio-net: ARP, IPv4 without fragments and
+// UDP sockets. Addresses and ports are in host byte order.
+#define NET_IP4(a, b, c, d) (((uint32_t)(a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+// Static configuration matching QEMU's user-mode networking, where the
+// gateway also stands for the host
+#define NET_IP NET_IP4(10, 0, 2, 15)
+#define NET_NETMASK NET_IP4(255, 255, 255, 0)
+#define NET_GATEWAY NET_IP4(10, 0, 2, 2)
+
+#define NET_MAX_SOCKETS 4
+// Datagrams a socket holds until read. Each keeps a receive buffer of the
+// driver, so together they leave some of the ring posted.
+#define NET_SOCK_QUEUE 3
+// Largest UDP payload that fits one Ethernet frame
+#define NET_UDP_MAX 1472
+// Ports handed out to sockets opened with port 0
+#define NET_EPHEMERAL_BASE 49152
+#define NET_ARP_ENTRIES 8
+// An address is asked for this many times, this long apart
+#define NET_ARP_TRIES 3
+#define NET_ARP_TIMEOUT_US 200000
+
+// A datagram for SYS_SENDTO and SYS_RECVFROM
+typedef struct {
+    void *buf;
+    uint32_t len;           // Bytes to send, or room to receive into
+    uint32_t ip;            // Destination, or filled in with the source
+    uint16_t port;
+    uint32_t timeout_us;    // SYS_RECVFROM gives up after this long; 0 waits forever
+} net_msg_t;
+
+typedef struct {
+    uint64_t rx_frames;
+    uint64_t tx_frames;
+    uint64_t rx_udp;        // Datagrams queued on a socket
+    uint64_t tx_udp;
+    uint64_t rx_dropped;    // Not for us, malformed, or no room on the socket
+    uint64_t arp_requests;  // Sent by us
+} net_stats_t;
+
+int net_socket(int port);
+int net_connect(int s, uint32_t ip, int port);
+int net_sendto(int s, const void *buf, int len, uint32_t ip, int port);
+int net_recvfrom(int s, void *buf, int len, uint32_t *ip, uint16_t *port, uint32_t timeout_us);
+int net_send(int s, const void *buf, int len);
+int net_recv(int s, void *buf, int len);
+void net_close(int s);
+int net_socket_port(int s);
+const uint8_t *net_mac(void);
+const net_stats_t *net_stats(void);
+int net_arp_entry(int i, uint32_t *ip, uint8_t mac[6]);
+
+#endif
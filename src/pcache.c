@@ -0,0 +1,217 @@
+#include "pcache.h"
+#include "fs.h"
+#include "kalloc.h"
+#include "rwlock.h"
+#include "string.h"
+#include <stdint.h>
+
+// One cached page. Free slots have ino == 0.
+typedef struct {
+    uint32_t ino;
+    uint32_t index;         // Page index within the file
+    int next;               // Next slot in the hash chain, as index + 1
+    int referenced;         // Clock bit: set on every hit
+    int pins;               // Mappings and readers copying out; pinned pages stay put
+} pcache_entry_t;
+
+static char pages[PCACHE_PAGES][PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+static pcache_entry_t entries[PCACHE_PAGES];
+static int buckets[PCACHE_HASH];  // First slot of each chain, as index + 1
+static int hand;                  // Clock hand
+// Bumped whenever cached contents of a bucket's pages change, so a fill
+// that raced with a write can tell its copy may be out of date
+static uint32_t updates[PCACHE_HASH];
+// Lookups and pins share this lock; the chains, the clock and free slots
+// change under it exclusively. Fills run with no lock held, since they
+// call back into the file system. Pins and counters are updated atomically.
+static rwlock_t lock;
+static pcache_stats_t stats;
+
+static inline void stat_inc(uint64_t *counter) {
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+static inline int pcache_bucket(uint32_t ino, uint32_t index) {
+    return (ino * 31 + index) % PCACHE_HASH;
+}
+
+// Find the slot caching page 'index' of 'ino', or -1. The lock is held.
+static int pcache_lookup(uint32_t ino, uint32_t index) {
+    for (int s = buckets[pcache_bucket(ino, index)]; s; s = entries[s - 1].next) {
+        if (entries[s - 1].ino == ino && entries[s - 1].index == index) return s - 1;
+    }
+    return -1;
+}
+
+// Remove a slot from its hash chain and mark it free
+static void pcache_drop(int slot) {
+    pcache_entry_t *e = &entries[slot];
+    int *link = &buckets[pcache_bucket(e->ino, e->index)];
+    while (*link && *link != slot + 1) link = &entries[*link - 1].next;
+    if (*link) *link = e->next;
+    e->ino = 0;
+    e->next = 0;
+}
+
+// Clock eviction: pick a free slot, or the first unpinned page that was
+// not used since the hand last passed it. Returns -1 if all are pinned.
+// The lock is held exclusively.
+static int pcache_victim(void) {
+    for (int n = 0; n < 2 * PCACHE_PAGES; n++) {
+        int slot = hand;
+        pcache_entry_t *e = &entries[slot];
+        hand = (hand + 1) % PCACHE_PAGES;
+        if (__atomic_load_n(&e->pins, __ATOMIC_RELAXED)) continue;
+        if (!e->ino) return slot;
+        if (e->referenced) {
+            e->referenced = 0;
+            continue;
+        }
+        pcache_drop(slot);
+        stat_inc(&stats.evictions);
+        return slot;
+    }
+    return -1;
+}
+
+// Read page 'index' of 'ino' into a fresh slot and return it, holding a
+// pin if 'pin'. The slot is reserved with a pin while the file system
+// fills it; if the page was written meanwhile the copy may be stale, and
+// the fill starts over. Returns -1 past the end of the file or if every
+// page is pinned.
+static int pcache_fill(uint32_t ino, uint32_t index, int referenced, int pin) {
+    int b = pcache_bucket(ino, index);
+    for (;;) {
+        rwlock_write_lock(&lock);
+        int slot = pcache_lookup(ino, index);
+        if (slot < 0) slot = pcache_victim();
+        if (slot < 0 || entries[slot].ino) {
+            // No room, or someone else filled the page in the meantime
+            if (slot >= 0 && pin) __atomic_add_fetch(&entries[slot].pins, 1, __ATOMIC_RELAXED);
+            rwlock_write_unlock(&lock);
+            return slot;
+        }
+        __atomic_store_n(&entries[slot].pins, 1, __ATOMIC_RELAXED);  // Reserved
+        uint32_t seen = updates[b];
+        rwlock_write_unlock(&lock);
+
+        int filled = fs_fill_page(ino, index, pages[slot]) == 0;
+
+        rwlock_write_lock(&lock);
+        if (filled && updates[b] == seen && pcache_lookup(ino, index) < 0) {
+            pcache_entry_t *e = &entries[slot];
+            e->ino = ino;
+            e->index = index;
+            e->referenced = referenced;
+            __atomic_store_n(&e->pins, pin, __ATOMIC_RELAXED);
+            e->next = buckets[b];
+            buckets[b] = slot + 1;
+            rwlock_write_unlock(&lock);
+            return slot;
+        }
+        __atomic_store_n(&entries[slot].pins, 0, __ATOMIC_RELAXED);
+        rwlock_write_unlock(&lock);
+        if (!filled) return -1;
+        // Another copy went in first, or ours may predate a write: look again
+    }
+}
+
+static int pcache_find(uint32_t ino, uint32_t index, int pin) {
+    rwlock_read_lock(&lock);
+    int slot = pcache_lookup(ino, index);
+    if (slot >= 0) {
+        __atomic_store_n(&entries[slot].referenced, 1, __ATOMIC_RELAXED);
+        if (pin) __atomic_add_fetch(&entries[slot].pins, 1, __ATOMIC_RELAXED);
+    }
+    rwlock_read_unlock(&lock);
+    if (slot >= 0) {
+        stat_inc(&stats.hits);
+        return slot;
+    }
+    stat_inc(&stats.misses);
+    return pcache_fill(ino, index, 1, pin);
+}
+
+// Fill up to 'count' pages starting at 'index' that are not cached yet.
+// They go in unreferenced, so pages the reader never reaches leave first.
+void pcache_readahead(uint32_t ino, uint32_t index, uint32_t count) {
+    if (fs_image_page(ino, index)) return;  // Nothing to read in
+    for (uint32_t i = 0; i < count; i++) {
+        rwlock_read_lock(&lock);
+        int cached = pcache_lookup(ino, index + i) >= 0;
+        rwlock_read_unlock(&lock);
+        if (cached) continue;
+        if (pcache_fill(ino, index + i, 0, 0) < 0) return;  // End of file
+        stat_inc(&stats.readahead);
+    }
+}
+
+// Physical address of page 'index' of 'ino', read in on a miss, for
+// mapping into an address space or copying out of. Bytes past the end of
+// the file are zero. The page stays cached until every pcache_unpin. A page
+// of the initramfs image is handed out in place; it never moves, so it
+// needs no pin (pcache_unpin ignores addresses outside the cache). Returns
+// 0 past the end of the file or if every page is pinned.
+uint64_t pcache_pin(uint32_t ino, uint32_t index) {
+    const char *image = fs_image_page(ino, index);
+    if (image) {
+        stat_inc(&stats.in_place);
+        return (uint64_t)image;
+    }
+    int slot = pcache_find(ino, index, 1);
+    return slot < 0 ? 0 : (uint64_t)pages[slot];
+}
+
+static int pcache_slot_of(uint64_t pa) {
+    uint64_t base = (uint64_t)pages;
+    if (pa < base || pa >= base + sizeof(pages)) return -1;
+    return (pa - base) / PAGE_SIZE;
+}
+
+// Another mapping of a pinned page (fork)
+void pcache_dup(uint64_t pa) {
+    int slot = pcache_slot_of(pa);
+    if (slot >= 0) __atomic_add_fetch(&entries[slot].pins, 1, __ATOMIC_RELAXED);
+}
+
+void pcache_unpin(uint64_t pa) {
+    int slot = pcache_slot_of(pa);
+    if (slot < 0) return;
+    int pins = __atomic_load_n(&entries[slot].pins, __ATOMIC_RELAXED);
+    while (pins > 0 && !__atomic_compare_exchange_n(&entries[slot].pins, &pins, pins - 1, 1,
+                                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Write-through: copy bytes just written to the file into any cached pages,
+// so readers and mappings see them. 'src' must not fault: the lock is held.
+void pcache_update(uint32_t ino, uint64_t off, const char *src, uint64_t len) {
+    rwlock_write_lock(&lock);
+    while (len > 0) {
+        uint64_t in_page = off % PAGE_SIZE;
+        uint64_t n = PAGE_SIZE - in_page;
+        if (n > len) n = len;
+        updates[pcache_bucket(ino, off / PAGE_SIZE)]++;
+        int slot = pcache_lookup(ino, off / PAGE_SIZE);
+        if (slot >= 0) memcpy(pages[slot] + in_page, src, n);
+        off += n;
+        src += n;
+        len -= n;
+    }
+    rwlock_write_unlock(&lock);
+}
+
+// Forget every page of a deleted file. Pages still mapped somewhere keep
+// their contents and are reused once unpinned.
+void pcache_invalidate(uint32_t ino) {
+    rwlock_write_lock(&lock);
+    for (int b = 0; b < PCACHE_HASH; b++) updates[b]++;  // Fills in flight are stale
+    for (int i = 0; i < PCACHE_PAGES; i++) {
+        if (entries[i].ino == ino) pcache_drop(i);
+    }
+    rwlock_write_unlock(&lock);
+}
+
+const pcache_stats_t *pcache_stats(void) {
+    return &stats;
+}
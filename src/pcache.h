@@ -0,0 +1,30 @@
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include <stdint.h>
+
+// Pages of file data kept in memory, shared by read() and mmap'ed or loaded
+// programs. A page is identified by the file's inode number and its index.
+#define PCACHE_PAGES 64
+#define PCACHE_HASH 32
+// Largest read-ahead window in pages
+#define PCACHE_RA_MAX 8
+
+// Counters for tuning (see the 'cache' shell command)
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead;     // Pages filled ahead of a sequential reader
+    uint64_t evictions;
+    uint64_t in_place;      // Pages served straight from the initramfs image
+} pcache_stats_t;
+
+void pcache_readahead(uint32_t ino, uint32_t index, uint32_t count);
+uint64_t pcache_pin(uint32_t ino, uint32_t index);
+void pcache_dup(uint64_t pa);
+void pcache_unpin(uint64_t pa);
+void pcache_update(uint32_t ino, uint64_t off, const char *src, uint64_t len);
+void pcache_invalidate(uint32_t ino);
+const pcache_stats_t *pcache_stats(void);
+
+#endif
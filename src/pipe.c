@@ -0,0 +1,98 @@
+#include "pipe.h"
+#include "scheduler.h"
+#include "string.h"
+#include "uaccess.h"
+#include <stdint.h>
+
+// 'nread' and 'nwrite' count bytes ever read and written; their difference
+// is the fill level, and their values modulo PIPE_SIZE are ring positions.
+// Readers sleep on &nwrite (waiting for data), writers on &nread (waiting
+// for space).
+typedef struct {
+    char buf[PIPE_SIZE];
+    uint32_t nread;
+    uint32_t nwrite;
+    int readers;         // Open read ends
+    int writers;         // Open write ends
+} pipe_t;
+
+static pipe_t pipes[MAX_PIPES];
+
+// Allocate a pipe with one read end and one write end; returns its index or -1
+int pipe_alloc(void) {
+    for (int i = 0; i < MAX_PIPES; i++) {
+        if (!pipes[i].readers && !pipes[i].writers) {
+            pipes[i].nread = pipes[i].nwrite = 0;
+            pipes[i].readers = pipes[i].writers = 1;
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Copy up to 'len' bytes out of the pipe, blocking until at least one is
+// available. Returns 0 once the pipe is empty and every write end is closed.
+// Bytes that could not be copied to 'buf' (-EFAULT) stay in the pipe.
+int pipe_read(int p, char *buf, int len) {
+    pipe_t *pp = &pipes[p];
+    while (pp->nread == pp->nwrite) {
+        if (!pp->writers) return 0;
+        scheduler_sleep(&pp->nwrite);
+    }
+
+    int avail = pp->nwrite - pp->nread;
+    int n = len < avail ? len : avail;
+    int done = 0;
+    while (done < n) {
+        // Copy up to the end of the ring, then wrap
+        uint32_t off = pp->nread % PIPE_SIZE;
+        int chunk = PIPE_SIZE - off;
+        if (chunk > n - done) chunk = n - done;
+        if (__uaccess_copy(buf + done, pp->buf + off, chunk) < 0) break;
+        pp->nread += chunk;
+        done += chunk;
+    }
+    if (done) scheduler_wakeup(&pp->nread);
+    return done ? done : -EFAULT;
+}
+
+// Copy all 'len' bytes into the pipe, blocking while it is full.
+// Returns -1 if the read end is closed before anything could be written,
+// or -EFAULT if nothing could be copied from 'buf'.
+int pipe_write(int p, const char *buf, int len) {
+    pipe_t *pp = &pipes[p];
+    int done = 0;
+    while (done < len) {
+        if (!pp->readers) return done ? done : -1;
+        if (pp->nwrite - pp->nread == PIPE_SIZE) {
+            scheduler_wakeup(&pp->nwrite);
+            scheduler_sleep(&pp->nread);
+            continue;
+        }
+        uint32_t off = pp->nwrite % PIPE_SIZE;
+        int chunk = PIPE_SIZE - off;
+        int space = PIPE_SIZE - (pp->nwrite - pp->nread);
+        if (chunk > space) chunk = space;
+        if (chunk > len - done) chunk = len - done;
+        if (__uaccess_copy(pp->buf + off, buf + done, chunk) < 0) {
+            if (done) scheduler_wakeup(&pp->nwrite);
+            return done ? done : -EFAULT;
+        }
+        pp->nwrite += chunk;
+        done += chunk;
+    }
+    scheduler_wakeup(&pp->nwrite);
+    return done;
+}
+
+// Close one end; the other side is woken so it can see EOF or a broken pipe
+void pipe_close(int p, int write_end) {
+    pipe_t *pp = &pipes[p];
+    if (write_end) {
+        if (pp->writers) pp->writers--;
+        scheduler_wakeup(&pp->nwrite);
+    } else {
+        if (pp->readers) pp->readers--;
+        scheduler_wakeup(&pp->nread);
+    }
+}
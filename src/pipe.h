@@ -0,0 +1,15 @@
+#ifndef PIPE_H
+#define PIPE_H
+
+// Pipes are fixed-size ring buffers connecting a write end to a read end.
+// Readers block while the pipe is empty, writers while it is full; each side
+// wakes the other directly instead of polling.
+#define MAX_PIPES 4
+#define PIPE_SIZE 1024
+
+int pipe_alloc(void);
+int pipe_read(int p, char *buf, int len);
+int pipe_write(int p, const char *buf, int len);
+void pipe_close(int p, int write_end);
+
+#endif
@@ -0,0 +1,55 @@
+#include "plic.h"
+#include "fdt.h"
+#include "hart.h"
+#include <stdint.h>
+
+// Register layout of the SiFive/RISC-V PLIC
+#define PLIC_PRIORITY(irq) (4 * (irq))
+#define PLIC_ENABLE(ctx) (0x2000 + 0x80 * (ctx))
+#define PLIC_THRESHOLD(ctx) (0x200000 + 0x1000 * (ctx))
+#define PLIC_CLAIM(ctx) (0x200004 + 0x1000 * (ctx))
+// On QEMU virt every hart has an M-mode and an S-mode context, in that order
+#define PLIC_S_CONTEXT(hart) (2 * (hart) + 1)
+
+// sie.SEIE enables supervisor external interrupts
+#define SIE_SEIE (1UL << 9)
+
+static uint64_t plic_base;
+static void (*handlers[PLIC_MAX_IRQ])(void);
+
+static volatile uint32_t *plic_reg(uint64_t off) {
+    return (volatile uint32_t *)(plic_base + off);
+}
+
+// Find the PLIC on first use; returns -1 if the machine has none
+static int plic_lazy_init(void) {
+    if (plic_base) return 0;
+    const fdt_device_t *dev = fdt_find_device(&boot_fdt, "sifive,plic-1.0.0", 0);
+    if (!dev) dev = fdt_find_device(&boot_fdt, "riscv,plic0", 0);
+    if (!dev) return -1;
+    plic_base = dev->base;
+    *plic_reg(PLIC_THRESHOLD(PLIC_S_CONTEXT(hart_id()))) = 0;
+    asm volatile("csrs sie, %0" :: "r"(SIE_SEIE));
+    return 0;
+}
+
+// Route device interrupt 'irq' to this hart and call 'handler' for it.
+// Returns -1 if there is no PLIC or the irq is out of range.
+int plic_register(uint32_t irq, void (*handler)(void)) {
+    if (irq == 0 || irq >= PLIC_MAX_IRQ || plic_lazy_init() < 0) return -1;
+    handlers[irq] = handler;
+    *plic_reg(PLIC_PRIORITY(irq)) = 1;
+    *plic_reg(PLIC_ENABLE(PLIC_S_CONTEXT(hart_id())) + 4 * (irq / 32)) |= 1u << (irq % 32);
+    return 0;
+}
+
+// Called from the trap handler on a supervisor external interrupt:
+// claim every pending device interrupt and run its handler.
+void plic_handle_irq(void) {
+    volatile uint32_t *claim = plic_reg(PLIC_CLAIM(PLIC_S_CONTEXT(hart_id())));
+    uint32_t irq;
+    while ((irq = *claim) != 0) {
+        if (irq < PLIC_MAX_IRQ && handlers[irq]) handlers[irq]();
+        *claim = irq;  // Complete
+    }
+}
@@ -0,0 +1,13 @@
+#ifndef PLIC_H
+#define PLIC_H
+
+#include <stdint.h>
+
+// Platform-Level Interrupt Controller: routes device interrupts to the
+// supervisor external interrupt of a hart.
+#define PLIC_MAX_IRQ 64
+
+int plic_register(uint32_t irq, void (*handler)(void));
+void plic_handle_irq(void);
+
+#endif
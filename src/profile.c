@@ -0,0 +1,91 @@
+#include "profile.h"
+#include "timer.h"
+#include "trap.h"
+#include "hart.h"
+#include "scheduler.h"
+#include "uart.h"
+#include <stdint.h>
+
+/* Per-hart sample buffer, so the tick path never touches shared state. */
+typedef struct {
+    profile_sample_t samples[PROFILE_MAX_SAMPLES];
+    int count;
+    int dropped;
+} profile_buf_t;
+
+static profile_buf_t profile_bufs[MAX_HARTS];
+static volatile int profiling;
+/* Periodic timer event that takes the samples. */
+static timer_event_t profile_event;
+
+static void profile_event_fire(timer_event_t *ev, uint64_t *tf) {
+    (void)ev;
+    profile_tick(tf);
+}
+
+void profile_start(void) {
+    for (int h = 0; h < MAX_HARTS; h++) {
+        profile_bufs[h].count = 0;
+        profile_bufs[h].dropped = 0;
+    }
+    profiling = 1;
+    profile_event.fn = profile_event_fire;
+    profile_event.period = TIMER_FREQ / PROFILE_HZ;
+    timer_add(&profile_event, timer_now() + profile_event.period);
+}
+
+void profile_stop(void) {
+    profiling = 0;
+    timer_cancel(&profile_event);
+}
+
+/*
+ * Runs in interrupt context on every profiler timer event.
+ * Records the interrupted pc and the current task; once the buffer is
+ * full, samples are counted as dropped instead of overwriting old ones.
+ */
+void profile_tick(uint64_t *tf) {
+    if (!profiling) return;
+
+    uint64_t hart = hart_id();
+    if (hart >= MAX_HARTS) return;
+
+    profile_buf_t *buf = &profile_bufs[hart];
+    if (buf->count >= PROFILE_MAX_SAMPLES) {
+        buf->dropped++;
+        return;
+    }
+    buf->samples[buf->count].pc = tf[TF_SEPC/8];
+    buf->samples[buf->count].task = scheduler_current();
+    buf->count++;
+}
+
+/*
+ * Dumps the samples as one line each:
+ *   P <hart> <task> <pc>
+ * followed by a summary line. tools/profile.py picks the 'P' lines out of
+ * a console log and symbolizes them against build/kernel.elf.
+ */
+void profile_dump(void) {
+    int total = 0, dropped = 0;
+    for (int h = 0; h < MAX_HARTS; h++) {
+        profile_buf_t *buf = &profile_bufs[h];
+        for (int i = 0; i < buf->count; i++) {
+            uart_puts("P ");
+            uart_put_dec(h);
+            uart_puts(" ");
+            if (buf->samples[i].task < 0) uart_puts("-1");
+            else uart_put_dec(buf->samples[i].task);
+            uart_puts(" ");
+            uart_put_hex(buf->samples[i].pc);
+            uart_puts("\n");
+        }
+        total += buf->count;
+        dropped += buf->dropped;
+    }
+    uart_puts("profile: ");
+    uart_put_dec(total);
+    uart_puts(" samples, ");
+    uart_put_dec(dropped);
+    uart_puts(" dropped\n");
+}
@@ -0,0 +1,26 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+/* Number of samples each hart can buffer before new ones are dropped. */
+#define PROFILE_MAX_SAMPLES 2048
+/* Sampling rate while the profiler is running. */
+#define PROFILE_HZ 1000
+
+/* One sample: where the hart was interrupted and which task was running. */
+typedef struct {
+    uint64_t pc;    /* sepc from the trap frame. */
+    int task;       /* Task id, or -1 when no task was running. */
+} profile_sample_t;
+
+/* Clears the sample buffers and starts sampling PROFILE_HZ times a second. */
+void profile_start(void);
+/* Stops sampling; the buffers are kept until the next start. */
+void profile_stop(void);
+/* Records one sample from the trap frame of a timer interrupt. */
+void profile_tick(uint64_t *tf);
+/* Prints every buffered sample in the format tools/profile.py reads. */
+void profile_dump(void);
+
+#endif
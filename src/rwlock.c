@@ -0,0 +1,48 @@
+#include "rwlock.h"
+#include "scheduler.h"
+
+// The lock word only changes through atomic operations. A waiter sleeps on
+// the lock and tries again once woken; wakeups may be spurious, so the
+// host build can stand in a plain yield for the sleep.
+
+// Sleep until an unlock, unless the lock was let go in the meantime
+static void rwlock_wait(rwlock_t *l, int for_write) {
+    __atomic_store_n(&l->waiters, 1, __ATOMIC_SEQ_CST);
+    int s = __atomic_load_n(&l->state, __ATOMIC_SEQ_CST);
+    if (for_write ? s != 0 : s == RWLOCK_WRITER) scheduler_sleep(l);
+}
+
+static void rwlock_wake(rwlock_t *l) {
+    if (__atomic_exchange_n(&l->waiters, 0, __ATOMIC_SEQ_CST)) scheduler_wakeup(l);
+}
+
+void rwlock_read_lock(rwlock_t *l) {
+    int s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+    for (;;) {
+        if (s == RWLOCK_WRITER) {
+            rwlock_wait(l, 0);
+            s = __atomic_load_n(&l->state, __ATOMIC_RELAXED);
+        } else if (__atomic_compare_exchange_n(&l->state, &s, s + 1, 1, __ATOMIC_ACQUIRE,
+                                               __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+}
+
+void rwlock_read_unlock(rwlock_t *l) {
+    if (__atomic_sub_fetch(&l->state, 1, __ATOMIC_RELEASE) == 0) rwlock_wake(l);
+}
+
+void rwlock_write_lock(rwlock_t *l) {
+    int s = 0;
+    while (!__atomic_compare_exchange_n(&l->state, &s, RWLOCK_WRITER, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+        rwlock_wait(l, 1);
+        s = 0;
+    }
+}
+
+void rwlock_write_unlock(rwlock_t *l) {
+    __atomic_store_n(&l->state, 0, __ATOMIC_RELEASE);
+    rwlock_wake(l);
+}
@@ -0,0 +1,21 @@
+#ifndef RWLOCK_H
+#define RWLOCK_H
+
+// Sleeping reader/writer lock: any number of readers, or one writer.
+// Readers are let in whenever no writer holds the lock, so a task may take
+// a read lock it already holds (the file system relies on this when a page
+// cache miss under a read lock comes back to read the file). Writers can be
+// kept waiting while readers keep coming.
+typedef struct {
+    int state;              // Readers holding the lock, or RWLOCK_WRITER; 0 when free
+    int waiters;            // Someone is sleeping on the lock
+} rwlock_t;
+
+#define RWLOCK_WRITER (-1)
+
+void rwlock_read_lock(rwlock_t *l);
+void rwlock_read_unlock(rwlock_t *l);
+void rwlock_write_lock(rwlock_t *l);
+void rwlock_write_unlock(rwlock_t *l);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef SBI_H
+#define SBI_H
+
+#include <stdint.h>
+
+// Legacy SBI call numbers (passed in a7).
+#define SBI_SET_TIMER 0
+#define SBI_CONSOLE_PUTCHAR 1
+#define SBI_CONSOLE_GETCHAR 2
+#define SBI_SHUTDOWN 8
+
+// Makes a Supervisor Binary Interface (SBI) call.
+// 'which' is the SBI call number, 'arg0' is the first argument.
+static inline long sbi_call(long which, long arg0) {
+    register long a0 asm("a0") = arg0;
+    register long a7 asm("a7") = which;
+    // ecall transfers control to the supervisor (M-mode).
+    asm volatile ("ecall" : "=r"(a0) : "0"(a0), "r"(a7) : "memory");
+    return a0;
+}
+
+// SBI v0.2+ extensions: extension id in a7, function id in a6.
+#define SBI_EXT_BASE 0x10
+#define SBI_BASE_PROBE_EXTENSION 3
+#define SBI_EXT_DBCN 0x4442434E  // Debug console: "DBCN"
+#define SBI_DBCN_WRITE 0
+
+typedef struct {
+    long error;     // 0 on success
+    long value;
+} sbiret_t;
+
+static inline sbiret_t sbi_ecall(long ext, long fid, long arg0, long arg1, long arg2) {
+    register long a0 asm("a0") = arg0;
+    register long a1 asm("a1") = arg1;
+    register long a2 asm("a2") = arg2;
+    register long a6 asm("a6") = fid;
+    register long a7 asm("a7") = ext;
+    asm volatile ("ecall" : "+r"(a0), "+r"(a1) : "r"(a2), "r"(a6), "r"(a7) : "memory");
+    sbiret_t ret = {a0, a1};
+    return ret;
+}
+
+// Nonzero if the SBI implementation offers extension 'ext'.
+static inline int sbi_probe(long ext) {
+    sbiret_t ret = sbi_ecall(SBI_EXT_BASE, SBI_BASE_PROBE_EXTENSION, ext, 0, 0);
+    return ret.error == 0 && ret.value != 0;
+}
+
+#endif
@@ -1,35 +1,161 @@
 #include "scheduler.h"
 #include "uart.h"
 #include "string.h"
+#include "vm.h"
+#include "trap.h"
+#include "hart.h"
+#include "vdso.h"
+#include "fpu.h"
+#include "timer.h"
+#include "klog.h"
 
 /*
  * This is a forward declaration for the context_switch function, which is
- * defined in assembly code (context_switch.S).
- * Note: This function is currently not used in this file. The task switching
- * is done via inline assembly with 'jr' instruction.
+ * defined in assembly code (context_switch.S). It saves the callee-saved
+ * registers of one task and resumes another from its saved registers.
  */
-extern void context_switch(uint64_t*, uint64_t*);
+extern void context_switch(uint64_t*, uint64_t*, uint64_t);
+/* Start points of new contexts, also in assembly: trap_return in trap_entry.S
+ * and task_thread_start in context_switch.S. */
+extern void trap_return(void);
+extern void task_thread_start(void);
 
 /* Static array to hold all the task control blocks (TCBs). */
 static task_t tasks[MAX_TASKS];
 /* Index of the currently running task in the 'tasks' array. -1 if no task is running. */
 static int current = -1;
+/* Saved context of scheduler_run(), which runs on the boot stack while no task is running. */
+static uint64_t idle_context[TASK_CONTEXT_REGS];
+/* Cycles spent in scheduler_run() with nothing to run, and when it last took over. */
+static uint64_t idle_cycles;
+static uint64_t idle_start;
+
+/* Scheduling policy, and the least virtual runtime seen, which only grows. */
+static int policy = SCHED_RR;
+static uint64_t min_vruntime;
+/* Ready tasks as a binary min-heap on virtual runtime, like the timer's
+ * event heap: ready_heap[0] has run least. It is kept under both policies,
+ * so the policy can change at any time. Changed with interrupts off. */
+static int ready_heap[MAX_TASKS];
+static int nready;
+/* Preemption tick of the fair policy. */
+static timer_event_t sched_tick;
+/* CPU share reserved by deadline tasks, and the timer that fires when the
+ * running one has used up its budget. */
+static uint64_t dl_total_bw;
+static timer_event_t dl_budget_timer;
+
+/* Load weight of each nice value from NICE_MIN up; one step is worth about
+ * 10% of CPU time against a task one step away. */
+#define NICE_0_WEIGHT 1024
+static const uint32_t nice_weight[NICE_MAX - NICE_MIN + 1] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+};
 
 /* Initializes the scheduler. */
 void scheduler_init(void) {
-    /* Zero out the tasks array. */
-    memset(tasks, 0, sizeof(tasks));
+    /* The tasks array lives in .bss, which start.s has already zeroed. */
     /* No task is currently running. */
     current = -1;
 }
 
 /* Helper function to zero out the register context of a task. */
 static void zero_regs(uint64_t *r) {
-    /* 
-     * The number 27 here corresponds to the number of registers to be saved.
-     * This should match the context structure.
-     */
-    for (int i = 0; i < 27; i++) r[i] = 0;
+    for (int i = 0; i < TASK_CONTEXT_REGS; i++) r[i] = 0;
+}
+
+/* Top of task 'tid''s kernel stack. */
+static uint64_t kstack_top(int tid) {
+    return (uint64_t)&tasks[tid].stack[TASK_STACK_SIZE];
+}
+
+/* Bytes of task 'tid''s kernel stack that were ever used: everything above
+ * the lowest byte that lost its paint. */
+static int stack_used(int tid) {
+    int i = 0;
+    while (i < TASK_STACK_SIZE && tasks[tid].stack[i] == TASK_STACK_PAINT) i++;
+    return TASK_STACK_SIZE - i;
+}
+
+/* Heap order: less virtual runtime first, the lower id on a tie. */
+static int ready_before(int a, int b) {
+    if (tasks[a].vruntime != tasks[b].vruntime) return tasks[a].vruntime < tasks[b].vruntime;
+    return a < b;
+}
+
+static void ready_place(int i, int tid) {
+    ready_heap[i] = tid;
+    tasks[tid].ready_slot = i + 1;
+}
+
+/* Move the task at 'i' up or down until the heap order holds again. */
+static void ready_fix(int i) {
+    int tid = ready_heap[i];
+    while (i > 0 && ready_before(tid, ready_heap[(i - 1) / 2])) {
+        ready_place(i, ready_heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= nready) break;
+        if (child + 1 < nready && ready_before(ready_heap[child + 1], ready_heap[child])) child++;
+        if (!ready_before(ready_heap[child], tid)) break;
+        ready_place(i, ready_heap[child]);
+        i = child;
+    }
+    ready_place(i, tid);
+}
+
+/* Marks task 'tid' ready and queues it in the heap. */
+static void make_ready(int tid) {
+    tasks[tid].state = TASK_READY;
+    if (tasks[tid].ready_slot) return;
+    ready_heap[nready++] = tid;
+    ready_fix(nready - 1);
+}
+
+/* Takes task 'tid' out of the heap, if it is there. */
+static void ready_remove(int tid) {
+    int i = tasks[tid].ready_slot - 1;
+    if (i < 0) return;
+    tasks[tid].ready_slot = 0;
+    if (--nready > i) {
+        ready_heap[i] = ready_heap[nready];
+        ready_fix(i);
+    }
+}
+
+/* Charges the running task 'tid' for the time since it was last charged:
+ * its runtime, and its virtual runtime scaled by its nice weight. */
+static void charge(int tid, uint64_t now) {
+    task_t *t = &tasks[tid];
+    uint64_t delta = now - t->time_start;
+    t->time_start = now;
+    t->runtime += delta;
+    if (t->dl_runtime) t->dl_budget -= delta;
+    t->vruntime += delta * NICE_0_WEIGHT / nice_weight[t->nice - NICE_MIN];
+
+    uint64_t v = t->vruntime;
+    if (nready && tasks[ready_heap[0]].vruntime < v) v = tasks[ready_heap[0]].vruntime;
+    if (v > min_vruntime) min_vruntime = v;
+}
+
+/*
+ * First code a new task runs, reached through the 'ra' set up by scheduler_spawn.
+ * Calls the task's entry point, with interrupts enabled, and retires the task
+ * once it returns.
+ */
+static void task_start(void) {
+    intr_on();
+    tasks[current].entry();
+    scheduler_exit(0);
 }
 
 /*
@@ -39,27 +165,149 @@ static void zero_regs(uint64_t *r) {
  * Returns the task ID (index in the tasks array) or -1 if no slot is available.
  */
 int scheduler_spawn(void (*entry)(void)) {
-    for (int i = 0; i < MAX_TASKS; i++) {
-        if (tasks[i].state == TASK_EMPTY || tasks[i].state == TASK_EXITED) {
-            tasks[i].state = TASK_READY;
-            tasks[i].entry = entry;
-            /* Set the stack pointer to the top of the allocated stack for this task. */
-            tasks[i].sp = (uint64_t)&tasks[i].stack[1024];
-            zero_regs(tasks[i].regs);
-            /* Store the entry point in regs[0]. This is used by 'jr' to start the task. */
-            tasks[i].regs[0] = (uint64_t)entry;
-            return i;
-        }
+    return scheduler_spawn_in(0, entry, 0);
+}
+
+/*
+ * Spawns a new task in address space 'space' (0 for a kernel task).
+ * The task takes over the caller's reference to 'space'.
+ * 'arg' is left in the task control block for the entry point to pick up.
+ */
+int scheduler_spawn_in(struct vm_space *space, void (*entry)(void), uint64_t arg) {
+    /* Unused slots go first, so an exited task's status stays around for
+     * scheduler_wait as long as possible. */
+    int i = 0;
+    while (i < MAX_TASKS && tasks[i].state != TASK_EMPTY) i++;
+    if (i == MAX_TASKS) {
+        i = 0;
+        while (i < MAX_TASKS && tasks[i].state != TASK_EXITED) i++;
+        if (i == MAX_TASKS) return -1; /* No available task slot. */
     }
-    return -1; /* No available task slot. */
+
+    /* An exited task may still hold its address space and registers; release them now. */
+    vm_space_put(tasks[i].space);
+    fpu_release(&tasks[i]);
+    tasks[i].gen++;
+    tasks[i].entry = entry;
+    tasks[i].space = space;
+    tasks[i].arg = arg;
+    tasks[i].name[0] = 0;
+    tasks[i].exit_status = 0;
+    tasks[i].killed = 0;
+    tasks[i].cycles = 0;
+    tasks[i].switches = 0;
+    tasks[i].runtime = 0;
+    tasks[i].nice = 0;
+    tasks[i].dl_jobs = 0;
+    tasks[i].dl_misses = 0;
+    tasks[i].dl_throttled = 0;
+    memset(tasks[i].stack, TASK_STACK_PAINT, TASK_STACK_SIZE);
+    zero_regs(tasks[i].regs);
+    /* The first context_switch to this task "returns" into task_start... */
+    tasks[i].regs[0] = (uint64_t)task_start;
+    /* ...running on the top of the task's own stack. */
+    tasks[i].regs[1] = kstack_top(i);
+
+    /* A new task starts level with the least-run one, not ahead of everybody. */
+    int s = intr_off();
+    tasks[i].vruntime = min_vruntime;
+    make_ready(i);
+    intr_restore(s);
+    return i;
 }
 
 /*
- * Finds the next task in the READY state using a round-robin algorithm.
+ * Forks the current task, which is in the middle of the system call whose
+ * trap frame is 'tf'. The child gets a copy-on-write duplicate of the address
+ * space and resumes from a copy of the same trap frame on its own kernel
+ * stack, seeing 0 in a0. The parent's sepc must already point past the ecall.
+ * Returns the child's task id, or -1 on failure.
+ */
+int scheduler_fork(uint64_t *tf) {
+    task_t *parent = scheduler_current_task();
+    /* Kernel tasks share the kernel's memory; there is nothing to copy. */
+    if (!parent || !parent->space) return -1;
+
+    struct vm_space *space = vm_space_fork(parent->space);
+    if (!space) return -1;
+    int tid = scheduler_spawn_in(space, parent->entry, parent->arg);
+    if (tid < 0) {
+        vm_space_put(space);
+        return -1;
+    }
+    if (fpu_fork(parent, &tasks[tid]) < 0) {
+        /* The slot gives the space back when it is reused. */
+        int s = intr_off();
+        ready_remove(tid);
+        tasks[tid].state = TASK_EMPTY;
+        intr_restore(s);
+        return -1;
+    }
+    tasks[tid].nice = parent->nice;
+    memcpy(tasks[tid].name, parent->name, TASK_NAME_LEN);
+
+    /* The program's stack pointer in the frame is valid in the copy of the
+     * address space; the frame itself moves to the child's kernel stack. */
+    uint64_t *child_tf = (uint64_t *)(kstack_top(tid) - TF_SIZE);
+    memcpy(child_tf, tf, TF_SIZE);
+    child_tf[TF_A0/8] = 0;
+    /* The child's FP and vector registers start out off, like those of any
+     * task switched in; its first use loads the copy fpu_fork makes. */
+    child_tf[TF_SSTATUS/8] &= ~(SSTATUS_FS | SSTATUS_VS);
+    child_tf[TF_KSTACK/8] = kstack_top(tid);
+    tasks[tid].regs[0] = (uint64_t)trap_return;
+    tasks[tid].regs[1] = (uint64_t)child_tf;
+    return tid;
+}
+
+/*
+ * Creates a thread: a task sharing the current task's address space that
+ * calls entry(arg) on the stack whose top is 'stack'.
+ * Kernel tasks may pass stack = 0 to use the new task's own stack; tasks
+ * with an address space get a fresh stack region mapped for them instead.
+ * Returns the new task id, or -1 on failure.
+ */
+int scheduler_thread_create(uint64_t entry, uint64_t arg, uint64_t stack) {
+    task_t *self = scheduler_current_task();
+    struct vm_space *space = self ? self->space : 0;
+    if (space) {
+        stack = vm_thread_stack(space, stack);
+        if (!stack) return -1;
+    }
+    vm_space_get(space);
+    int tid = scheduler_spawn_in(space, (void (*)(void))entry, arg);
+    if (tid < 0) {
+        vm_space_put(space);
+        return -1;
+    }
+    if (self) {
+        memcpy(tasks[tid].name, self->name, TASK_NAME_LEN);
+        tasks[tid].nice = self->nice;
+    }
+    if (!stack) stack = kstack_top(tid);
+    /* task_thread_start picks up entry, argument, stack and, for a thread
+     * running program code, the kernel stack its traps go to from s0-s3. */
+    tasks[tid].regs[0] = (uint64_t)task_thread_start;
+    tasks[tid].regs[2] = entry;
+    tasks[tid].regs[3] = arg;
+    tasks[tid].regs[4] = stack;
+    tasks[tid].regs[5] = space ? kstack_top(tid) : 0;
+    return tid;
+}
+
+/*
+ * Finds the next task in the READY state: the deadline task with the
+ * earliest deadline if there is one, else under SCHED_FAIR the one with the
+ * least virtual runtime, under SCHED_RR the next one in round-robin order.
  * s: The index of the current task.
  * Returns the index of the next ready task, or -1 if no ready tasks are found.
  */
+static int next_deadline(void);
+
 static int next_ready(int s) {
+    int dl = next_deadline();
+    if (dl >= 0) return dl;
+    if (policy == SCHED_FAIR) return nready ? ready_heap[0] : -1;
     for (int i = 1; i <= MAX_TASKS; i++) {
         int j = (s + i) % MAX_TASKS;
         if (tasks[j].state == TASK_READY) return j;
@@ -68,56 +316,118 @@ static int next_ready(int s) {
 }
 
 /*
- * Yields the CPU to another task. This is for cooperative multitasking.
- * This implementation is very basic and simply jumps to the entry point of the next task.
- * It does not save the full context of the current task.
+ * Switches from the current task to task 'nxt'.
+ * An index of -1 on either side stands for the idle context of scheduler_run().
+ * Returns when the calling task is switched back in.
+ * Interrupts are off during the switch, and each task gets back the
+ * interrupt state it switched out with: the flag is kept on its own stack.
+ * The cycles and time since the last switch are charged to the task
+ * leaving. If the caller made it READY, it joins the ready heap only now,
+ * with its virtual runtime up to date.
  */
-void scheduler_yield(void) {
+static void switch_to(int nxt) {
+    int s = intr_off();
     int prev = current;
-    int nxt = next_ready(current);
-    if (nxt == -1) return; /* No other ready tasks. */
+    uint64_t *old_ctx = prev >= 0 ? tasks[prev].regs : idle_context;
+    uint64_t *new_ctx = nxt >= 0 ? tasks[nxt].regs : idle_context;
 
-    if (prev == -1) {
-        /* This case is for starting the very first task. */
-        current = nxt;
+    current = nxt;
+    if (nxt >= 0) {
+        ready_remove(nxt);
         tasks[nxt].state = TASK_RUNNING;
-        /* Set the stack pointer and jump to the new task's entry point. */
-        asm volatile("mv sp, %0" :: "r"(tasks[nxt].sp));
-        asm volatile("jr %0" :: "r"(tasks[nxt].regs[0]));
-        return;
     }
-
-    /* Save the current stack pointer. Note: this is not used to restore the stack later. */
-    uint64_t sp;
-    asm volatile("mv %0, sp" : "=r"(sp));
-    tasks[prev].sp = sp;
-
-    current = nxt;
-    tasks[nxt].state = TASK_RUNNING;
-    /* Set the stack pointer and jump to the new task's entry point. */
-    asm volatile("mv sp, %0" :: "r"(tasks[nxt].sp));
-    asm volatile("jr %0" :: "r"(tasks[nxt].regs[0]));
+    if (old_ctx != new_ctx) {
+        uint64_t now = rdcycle();
+        uint64_t time = timer_now();
+        if (prev >= 0) {
+            /* Past the bottom of its kernel stack the task has already
+             * overwritten its own control block; stop before it spreads. */
+            if (tasks[prev].stack[0] != TASK_STACK_PAINT) {
+                klog(KLOG_ERR, "%s[%d]: kernel stack overflow", tasks[prev].name, prev);
+                klog_flush();
+                while (1) asm volatile("wfi");
+            }
+            tasks[prev].cycles += now - tasks[prev].run_start;
+            charge(prev, time);
+            if (tasks[prev].state == TASK_READY) make_ready(prev);
+        } else {
+            idle_cycles += now - idle_start;
+        }
+        if (nxt >= 0) {
+            tasks[nxt].run_start = now;
+            tasks[nxt].time_start = time;
+            tasks[nxt].switches++;
+            /* A deadline task may run until its budget is gone. */
+            if (tasks[nxt].dl_runtime) {
+                int64_t left = tasks[nxt].dl_budget > 0 ? tasks[nxt].dl_budget : 0;
+                timer_add(&dl_budget_timer, time + left);
+            } else {
+                timer_cancel(&dl_budget_timer);
+            }
+        } else {
+            idle_start = now;
+        }
+        vdso_switch(nxt);
+        fpu_switch(prev >= 0 ? &tasks[prev] : 0, nxt >= 0 ? &tasks[nxt] : 0);
+        /* A task may block while it reads program memory in place
+         * (uaccess_enable): sstatus.SUM goes with it, kept on its own
+         * stack, and every other task starts out without it. */
+        uint64_t sum;
+        asm volatile("csrrc %0, sstatus, %1" : "=r"(sum) : "r"(SSTATUS_SUM));
+        context_switch(old_ctx, new_ctx, vm_satp(nxt >= 0 ? tasks[nxt].space : 0));
+        if (sum & SSTATUS_SUM) asm volatile("csrs sstatus, %0" :: "r"(SSTATUS_SUM));
+    }
+    intr_restore(s);
 }
 
 /*
- * Preempts the current task. Intended to be called from a trap (e.g., timer interrupt).
- * This implementation is very similar to scheduler_yield and has the same limitations.
+ * Yields the CPU to another task. This is for cooperative multitasking.
+ * The current task goes back to READY and resumes right here the next
+ * time the round-robin comes around to it.
  */
-void scheduler_preempt(void) {
-    int prev = current;
+void scheduler_yield(void) {
     int nxt = next_ready(current);
     if (nxt == -1) return; /* No other ready tasks. */
-    if (prev == nxt) return; /* No need to switch to the same task. */
 
-    uint64_t sp;
-    asm volatile("mv %0, sp" : "=r"(sp));
-    if (prev >= 0) tasks[prev].sp = sp;
+    if (current >= 0) tasks[current].state = TASK_READY;
+    switch_to(nxt);
+}
 
-    current = nxt;
-    tasks[nxt].state = TASK_RUNNING;
-    /* Set the stack pointer and jump to the new task's entry point. */
-    asm volatile("mv sp, %0" :: "r"(tasks[nxt].sp));
-    asm volatile("jr %0" :: "r"(tasks[nxt].regs[0]));
+/*
+ * Preempts the current task. Intended to be called from a trap (e.g., timer interrupt).
+ * The switch happens on the task's stack, below the trap frame, so the task
+ * resumes through the normal trap return path once it is scheduled again.
+ * A deadline task that has used up its budget sleeps until its next
+ * release; otherwise it keeps the CPU unless a deadline task with an
+ * earlier deadline is ready. Deadline tasks preempt every normal task.
+ * Under SCHED_FAIR a normal task keeps the CPU until its virtual runtime
+ * is more than SCHED_GRANULARITY_US ahead of the least one ready.
+ */
+void scheduler_preempt(void) {
+    if (current >= 0) {
+        int s = intr_off();
+        task_t *t = &tasks[current];
+        charge(current, timer_now());
+        if (t->dl_runtime && t->dl_budget <= 0) {
+            t->dl_throttled++;
+            while (t->dl_runtime && t->dl_budget <= 0 && !t->killed) scheduler_sleep(&t->dl_timer);
+            intr_restore(s);
+            return;
+        }
+        int dl = next_deadline();
+        int keep;
+        if (dl >= 0) {
+            keep = t->dl_runtime && t->dl_abs <= tasks[dl].dl_abs;
+        } else if (t->dl_runtime) {
+            keep = 1;
+        } else {
+            keep = policy == SCHED_FAIR && !(nready && t->vruntime >
+                   tasks[ready_heap[0]].vruntime + TIMER_US(SCHED_GRANULARITY_US));
+        }
+        intr_restore(s);
+        if (keep) return;
+    }
+    scheduler_yield();
 }
 
 /* Alias for scheduler_preempt, to be called from a trap handler. */
@@ -125,29 +435,352 @@ void scheduler_yield_from_trap(void) {
     scheduler_preempt();
 }
 
+/*
+ * Blocks the current task on 'chan', any address identifying what it waits
+ * for, and runs something else. Returns once another task (or an interrupt
+ * handler) calls scheduler_wakeup on the same channel and the task is
+ * scheduled again. Callers recheck their condition in a loop; if the
+ * wakeup may come from an interrupt handler, they check and sleep with
+ * interrupts disabled.
+ */
+void scheduler_sleep(void *chan) {
+    int s = intr_off();
+    tasks[current].chan = chan;
+    tasks[current].state = TASK_BLOCKED;
+    switch_to(next_ready(current));
+    tasks[current].chan = 0;
+    intr_restore(s);
+}
+
+/* A task that slept is placed at most one tick behind the least virtual
+ * runtime: enough to run soon after its wakeup, not enough to hog the CPU
+ * with credit saved up while it slept. */
+static void wake(int tid) {
+    uint64_t credit = TIMER_US(SCHED_TICK_US);
+    uint64_t floor = min_vruntime > credit ? min_vruntime - credit : 0;
+    if (tasks[tid].vruntime < floor) tasks[tid].vruntime = floor;
+    make_ready(tid);
+}
+
+/* Wakes every task sleeping on 'chan'. Returns the number of tasks woken.
+ * Safe to call from interrupt handlers. */
+int scheduler_wakeup(void *chan) {
+    int s = intr_off();
+    int woken = 0;
+    for (int i = 0; i < MAX_TASKS; i++) {
+        if (tasks[i].state == TASK_BLOCKED && tasks[i].chan == chan) {
+            wake(i);
+            woken++;
+        }
+    }
+    intr_restore(s);
+    return woken;
+}
+
+/* Returns 1 if some task is blocked, waiting to be woken. */
+static int any_blocked(void) {
+    for (int i = 0; i < MAX_TASKS; i++) {
+        if (tasks[i].state == TASK_BLOCKED) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Marks the current task as exited with 'status', wakes any task waiting
+ * for it, and switches away from it for good. The status stays in the
+ * slot until the slot is reused.
+ * With nothing else ready, control returns to the idle loop in scheduler_run().
+ */
+static void dl_leave(task_t *t);
+
+void scheduler_exit(int status) {
+    intr_off();
+    dl_leave(&tasks[current]);
+    tasks[current].exit_status = status;
+    tasks[current].state = TASK_EXITED;
+    scheduler_wakeup(&tasks[current]);
+    switch_to(next_ready(current));
+    /* Not reached: exited tasks are never switched back in. */
+    while (1) asm volatile("wfi");
+}
+
+/*
+ * Asks task 'tid' to end. Nothing can be torn down in the middle of kernel
+ * code, so the task only notes the request; it exits with
+ * TASK_KILLED_STATUS at the next point where it holds no kernel state:
+ * its next system call, or on its way back from a trap to program code
+ * (see trap.c).
+ * A blocked task is woken so it can get there; if what it waits for is
+ * still missing, it goes back to sleep until its system call completes.
+ * Returns -1 for an empty or exited slot, or the calling task itself.
+ */
+int scheduler_kill(int tid) {
+    if (tid < 0 || tid >= MAX_TASKS || tid == current) return -1;
+    int s = intr_off();
+    task_t *t = &tasks[tid];
+    if (t->state == TASK_EMPTY || t->state == TASK_EXITED) {
+        intr_restore(s);
+        return -1;
+    }
+    t->killed = 1;
+    if (t->state == TASK_BLOCKED) wake(tid);
+    intr_restore(s);
+    return 0;
+}
+
+/* Ends the current task if scheduler_kill asked for it. */
+void scheduler_check_killed(void) {
+    if (current >= 0 && tasks[current].killed) scheduler_exit(TASK_KILLED_STATUS);
+}
+
+/*
+ * Blocks until task 'tid' has exited and returns its exit status.
+ * Returns -1 at once for an empty slot or the calling task itself, and -1
+ * if the slot went to a new task before the waiter got to run again: the
+ * generation taken at the start tells the task waited for from the next
+ * one in its slot, whose status it must not report or wait on.
+ */
+int scheduler_wait(int tid) {
+    if (tid < 0 || tid >= MAX_TASKS || tid == current) return -1;
+    int s = intr_off();
+    uint32_t gen = tasks[tid].gen;
+    while (tasks[tid].gen == gen &&
+           tasks[tid].state != TASK_EMPTY && tasks[tid].state != TASK_EXITED) {
+        scheduler_sleep(&tasks[tid]);
+    }
+    int status = tasks[tid].gen == gen && tasks[tid].state == TASK_EXITED ?
+                 tasks[tid].exit_status : -1;
+    intr_restore(s);
+    return status;
+}
+
+/* Names task 'tid', cutting the name at TASK_NAME_LEN - 1 characters. */
+void scheduler_set_name(int tid, const char *name) {
+    if (tid < 0 || tid >= MAX_TASKS) return;
+    strncpy(tasks[tid].name, name, TASK_NAME_LEN - 1);
+    tasks[tid].name[TASK_NAME_LEN - 1] = 0;
+}
+
+/*
+ * Copies out the state and accounting of task 'tid'. The running task is
+ * charged for its current time slice so far.
+ * Returns -1 if the slot has never been used.
+ */
+int scheduler_task_info(int tid, task_info_t *info) {
+    if (tid < 0 || tid >= MAX_TASKS || tasks[tid].state == TASK_EMPTY) return -1;
+    int s = intr_off();
+    task_t *t = &tasks[tid];
+    info->state = t->state;
+    memcpy(info->name, t->name, TASK_NAME_LEN);
+    info->exit_status = t->exit_status;
+    info->killed = t->killed;
+    info->program = t->space != 0;
+    info->cycles = t->cycles;
+    if (tid == current) info->cycles += rdcycle() - t->run_start;
+    info->switches = t->switches;
+    info->runtime = t->runtime;
+    if (tid == current) info->runtime += timer_now() - t->time_start;
+    info->vruntime = t->vruntime;
+    info->nice = t->nice;
+    info->dl_runtime = t->dl_runtime;
+    info->dl_period = t->dl_period;
+    info->dl_deadline = t->dl_deadline;
+    info->dl_jobs = t->dl_jobs;
+    info->dl_misses = t->dl_misses;
+    info->dl_throttled = t->dl_throttled;
+    info->stack_used = stack_used(tid);
+    intr_restore(s);
+    return 0;
+}
+
+/* The fair policy's tick does nothing itself: the trap handler calls
+ * scheduler_preempt on the way back to program code after any interrupt,
+ * and that decides whether the program has had its share (see trap.c). */
+static void sched_tick_fn(timer_event_t *ev, uint64_t *tf) {
+    (void)ev;
+    (void)tf;
+}
+
+/* Selects the policy. SCHED_FAIR runs a preemption tick every
+ * SCHED_TICK_US; SCHED_RR is tickless. Returns -1 for an unknown policy. */
+int scheduler_set_policy(int p) {
+    if (p != SCHED_RR && p != SCHED_FAIR) return -1;
+    policy = p;
+    if (p == SCHED_FAIR) {
+        sched_tick.fn = sched_tick_fn;
+        sched_tick.period = TIMER_US(SCHED_TICK_US);
+        if (timer_add(&sched_tick, timer_now() + sched_tick.period) < 0) {
+            policy = SCHED_RR;
+            return -1;
+        }
+    } else {
+        timer_cancel(&sched_tick);
+    }
+    return 0;
+}
+
+int scheduler_policy(void) {
+    return policy;
+}
+
+/* A lower nice value gets a larger share under SCHED_FAIR. */
+int scheduler_set_nice(int tid, int nice) {
+    if (tid < 0 || tid >= MAX_TASKS || tasks[tid].state == TASK_EMPTY ||
+        nice < NICE_MIN || nice > NICE_MAX) {
+        return -1;
+    }
+    tasks[tid].nice = nice;
+    return 0;
+}
+
+/* The ready deadline task with the earliest deadline, or -1. A linear scan
+ * over MAX_TASKS slots, like the round-robin. */
+static int next_deadline(void) {
+    int best = -1;
+    for (int i = 0; i < MAX_TASKS; i++) {
+        if (tasks[i].state != TASK_READY || !tasks[i].dl_runtime) continue;
+        if (best < 0 || tasks[i].dl_abs < tasks[best].dl_abs) best = i;
+    }
+    return best;
+}
+
+/* Fires when the running deadline task's budget is gone; like the fair
+ * tick, it only gets the trap handler to call scheduler_preempt. */
+static void dl_budget_fn(timer_event_t *ev, uint64_t *tf) {
+    (void)ev;
+    (void)tf;
+}
+
+/* Starts the next job of a deadline task, once per period. A job that has
+ * not ended by now has missed its deadline. */
+static void dl_release(timer_event_t *ev, uint64_t *tf) {
+    (void)tf;
+    task_t *t = ev->arg;
+    if (!t->dl_done) t->dl_misses++;
+    t->dl_done = 0;
+    t->dl_budget = t->dl_runtime;
+    /* The timer has already moved the event to the next release. */
+    t->dl_abs = ev->deadline - ev->period + t->dl_deadline;
+    scheduler_wakeup(&t->dl_timer);
+}
+
+/* Takes 't' out of the deadline class and gives back its reservation. */
+static void dl_leave(task_t *t) {
+    timer_cancel(&t->dl_timer);
+    dl_total_bw -= t->dl_bw;
+    t->dl_bw = 0;
+    t->dl_runtime = 0;
+}
+
+/*
+ * Makes task 'tid' a deadline task: every 'period_us' it is released to run
+ * a job of at most 'runtime_us', which should end (scheduler_end_job) within
+ * 'deadline_us' of the release (the period if 0). Ready deadline tasks run
+ * earliest deadline first, ahead of all other tasks. Admission control
+ * keeps the sum of runtime / period over all deadline tasks at most
+ * SCHED_DL_BW_MAX, so together they can always meet their deadlines.
+ * A runtime of 0 makes the task a normal one again.
+ * Returns -1 for bad parameters, or if the task would not fit.
+ */
+int scheduler_set_deadline(int tid, uint64_t runtime_us, uint64_t period_us, uint64_t deadline_us) {
+    if (tid < 0 || tid >= MAX_TASKS) return -1;
+    if (!deadline_us) deadline_us = period_us;
+    if (runtime_us && (runtime_us > deadline_us || deadline_us > period_us ||
+                       period_us > SCHED_DL_PERIOD_MAX_US)) {
+        return -1;
+    }
+    uint64_t bw = runtime_us ? (runtime_us << SCHED_DL_BW_SHIFT) / period_us : 0;
+
+    int s = intr_off();
+    task_t *t = &tasks[tid];
+    if (t->state == TASK_EMPTY || t->state == TASK_EXITED ||
+        dl_total_bw - t->dl_bw + bw > SCHED_DL_BW_MAX) {
+        intr_restore(s);
+        return -1;
+    }
+    dl_leave(t);
+    if (runtime_us) {
+        uint64_t now = timer_now();
+        t->dl_runtime = TIMER_US(runtime_us);
+        t->dl_period = TIMER_US(period_us);
+        t->dl_deadline = TIMER_US(deadline_us);
+        t->dl_budget = t->dl_runtime;
+        t->dl_abs = now + t->dl_deadline;
+        t->dl_done = 0;
+        t->dl_timer.fn = dl_release;
+        t->dl_timer.arg = t;
+        t->dl_timer.period = t->dl_period;
+        if (timer_add(&t->dl_timer, now + t->dl_period) < 0) {
+            t->dl_runtime = 0;
+            intr_restore(s);
+            return -1;
+        }
+        t->dl_bw = bw;
+        dl_total_bw += bw;
+        dl_budget_timer.fn = dl_budget_fn;
+    }
+    /* A throttled task that leaves the class may run again at once. */
+    if (t->state == TASK_BLOCKED && t->chan == &t->dl_timer) wake(tid);
+    intr_restore(s);
+    return 0;
+}
+
+/* Ends the current job of a deadline task and sleeps until the next release.
+ * Returns -1, without sleeping, if the current task is not a deadline task. */
+int scheduler_end_job(void) {
+    if (current < 0 || !tasks[current].dl_runtime) return -1;
+    int s = intr_off();
+    task_t *t = &tasks[current];
+    if (!t->dl_done) {
+        t->dl_done = 1;
+        t->dl_jobs++;
+        if (timer_now() > t->dl_abs) t->dl_misses++;
+    }
+    while (t->dl_runtime && t->dl_done && !t->killed) scheduler_sleep(&t->dl_timer);
+    intr_restore(s);
+    return 0;
+}
+
+/* Cycles spent in the idle loop, with no task to run. */
+uint64_t scheduler_idle_cycles(void) {
+    return idle_cycles;
+}
+
+/* Returns the id of the running task, or -1 if none. */
+int scheduler_current(void) {
+    return current;
+}
+
+/* Returns the running task, or 0 if none. */
+task_t *scheduler_current_task(void) {
+    return current >= 0 ? &tasks[current] : 0;
+}
+
 /*
  * Starts the scheduler.
- * This function loops through the tasks and runs them.
- * This implementation runs each task to completion.
+ * Runs on the boot stack and hands the CPU to ready tasks in round-robin
+ * order. Control comes back here whenever a task exits or blocks and no
+ * other task is ready; the function returns once no task is left to run.
+ * The idle loop runs with interrupts disabled and only opens them after
+ * wfi, so an interrupt that makes a task ready cannot slip in between the
+ * check and the wfi. With no timer event pending, nothing wakes the hart
+ * until a device interrupt arrives.
  */
 void scheduler_run(void) {
+    int last = -1;
+    idle_start = rdcycle();
     while (1) {
-        int any = 0;
-        for (int i = 0; i < MAX_TASKS; i++) {
-            if (tasks[i].state == TASK_READY) {
-                any = 1;
-                current = i;
-                tasks[i].state = TASK_RUNNING;
-                /* Set the stack pointer and jump to the task's entry point. */
-                asm volatile("mv sp, %0" :: "r"(tasks[i].sp));
-                asm volatile("jr %0" :: "r"(tasks[i].regs[0]));
-                /* 
-                 * When the task function returns, it will come back here.
-                 * Mark the task as exited.
-                 */
-                tasks[i].state = TASK_EXITED;
-            }
+        int nxt = next_ready(last);
+        if (nxt == -1) {
+            /* No more tasks at all: exit the scheduler loop. */
+            if (!any_blocked()) break;
+            /* Everything left is blocked; only an interrupt can make progress. */
+            asm volatile("wfi");
+            intr_on();
+            intr_off();
+            continue;
         }
-        if (!any) break; /* No more ready tasks, exit the scheduler loop. */
+        last = nxt;
+        switch_to(nxt);
     }
-}
\ No newline at end of file
+}
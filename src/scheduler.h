@@ -2,38 +2,160 @@
 #define SCHEDULER_H
 
 #include <stdint.h>
+#include "timer.h"
+
+struct vm_space;
+struct fpu_state;
 
 /* Defines the possible states of a task. */
 typedef enum {
     TASK_EMPTY = 0,     /* Task slot is available. */
     TASK_READY,         /* Task is ready to run. */
     TASK_RUNNING,       /* Task is currently running. */
+    TASK_BLOCKED,       /* Task sleeps until a wakeup on its channel. */
     TASK_EXITED         /* Task has finished execution. */
 } task_state_t;
 
 /* Maximum number of tasks the scheduler can manage. */
-#define MAX_TASKS 8
+#define MAX_TASKS 16
+/* Size of each task's kernel stack in bytes. A kernel task runs on it; a
+ * program task takes its traps and system calls on it. Interrupts in
+ * kernel code go to the hart's interrupt stack instead (trap_entry.S), so
+ * it needs room for one system call plus a page fault nested in it. */
+#define TASK_STACK_SIZE 2048
+/* Byte the unused part of a kernel stack is painted with, to measure how
+ * deep it got and to catch overflows at the next switch. */
+#define TASK_STACK_PAINT 0xa5
+/* Registers saved by context_switch: ra, sp and s0-s11. */
+#define TASK_CONTEXT_REGS 14
+/* Room for a task's name, including the terminating zero. */
+#define TASK_NAME_LEN 16
+/* Exit status of a task ended by scheduler_kill. */
+#define TASK_KILLED_STATUS (-1)
+
+/* Scheduling policies (scheduler_set_policy). */
+#define SCHED_RR 0          /* Round-robin over the task array. */
+#define SCHED_FAIR 1        /* Least weighted virtual runtime first. */
+/* Fair policy: period of the preemption tick, and how far the running
+ * task's virtual runtime may get ahead of the least one ready before it
+ * is preempted. A woken task is placed at most one tick behind the
+ * least virtual runtime, so sleeping earns a limited head start. */
+#define SCHED_TICK_US 10000
+#define SCHED_GRANULARITY_US 3000
+/* Nice values: -20 gets the largest CPU share, 19 the smallest. */
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+/* Deadline tasks: the share of the CPU all of them together may reserve,
+ * in units of 1 / (1 << SCHED_DL_BW_SHIFT), and the longest period. */
+#define SCHED_DL_BW_SHIFT 20
+#define SCHED_DL_BW_MAX ((95 << SCHED_DL_BW_SHIFT) / 100)
+#define SCHED_DL_PERIOD_MAX_US 10000000
 
 /* Task Control Block (TCB) structure. */
 typedef struct {
-    uint64_t regs[27];      /* Saved registers. */
-    uint64_t sp;            /* Saved stack pointer. */
+    uint64_t regs[TASK_CONTEXT_REGS];   /* Saved registers (see context_switch.S). */
     void (*entry)(void);    /* Entry point of the task function. */
     task_state_t state;     /* Current state of the task. */
-    uint8_t stack[1024];  /* The task's own stack. */
+    struct vm_space *space; /* Address space, or 0 for kernel tasks. */
+    uint64_t arg;           /* Start argument, e.g. a program's entry address. */
+    void *chan;             /* What a blocked task is waiting for. */
+    char name[TASK_NAME_LEN];   /* Shown by the shell's ps and top. */
+    int exit_status;        /* Set when the task exits. */
+    uint32_t gen;           /* Times the slot was taken, for scheduler_wait. */
+    int killed;             /* Ends at the next safe point (see scheduler_kill). */
+    uint64_t cycles;        /* CPU cycles run so far. */
+    uint64_t switches;      /* Times the task was switched in. */
+    uint64_t run_start;     /* Cycle count when it was last switched in. */
+    uint64_t runtime;       /* Time run so far, in timer ticks. */
+    uint64_t vruntime;      /* Runtime weighted by nice, for SCHED_FAIR. */
+    uint64_t time_start;    /* Timer value when it was last charged. */
+    int nice;               /* NICE_MIN..NICE_MAX. */
+    int ready_slot;         /* Index + 1 in the ready heap, 0 if not ready. */
+    /* Deadline class (scheduler_set_deadline); times in timer ticks. */
+    uint64_t dl_runtime;    /* Budget per period, 0 for a normal task. */
+    uint64_t dl_period;
+    uint64_t dl_deadline;   /* Relative to each release. */
+    uint64_t dl_bw;         /* dl_runtime / dl_period, as reserved. */
+    uint64_t dl_abs;        /* Absolute deadline of the current job. */
+    int64_t dl_budget;      /* Budget left in this period. */
+    int dl_done;            /* The current job has ended (scheduler_end_job). */
+    uint64_t dl_jobs;       /* Jobs ended so far. */
+    uint64_t dl_misses;     /* Jobs that ended after their deadline, or not at all. */
+    uint64_t dl_throttled;  /* Times the task ran out of budget. */
+    timer_event_t dl_timer; /* Releases a job every period. */
+    struct fpu_state *fpu;  /* Saved FP/vector registers, once used (fpu.c). */
+    uint8_t stack[TASK_STACK_SIZE] __attribute__((aligned(16)));  /* The task's kernel stack. */
 } task_t;
 
 /* Initializes the scheduler. */
 void scheduler_init(void);
 /* Spawns a new task. */
 int scheduler_spawn(void (*entry)(void));
+/* Spawns a new task running in the given address space. */
+int scheduler_spawn_in(struct vm_space *space, void (*entry)(void), uint64_t arg);
+/* Forks the current task from within a system call. */
+int scheduler_fork(uint64_t *tf);
+/* Starts a thread sharing the current task's address space. */
+int scheduler_thread_create(uint64_t entry, uint64_t arg, uint64_t stack);
 /* Yields the CPU to another task cooperatively. */
 void scheduler_yield(void);
 /* Yields the CPU from a trap handler. */
 void scheduler_yield_from_trap(void);
 /* Preempts the current task (for preemptive multitasking). */
 void scheduler_preempt(void);
+/* Makes task 'tid' a deadline task, or a normal one again with runtime 0. */
+int scheduler_set_deadline(int tid, uint64_t runtime_us, uint64_t period_us, uint64_t deadline_us);
+/* Ends the current job of a deadline task and sleeps until the next one. */
+int scheduler_end_job(void);
+/* Blocks the current task until scheduler_wakeup(chan). */
+void scheduler_sleep(void *chan);
+/* Makes every task sleeping on chan ready again; returns how many. */
+int scheduler_wakeup(void *chan);
+/* Ends the current task with 'status' and switches to the next one. Does not return. */
+void scheduler_exit(int status);
+/* Asks task 'tid' to end; returns -1 if there is no such task. */
+int scheduler_kill(int tid);
+/* Ends the current task if it was killed; call only where it holds nothing. */
+void scheduler_check_killed(void);
+/* Waits for task 'tid' to exit; returns its exit status, or -1. */
+int scheduler_wait(int tid);
+/* Names task 'tid' for ps and top. */
+void scheduler_set_name(int tid, const char *name);
+/* Returns the id of the running task, or -1 if none. */
+int scheduler_current(void);
+/* Returns the running task, or 0 if none. */
+task_t *scheduler_current_task(void);
+/* A snapshot of one task's state and accounting. */
+typedef struct {
+    task_state_t state;
+    char name[TASK_NAME_LEN];
+    int exit_status;
+    int killed;
+    int program;            /* Runs in its own address space. */
+    uint64_t cycles;
+    uint64_t switches;
+    uint64_t runtime;       /* Timer ticks. */
+    uint64_t vruntime;
+    int nice;
+    uint64_t dl_runtime;    /* Timer ticks; 0 for a normal task. */
+    uint64_t dl_period;
+    uint64_t dl_deadline;
+    uint64_t dl_jobs;
+    uint64_t dl_misses;
+    uint64_t dl_throttled;
+    int stack_used;         /* Deepest use of the kernel stack, in bytes. */
+} task_info_t;
+
+/* Selects SCHED_RR or SCHED_FAIR; returns -1 for anything else. */
+int scheduler_set_policy(int policy);
+int scheduler_policy(void);
+/* Sets the nice value of task 'tid'; returns -1 if out of range. */
+int scheduler_set_nice(int tid, int nice);
+/* Fills 'info' for task 'tid'; returns -1 for an empty slot. */
+int scheduler_task_info(int tid, task_info_t *info);
+/* Cycles spent in the idle loop, with no task to run. */
+uint64_t scheduler_idle_cycles(void);
 /* Starts the scheduler to run the tasks. */
 void scheduler_run(void);
 
-#endif
\ No newline at end of file
+#endif
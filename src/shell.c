@@ -2,11 +2,25 @@
 #include "fs.h"
 #include "syscall.h"
 #include "string.h"
+#include "profile.h"
+#include "timer.h"
+#include "elf.h"
+#include "scheduler.h"
+#include "pcache.h"
+#include "klog.h"
+#include "net.h"
 #include <stdint.h>
 
 #define LINE_MAX 80
 #define FD_READ 0x1
 #define FD_WRITE 0x2
+// Output or input descriptor meaning the console
+#define CONSOLE -1
+// Lines kept for the up and down arrow keys
+#define HISTORY_SIZE 16
+#define CON_BUF_SIZE 256
+// Slots of the command hash table: a power of two above the command count
+#define CMD_HASH_SIZE 32
 
 extern void user_prog_hello(void);
 extern void user_prog_echo(void);
@@ -22,109 +36,887 @@ static inline int syscall(int num, uint64_t a0, uint64_t a1, uint64_t a2) {
     return (int)a0_reg;
 }
 
+// Console output is collected in con_buf and written out once per line,
+// or when the shell is about to wait for input. On the SBI debug console
+// that is one call per line instead of one per character.
+static char con_buf[CON_BUF_SIZE];
+static int con_len;
+
+static void con_flush(void) {
+    if (con_len) {
+        uart_write(con_buf, con_len);
+        con_len = 0;
+    }
+}
+
+static void con_putc(char c) {
+    if (con_len + 2 > CON_BUF_SIZE) con_flush();
+    if (c == '\n') con_buf[con_len++] = '\r';
+    con_buf[con_len++] = c;
+    if (c == '\n') con_flush();
+}
+
+// Write a string to the console or to the file descriptor 'out'
+static void shell_puts(int out, const char *s) {
+    if (out == CONSOLE) {
+        while (*s) con_putc(*s++);
+    } else {
+        syscall(SYS_WRITE_FD, out, (uint64_t)s, strlen(s));
+    }
+}
+
+// Format 'v' in decimal at the end of 'buf' (21 bytes); returns the first digit
+static const char *fmt_dec(char *buf, uint64_t v) {
+    int i = 20;
+    buf[i] = 0;
+    do {
+        buf[--i] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    return buf + i;
+}
+
+// Write an unsigned decimal number
+static void shell_put_dec(int out, uint64_t v) {
+    char buf[21];
+    shell_puts(out, fmt_dec(buf, v));
+}
+
+// Write a signed decimal number
+static void shell_put_int(int out, int v) {
+    if (v < 0) shell_puts(out, "-");
+    shell_put_dec(out, v < 0 ? -(uint64_t)v : (uint64_t)v);
+}
+
+// Write 's' left-aligned in a column 'width' characters wide
+static void shell_put_col(int out, const char *s, int width) {
+    shell_puts(out, s);
+    for (int n = strlen(s); n < width; n++) shell_puts(out, " ");
+}
+
+static void shell_put_dec_col(int out, uint64_t v, int width) {
+    char buf[21];
+    shell_put_col(out, fmt_dec(buf, v), width);
+}
+
+static void shell_put_int_col(int out, int v, int width) {
+    char buf[22];
+    char *s = (char *)fmt_dec(buf + 1, v < 0 ? -(uint64_t)v : (uint64_t)v);
+    if (v < 0) *--s = '-';
+    shell_put_col(out, s, width);
+}
+
+// Returns 1 if 'pattern' occurs in 's'
+static int contains(const char *s, const char *pattern) {
+    uint64_t n = strlen(pattern);
+    for (; *s; s++) {
+        if (strncmp(s, pattern, n) == 0) return 1;
+    }
+    return n == 0;
+}
+
+static void cmd_cat(const char *name, int in, int out) {
+    (void)in;
+    int fd = syscall(SYS_OPEN, (uint64_t)name, FD_READ, 0);
+    if (fd < 0) {
+        shell_puts(out, "Error: file not found\n");
+        return;
+    }
+    char buf[128];
+    int n;
+    while ((n = syscall(SYS_READ, fd, (uint64_t)buf, sizeof(buf) - 1)) > 0) {
+        buf[n] = 0;
+        shell_puts(out, buf);
+    }
+    if (n < 0) {
+        shell_puts(out, "Error: read failed\n");
+    }
+    syscall(SYS_CLOSE, fd, 0, 0);
+}
+
+// Print the lines of 'in' that contain 'pattern'
+static void cmd_grep(const char *pattern, int in, int out) {
+    if (in == CONSOLE) {
+        shell_puts(out, "Usage: <command> | grep <text>\n");
+        return;
+    }
+    char line[LINE_MAX + 1];
+    char buf[64];
+    int len = 0;
+    int n;
+    while ((n = syscall(SYS_READ, in, (uint64_t)buf, sizeof(buf))) > 0) {
+        for (int i = 0; i < n; i++) {
+            if (len < LINE_MAX) line[len++] = buf[i];
+            if (buf[i] != '\n') continue;
+            line[len] = 0;
+            if (contains(line, pattern)) shell_puts(out, line);
+            len = 0;
+        }
+    }
+    // Last line without a newline
+    line[len] = 0;
+    if (len && contains(line, pattern)) {
+        shell_puts(out, line);
+        shell_puts(out, "\n");
+    }
+}
+
+static void cmd_write(const char *rest, int in, int out) {
+    (void)in;
+    // Format: write <filename> <text>
+    char filename[32];
+    int i = 0;
+    while (rest[i] && rest[i] != ' ' && i < 31) {
+        filename[i] = rest[i];
+        i++;
+    }
+    filename[i] = 0;
+    
+    if (rest[i] != ' ') {
+        shell_puts(out, "Usage: write <filename> <text>\n");
+        return;
+    }
+    const char *text = rest + i + 1;
+    int fd = syscall(SYS_OPEN, (uint64_t)filename, FD_WRITE, 0);
+    if (fd < 0) {
+        shell_puts(out, "Error: file not found (create it first)\n");
+        return;
+    }
+    int len = strlen(text);
+    int written = syscall(SYS_WRITE_FD, fd, (uint64_t)text, len);
+    if (written > 0) {
+        shell_puts(out, "Written to file\n");
+    } else {
+        shell_puts(out, "Error: write failed\n");
+    }
+    syscall(SYS_CLOSE, fd, 0, 0);
+}
+
+static void cmd_ls(const char *args, int in, int out) {
+    (void)args;
+    (void)in;
+    char buf[256];
+    fs_list_files(buf, sizeof(buf));
+    shell_puts(out, buf);
+}
+
+static void cmd_create(const char *name, int in, int out) {
+    (void)in;
+    int result = syscall(SYS_CREATE, (uint64_t)name, 0, 0);
+    if (result == 0) {
+        shell_puts(out, "File created\n");
+    } else {
+        shell_puts(out, "Error: failed to create file\n");
+    }
+}
+
+static void cmd_delete(const char *name, int in, int out) {
+    (void)in;
+    int result = syscall(SYS_DELETE, (uint64_t)name, 0, 0);
+    if (result == 0) {
+        shell_puts(out, "File deleted\n");
+    } else {
+        shell_puts(out, "Error: file not found\n");
+    }
+}
+
+// Programs built into the kernel, run as kernel tasks
+static const struct {
+    const char *name;
+    void (*entry)(void);
+} builtin_progs[] = {
+    {"hello", user_prog_hello},
+    {"echo", user_prog_echo},
+    {"fstest", user_prog_fstest},
+};
+#define NBUILTIN_PROGS ((int)(sizeof(builtin_progs) / sizeof(builtin_progs[0])))
+
+// Print how a task ended
+static void put_exit(int out, int status, int killed) {
+    if (killed) {
+        shell_puts(out, "killed\n");
+    } else {
+        shell_puts(out, "exit status ");
+        shell_put_int(out, status);
+        shell_puts(out, "\n");
+    }
+}
+
+// run <prog> [&]: start a built-in program or an ELF file. The shell waits
+// for it to finish unless the line ends in '&', which leaves it running
+// as a background job.
+static void cmd_run(const char *args, int in, int out) {
+    (void)in;
+    char name[LINE_MAX];
+    int n = 0;
+    while (args[n] && args[n] != ' ' && args[n] != '&') {
+        name[n] = args[n];
+        n++;
+    }
+    name[n] = 0;
+    const char *rest = args + n;
+    while (*rest == ' ') rest++;
+    int background = *rest == '&';
+
+    int tid = -1;
+    for (int i = 0; i < NBUILTIN_PROGS; i++) {
+        if (strcmp(name, builtin_progs[i].name) == 0) {
+            tid = do_sys_spawn(builtin_progs[i].entry);
+            scheduler_set_name(tid, name);
+            break;
+        }
+    }
+    if (tid < 0) tid = elf_spawn(name);
+    if (tid < 0) {
+        shell_puts(out, "unknown program\n");
+        return;
+    }
+
+    if (background) {
+        shell_puts(out, "[");
+        shell_put_dec(out, tid);
+        shell_puts(out, "] ");
+        shell_puts(out, name);
+        shell_puts(out, "\n");
+        return;
+    }
+    // What the shell printed so far goes out before the program's output
+    con_flush();
+    int status = scheduler_wait(tid);
+    task_info_t info;
+    int killed = scheduler_task_info(tid, &info) == 0 && info.killed;
+    if (status != 0 || killed) put_exit(out, status, killed);
+}
+
+// Parse a task id; returns -1 if 's' is not a number
+static int parse_tid(const char *s) {
+    if (*s < '0' || *s > '9') return -1;
+    int v = 0;
+    while (*s >= '0' && *s <= '9' && v < MAX_TASKS) v = v * 10 + (*s++ - '0');
+    return *s && *s != ' ' ? -1 : v;
+}
+
+// Parse a signed decimal number into '*v'; returns -1 if 's' is not one
+static int parse_int(const char *s, int *v) {
+    int neg = *s == '-';
+    if (neg) s++;
+    if (*s < '0' || *s > '9') return -1;
+    int n = 0;
+    while (*s >= '0' && *s <= '9' && n < 1000000) n = n * 10 + (*s++ - '0');
+    if (*s && *s != ' ') return -1;
+    *v = neg ? -n : n;
+    return 0;
+}
+
+static const char *const state_names[] = {"empty", "ready", "running", "blocked", "exited"};
+
+static void cmd_ps(const char *args, int in, int out) {
+    (void)args;
+    (void)in;
+    shell_puts(out, "ID  STATE    STACK  NAME\n");
+    for (int tid = 0; tid < MAX_TASKS; tid++) {
+        task_info_t info;
+        if (scheduler_task_info(tid, &info) < 0) continue;
+        shell_put_dec_col(out, tid, 4);
+        shell_put_col(out, state_names[info.state], 9);
+        shell_put_dec_col(out, info.stack_used, 7);
+        shell_puts(out, info.name[0] ? info.name : "-");
+        if (info.state == TASK_EXITED) {
+            shell_puts(out, ", ");
+            put_exit(out, info.exit_status, info.killed);
+        } else {
+            shell_puts(out, "\n");
+        }
+    }
+}
+
+static void cmd_kill(const char *args, int in, int out) {
+    (void)in;
+    if (scheduler_kill(parse_tid(args)) < 0) shell_puts(out, "Error: no such task\n");
+}
+
+static void cmd_wait(const char *args, int in, int out) {
+    (void)in;
+    int tid = parse_tid(args);
+    task_info_t info;
+    // Flush first: the slot must not change hands between the check and the wait
+    con_flush();
+    if (tid == scheduler_current() || scheduler_task_info(tid, &info) < 0) {
+        shell_puts(out, "Error: no such task\n");
+        return;
+    }
+    int status = scheduler_wait(tid);
+    scheduler_task_info(tid, &info);
+    put_exit(out, status, info.killed);
+}
+
+// sched [rr|fair]: show or change the scheduling policy. Deadline tasks
+// are listed too, with their parameters in us and how they fared.
+static void cmd_sched(const char *args, int in, int out) {
+    (void)in;
+    if (*args) {
+        int policy = strcmp(args, "rr") == 0 ? SCHED_RR : strcmp(args, "fair") == 0 ? SCHED_FAIR : -1;
+        if (scheduler_set_policy(policy) < 0) {
+            shell_puts(out, "Usage: sched [rr|fair]\n");
+            return;
+        }
+    }
+    shell_puts(out, scheduler_policy() == SCHED_FAIR ? "fair\n" : "rr\n");
+
+    int header = 0;
+    for (int tid = 0; tid < MAX_TASKS; tid++) {
+        task_info_t info;
+        if (scheduler_task_info(tid, &info) < 0 || !info.dl_runtime) continue;
+        if (!header) {
+            shell_puts(out, "ID  RUNTIME  PERIOD   DEADLINE JOBS    MISSED  THROTTLED NAME\n");
+            header = 1;
+        }
+        shell_put_dec_col(out, tid, 4);
+        shell_put_dec_col(out, info.dl_runtime / TIMER_US(1), 9);
+        shell_put_dec_col(out, info.dl_period / TIMER_US(1), 9);
+        shell_put_dec_col(out, info.dl_deadline / TIMER_US(1), 9);
+        shell_put_dec_col(out, info.dl_jobs, 8);
+        shell_put_dec_col(out, info.dl_misses, 8);
+        shell_put_dec_col(out, info.dl_throttled, 10);
+        shell_puts(out, info.name[0] ? info.name : "-");
+        shell_puts(out, "\n");
+    }
+}
+
+// nice <id> <n>: weight a task's CPU share under the fair policy
+static void cmd_nice(const char *args, int in, int out) {
+    (void)in;
+    int tid = parse_tid(args);
+    const char *n = args;
+    while (*n && *n != ' ') n++;
+    while (*n == ' ') n++;
+    int nice;
+    if (parse_int(n, &nice) < 0) {
+        shell_puts(out, "Usage: nice <id> <n>\n");
+        return;
+    }
+    if (scheduler_set_nice(tid, nice) < 0) shell_puts(out, "Error: no such task or nice value\n");
+}
+
+// CPU cycles, share of the total, run time, context switches and nice
+// value of every task, from the scheduler's accounting since each task started.
+// Tasks are looked up one at a time, twice: a snapshot of all of them would
+// not fit on the shell's kernel stack.
+static void cmd_top(const char *args, int in, int out) {
+    (void)args;
+    (void)in;
+    task_info_t info;
+    uint64_t idle = scheduler_idle_cycles();
+    uint64_t total = idle;
+    for (int tid = 0; tid < MAX_TASKS; tid++) {
+        if (scheduler_task_info(tid, &info) == 0) total += info.cycles;
+    }
+    if (total == 0) total = 1;
+
+    shell_puts(out, "ID  STATE    CPU%  TIME(ms)  CYCLES          SWITCHES  NICE  NAME\n");
+    for (int tid = 0; tid < MAX_TASKS; tid++) {
+        if (scheduler_task_info(tid, &info) < 0) continue;
+        shell_put_dec_col(out, tid, 4);
+        shell_put_col(out, state_names[info.state], 9);
+        shell_put_dec_col(out, info.cycles * 100 / total, 6);
+        shell_put_dec_col(out, info.runtime / TIMER_US(1000), 10);
+        shell_put_dec_col(out, info.cycles, 16);
+        shell_put_dec_col(out, info.switches, 10);
+        shell_put_int_col(out, info.nice, 6);
+        shell_puts(out, info.name[0] ? info.name : "-");
+        shell_puts(out, "\n");
+    }
+    shell_put_col(out, "", 13);
+    shell_put_dec_col(out, idle * 100 / total, 6);
+    shell_put_col(out, "", 10);
+    shell_put_dec_col(out, idle, 32);
+    shell_puts(out, "idle\n");
+}
+
+static void cmd_profile(const char *args, int in, int out) {
+    (void)in;
+    if (strcmp(args, "start") == 0) {
+        profile_start();
+        shell_puts(out, "Profiling started\n");
+    } else if (strcmp(args, "stop") == 0) {
+        profile_stop();
+        shell_puts(out, "Profiling stopped\n");
+    } else if (strcmp(args, "dump") == 0) {
+        profile_dump();
+    } else {
+        shell_puts(out, "Usage: profile start|stop|dump\n");
+    }
+}
+
+static void cmd_cache(const char *args, int in, int out) {
+    (void)args;
+    (void)in;
+    const pcache_stats_t *st = pcache_stats();
+    shell_puts(out, "page cache: ");
+    shell_put_dec(out, st->hits);
+    shell_puts(out, " hits, ");
+    shell_put_dec(out, st->misses);
+    shell_puts(out, " misses, ");
+    shell_put_dec(out, st->readahead);
+    shell_puts(out, " read ahead, ");
+    shell_put_dec(out, st->evictions);
+    shell_puts(out, " evicted, ");
+    shell_put_dec(out, st->in_place);
+    shell_puts(out, " from the initramfs\n");
+}
+
+// Compress a file, turn it back into a plain one (-d), or with no
+// arguments list the compressed files
+static void cmd_compress(const char *args, int in, int out) {
+    (void)in;
+    if (*args) {
+        int on = strncmp(args, "-d ", 3) != 0;
+        if (fs_compress(on ? args : args + 3, on) < 0) {
+            shell_puts(out, on ? "Error: no such file, too big, or no room\n"
+                               : "Error: no such file, or too big to decompress\n");
+        }
+        return;
+    }
+    shell_puts(out, "NAME            SIZE    STORED  BLOCKS  RAW   STORED%\n");
+    for (int i = 0; i < MAX_FILES; i++) {
+        fs_zinfo_t z;
+        const char *name = fs_file_name(i);
+        if (!name || fs_compress_info(name, &z) < 0) continue;
+        shell_put_col(out, name, 16);
+        shell_put_dec_col(out, z.size, 8);
+        shell_put_dec_col(out, z.stored, 8);
+        shell_put_dec_col(out, z.blocks, 8);
+        shell_put_dec_col(out, z.raw, 6);
+        shell_put_dec(out, z.size ? (uint64_t)z.stored * 100 / z.size : 0);
+        shell_puts(out, "\n");
+    }
+    shell_puts(out, "store: ");
+    shell_put_dec(out, fs_zstore_used());
+    shell_puts(out, " of ");
+    shell_put_dec(out, FS_ZSTORE_SIZE);
+    shell_puts(out, " bytes\n");
+}
+
+// Replay the kernel log, or set which levels are recorded (-l) or also
+// printed on the console (-n)
+static void cmd_dmesg(const char *args, int in, int out) {
+    (void)in;
+    if (*args) {
+        int level;
+        if ((strncmp(args, "-l ", 3) != 0 && strncmp(args, "-n ", 3) != 0) ||
+            parse_int(args + 3, &level) < 0 || level < KLOG_ERR || level > KLOG_DEBUG) {
+            shell_puts(out, "Usage: dmesg [-l|-n <0-3>]\n");
+            return;
+        }
+        if (args[1] == 'l') klog_level = level;
+        else klog_console_level = level;
+        return;
+    }
+    char line[KLOG_MSG_MAX + 24];
+    int level;
+    uint32_t pos = klog_oldest();
+    while (klog_read(&pos, line, sizeof(line), &level) > 0) shell_puts(out, line);
+}
+
+// An IPv4 address in dotted decimal
+static void shell_put_ip(int out, uint32_t ip) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        shell_put_dec(out, (ip >> shift) & 0xff);
+        if (shift) shell_puts(out, ".");
+    }
+}
+
+static void shell_put_mac(int out, const uint8_t *mac) {
+    static const char hex[] = "0123456789abcdef";
+    char buf[18];
+    for (int i = 0; i < 6; i++) {
+        buf[i * 3] = hex[mac[i] >> 4];
+        buf[i * 3 + 1] = hex[mac[i] & 0xf];
+        buf[i * 3 + 2] = i < 5 ? ':' : 0;
+    }
+    shell_puts(out, buf);
+}
+
+// Show the network configuration, traffic counters, ARP table and sockets
+static void cmd_net(const char *args, int in, int out) {
+    (void)args;
+    (void)in;
+    const uint8_t *mac = net_mac();
+    if (!mac) {
+        shell_puts(out, "No network device\n");
+        return;
+    }
+    shell_puts(out, "mac ");
+    shell_put_mac(out, mac);
+    shell_puts(out, ", ip ");
+    shell_put_ip(out, NET_IP);
+    shell_puts(out, ", gateway ");
+    shell_put_ip(out, NET_GATEWAY);
+    const net_stats_t *st = net_stats();
+    shell_puts(out, "\nframes: ");
+    shell_put_dec(out, st->rx_frames);
+    shell_puts(out, " in, ");
+    shell_put_dec(out, st->tx_frames);
+    shell_puts(out, " out, ");
+    shell_put_dec(out, st->rx_dropped);
+    shell_puts(out, " dropped; udp: ");
+    shell_put_dec(out, st->rx_udp);
+    shell_puts(out, " in, ");
+    shell_put_dec(out, st->tx_udp);
+    shell_puts(out, " out; arp requests: ");
+    shell_put_dec(out, st->arp_requests);
+    shell_puts(out, "\n");
+    for (int i = 0; i < NET_ARP_ENTRIES; i++) {
+        uint32_t ip;
+        uint8_t m[6];
+        if (net_arp_entry(i, &ip, m) < 0) continue;
+        shell_puts(out, "arp ");
+        shell_put_ip(out, ip);
+        shell_puts(out, " is ");
+        shell_put_mac(out, m);
+        shell_puts(out, "\n");
+    }
+    for (int i = 0; i < NET_MAX_SOCKETS; i++) {
+        int port = net_socket_port(i);
+        if (port < 0) continue;
+        shell_puts(out, "udp socket on port ");
+        shell_put_dec(out, port);
+        shell_puts(out, "\n");
+    }
+}
+
+static void cmd_help(const char *args, int in, int out);
+
+typedef struct {
+    const char *name;
+    void (*fn)(const char *args, int in, int out);
+    const char *help;
+} shell_cmd_t;
+
+static const shell_cmd_t commands[] = {
+    {"ls", cmd_ls, "ls              - List files"},
+    {"cat", cmd_cat, "cat <file>      - Display file contents"},
+    {"create", cmd_create, "create <file>   - Create new file"},
+    {"delete", cmd_delete, "delete <file>   - Delete file"},
+    {"write", cmd_write, "write <file> <text> - Write text to file"},
+    {"run", cmd_run, "run <prog> [&]  - Run program, in the background with &"},
+    {"ps", cmd_ps, "ps              - List tasks"},
+    {"kill", cmd_kill, "kill <id>       - End a task"},
+    {"wait", cmd_wait, "wait <id>       - Wait for a task to end"},
+    {"top", cmd_top, "top             - Show CPU time, cycles and switches per task"},
+    {"sched", cmd_sched, "sched [rr|fair] - Show or set the policy, list deadline tasks"},
+    {"nice", cmd_nice, "nice <id> <n>   - Set a task's nice value, -20 to 19"},
+    {"grep", cmd_grep, "grep <text>     - Print input lines containing text"},
+    {"profile", cmd_profile, "profile start|stop|dump - Sample kernel pcs on the timer tick"},
+    {"cache", cmd_cache, "cache           - Show page cache statistics"},
+    {"dmesg", cmd_dmesg, "dmesg [-l|-n <0-3>] - Show kernel messages, set the levels logged or printed"},
+    {"compress", cmd_compress, "compress [-d] [file] - Compress a file, undo with -d, list compressed files"},
+    {"net", cmd_net, "net             - Show network address, counters, ARP table and sockets"},
+    {"help", cmd_help, "help            - Show this help"},
+};
+#define NCOMMANDS ((int)(sizeof(commands) / sizeof(commands[0])))
+
+static void cmd_help(const char *args, int in, int out) {
+    (void)args;
+    (void)in;
+    shell_puts(out, "Commands:\n");
+    for (int i = 0; i < NCOMMANDS; i++) {
+        shell_puts(out, "  ");
+        shell_puts(out, commands[i].help);
+        shell_puts(out, "\n");
+    }
+    shell_puts(out, "  <cmd> | <cmd>   - Pipe the output of one command into another\n");
+    shell_puts(out, "Keys: arrows edit and recall lines, Tab completes commands and files\n");
+}
+
+// Open-addressed hash from command name to index + 1 in commands[]
+static uint8_t cmd_hash[CMD_HASH_SIZE];
+
+static uint32_t hash_word(const char *s, int n) {
+    uint32_t h = 2166136261u;  // FNV-1a
+    for (int i = 0; i < n; i++) h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+// Filled in once by shell_run, before any pipeline task can look
+static void cmd_hash_init(void) {
+    for (int c = 0; c < NCOMMANDS; c++) {
+        const char *name = commands[c].name;
+        uint32_t i = hash_word(name, strlen(name));
+        while (cmd_hash[i % CMD_HASH_SIZE]) i++;
+        cmd_hash[i % CMD_HASH_SIZE] = c + 1;
+    }
+}
+
+// The command named by the first 'n' characters of 'word', or 0
+static const shell_cmd_t *find_command(const char *word, int n) {
+    for (uint32_t i = hash_word(word, n);; i++) {
+        int slot = cmd_hash[i % CMD_HASH_SIZE];
+        if (!slot) return 0;
+        const shell_cmd_t *cmd = &commands[slot - 1];
+        if (strncmp(cmd->name, word, n) == 0 && cmd->name[n] == 0) return cmd;
+    }
+}
+
+// Run one command, reading from 'in' and writing to 'out' (either may be CONSOLE)
+static void shell_exec(const char *line, int in, int out) {
+    while (*line == ' ') line++;
+    int n = 0;
+    while (line[n] && line[n] != ' ') n++;
+    if (n == 0) return;
+
+    const shell_cmd_t *cmd = find_command(line, n);
+    if (!cmd) {
+        shell_puts(out, "Unknown command (try help)\n");
+        return;
+    }
+    const char *args = line + n;
+    while (*args == ' ') args++;
+    cmd->fn(args, in, out);
+}
+
+// The left side of a pipeline runs as its own task, writing into the pipe
+// while the shell runs the right side reading from it. Its command and
+// pipe end come in a stage_t on the shell's stack (the task's start
+// argument), which stays valid because the shell waits for the task.
+typedef struct {
+    const char *cmd;
+    int out;
+} stage_t;
+
+static void shell_left_stage(void) {
+    const stage_t *stage = (const stage_t *)scheduler_current_task()->arg;
+    shell_exec(stage->cmd, CONSOLE, stage->out);
+    // Closing the write end lets the reader see end of file
+    syscall(SYS_CLOSE, stage->out, 0, 0);
+}
+
+// Cut 's' at its first '|', dropping the spaces around it; returns the right side or 0
+static char *split_pipe(char *s) {
+    char *bar = s;
+    while (*bar && *bar != '|') bar++;
+    if (!*bar) return 0;
+    char *end = bar;
+    while (end > s && end[-1] == ' ') end--;
+    *end = 0;
+    bar++;
+    while (*bar == ' ') bar++;
+    return bar;
+}
+
+// Run 'left | right'
+static void shell_pipeline(const char *left, const char *right) {
+    int fds[2];
+    if (syscall(SYS_PIPE, (uint64_t)fds, 0, 0) < 0) {
+        shell_puts(CONSOLE, "Error: cannot create pipe\n");
+        return;
+    }
+    stage_t stage = {left, fds[1]};
+    int tid = scheduler_spawn_in(0, shell_left_stage, (uint64_t)&stage);
+    if (tid < 0) {
+        shell_puts(CONSOLE, "Error: cannot start pipeline\n");
+        syscall(SYS_CLOSE, fds[0], 0, 0);
+        syscall(SYS_CLOSE, fds[1], 0, 0);
+        return;
+    }
+    shell_exec(right, fds[0], CONSOLE);
+    // A writer still blocked on a full pipe sees the read end go away, so
+    // the left side ends even if the right one read nothing (hello | ps)
+    syscall(SYS_CLOSE, fds[0], 0, 0);
+    scheduler_wait(tid);
+}
+
+// History ring: the i-th line entered lives in history[i % HISTORY_SIZE]
+static char history[HISTORY_SIZE][LINE_MAX];
+static int history_len;
+
+static void history_add(const char *line) {
+    if (!*line) return;
+    if (history_len && strcmp(history[(history_len - 1) % HISTORY_SIZE], line) == 0) return;
+    char *slot = history[history_len++ % HISTORY_SIZE];
+    strncpy(slot, line, LINE_MAX - 1);
+    slot[LINE_MAX - 1] = 0;
+}
+
+// The line being edited; the terminal cursor is kept at 'cur'
+typedef struct {
+    char buf[LINE_MAX];
+    int len;
+    int cur;
+} edit_t;
+
+// Redraw from the cursor to the end of the line, blank out 'stale'
+// characters left over past the end, and move the cursor back
+static void edit_redraw(edit_t *e, int stale) {
+    for (int i = e->cur; i < e->len; i++) con_putc(e->buf[i]);
+    for (int i = 0; i < stale; i++) con_putc(' ');
+    for (int i = e->len + stale; i > e->cur; i--) con_putc('\b');
+}
+
+static void edit_insert(edit_t *e, char c) {
+    if (e->len >= LINE_MAX - 1) return;
+    for (int i = e->len; i > e->cur; i--) e->buf[i] = e->buf[i - 1];
+    e->buf[e->cur] = c;
+    e->len++;
+    con_putc(c);
+    e->cur++;
+    edit_redraw(e, 0);
+}
+
+static void edit_backspace(edit_t *e) {
+    if (e->cur == 0) return;
+    for (int i = e->cur; i < e->len; i++) e->buf[i - 1] = e->buf[i];
+    e->len--;
+    e->cur--;
+    con_putc('\b');
+    edit_redraw(e, 1);
+}
+
+// Replace the whole line with 's', leaving the cursor at its end
+static void edit_set(edit_t *e, const char *s) {
+    int old = e->len;
+    for (; e->cur > 0; e->cur--) con_putc('\b');
+    for (e->len = 0; s[e->len] && e->len < LINE_MAX - 1; e->len++) {
+        e->buf[e->len] = s[e->len];
+        con_putc(s[e->len]);
+    }
+    e->cur = e->len;
+    for (int i = e->len; i < old; i++) con_putc(' ');
+    for (int i = e->len; i < old; i++) con_putc('\b');
+}
+
+// Completion candidate 'i': a command name when completing the first word,
+// a file name otherwise. Returns 0 for an empty file slot.
+static const char *complete_candidate(int command, int i) {
+    if (command) return commands[i].name;
+    return fs_file_name(i);
+}
+
+// Tab: complete the word before the cursor as far as all matches agree.
+// If that adds nothing and several names match, list them.
+static void edit_complete(edit_t *e) {
+    int start = e->cur;
+    while (start > 0 && e->buf[start - 1] != ' ') start--;
+    int command = 1;
+    for (int i = 0; i < start; i++) {
+        if (e->buf[i] != ' ') command = 0;
+    }
+    const char *word = e->buf + start;
+    int n = e->cur - start;
+    int limit = command ? NCOMMANDS : MAX_FILES;
+
+    const char *match = 0;
+    int common = 0, count = 0;
+    for (int i = 0; i < limit; i++) {
+        const char *name = complete_candidate(command, i);
+        if (!name || strncmp(name, word, n) != 0) continue;
+        if (!match) {
+            match = name;
+            common = strlen(name);
+        } else {
+            int k = n;
+            while (k < common && name[k] == match[k]) k++;
+            common = k;
+        }
+        count++;
+    }
+    if (!count) return;
+
+    if (common > n || count == 1) {
+        for (int i = n; i < common; i++) edit_insert(e, match[i]);
+        if (count == 1) edit_insert(e, ' ');
+        return;
+    }
+    con_putc('\n');
+    for (int i = 0; i < limit; i++) {
+        const char *name = complete_candidate(command, i);
+        if (!name || strncmp(name, word, n) != 0) continue;
+        shell_puts(CONSOLE, name);
+        shell_puts(CONSOLE, "  ");
+    }
+    con_putc('\n');
+    shell_puts(CONSOLE, "> ");
+    int cur = e->cur;
+    e->cur = 0;
+    edit_redraw(e, 0);
+    while (e->cur < cur) con_putc(e->buf[e->cur++]);
+}
+
+// Next input character. Echo only goes out when no more input is waiting,
+// so pasted text is echoed in one piece.
+static char shell_getc(void) {
+    int c = uart_getc_nonblock();
+    if (c < 0) {
+        con_flush();
+        c = uart_getc_block();
+    }
+    return c;
+}
+
+// Read a line into 'line' (LINE_MAX bytes), with backspace, left/right
+// cursor movement, up/down through the history and Tab completion
+static void shell_read_line(char *line) {
+    edit_t e;
+    e.len = 0;
+    e.cur = 0;
+    int browse = history_len;  // History line shown; history_len is the new line
+
+    while (1) {
+        char c = shell_getc();
+        if (c == '\r' || c == '\n') break;
+        if (c == 0x7f || c == '\b') {
+            edit_backspace(&e);
+        } else if (c == '\t') {
+            edit_complete(&e);
+        } else if (c == 0x1b) {
+            // Arrow keys arrive as ESC [ A..D
+            if (shell_getc() != '[') continue;
+            char key = shell_getc();
+            int oldest = history_len > HISTORY_SIZE ? history_len - HISTORY_SIZE : 0;
+            if (key == 'A' && browse > oldest) {
+                edit_set(&e, history[--browse % HISTORY_SIZE]);
+            } else if (key == 'B' && browse < history_len) {
+                browse++;
+                edit_set(&e, browse == history_len ? "" : history[browse % HISTORY_SIZE]);
+            } else if (key == 'C' && e.cur < e.len) {
+                con_putc(e.buf[e.cur++]);
+            } else if (key == 'D' && e.cur > 0) {
+                con_putc('\b');
+                e.cur--;
+            }
+        } else if (c >= ' ' && c < 0x7f) {
+            edit_insert(&e, c);
+        }
+    }
+    memcpy(line, e.buf, e.len);
+    line[e.len] = 0;
+}
+
 void shell_run(void) {
     char line[LINE_MAX];
-    int pos = 0;
 
-    uart_puts("\nSimple RISC-V Shell\n> ");
+    cmd_hash_init();
+    shell_puts(CONSOLE, "\nSimple RISC-V Shell\n");
+
+    // Report how long it took from _start to the first prompt.
+    extern uint64_t boot_time_start;
+    shell_puts(CONSOLE, "Boot time: ");
+    shell_put_dec(CONSOLE, (timer_now() - boot_time_start) / (TIMER_FREQ / 1000000));
+    shell_puts(CONSOLE, " us\n");
 
     while (1) {
-        char c = uart_getc_block();
-
-        if (c == '\r' || c == '\n') {
-            line[pos] = 0;
-            uart_puts("\n");
-
-            if (strcmp(line, "ls") == 0) {
-                char buf[256];
-                fs_list_files(buf, sizeof(buf));
-                uart_puts(buf);
-            } else if (strncmp(line, "run ", 4) == 0) {
-                const char *name = line + 4;
-                if (strcmp(name, "hello") == 0) do_sys_spawn(user_prog_hello);
-                else if (strcmp(name, "echo") == 0) do_sys_spawn(user_prog_echo);
-                else if (strcmp(name, "fstest") == 0) do_sys_spawn(user_prog_fstest);
-                else uart_puts("unknown program\n");
-            } else if (strncmp(line, "cat ", 4) == 0) {
-                const char *name = line + 4;
-                int fd = syscall(4, (uint64_t)name, FD_READ, 0);  // SYS_OPEN
-                if (fd < 0) {
-                    uart_puts("Error: file not found\n");
-                } else {
-                    char buf[256];
-                    int n;
-                    while ((n = syscall(5, fd, (uint64_t)buf, sizeof(buf) - 1)) > 0) {
-                        buf[n] = 0;
-                        uart_puts(buf);
-                    }
-                    if (n < 0) {
-                        uart_puts("Error: read failed\n");
-                    }
-                    syscall(7, fd, 0, 0);  // SYS_CLOSE
-                }
-            } else if (strncmp(line, "create ", 7) == 0) {
-                const char *name = line + 7;
-                int result = syscall(8, (uint64_t)name, 0, 0);  // SYS_CREATE
-                if (result == 0) {
-                    uart_puts("File created\n");
-                } else {
-                    uart_puts("Error: failed to create file\n");
-                }
-            } else if (strncmp(line, "delete ", 7) == 0) {
-                const char *name = line + 7;
-                int result = syscall(9, (uint64_t)name, 0, 0);  // SYS_DELETE
-                if (result == 0) {
-                    uart_puts("File deleted\n");
-                } else {
-                    uart_puts("Error: file not found\n");
-                }
-            } else if (strncmp(line, "write ", 6) == 0) {
-                // Format: write <filename> <text>
-                const char *rest = line + 6;
-                char filename[32];
-                int i = 0;
-                while (rest[i] && rest[i] != ' ' && i < 31) {
-                    filename[i] = rest[i];
-                    i++;
-                }
-                filename[i] = 0;
-                
-                if (rest[i] == ' ') {
-                    const char *text = rest + i + 1;
-                    int fd = syscall(4, (uint64_t)filename, FD_WRITE, 0);  // SYS_OPEN
-                    if (fd < 0) {
-                        uart_puts("Error: file not found (create it first)\n");
-                    } else {
-                        int len = strlen(text);
-                        int written = syscall(6, fd, (uint64_t)text, len);  // SYS_WRITE_FD
-                        if (written > 0) {
-                            uart_puts("Written to file\n");
-                        } else {
-                            uart_puts("Error: write failed\n");
-                        }
-                        syscall(7, fd, 0, 0);  // SYS_CLOSE
-                    }
-                } else {
-                    uart_puts("Usage: write <filename> <text>\n");
-                }
-            } else if (strcmp(line, "help") == 0) {
-                uart_puts("Commands:\n");
-                uart_puts("  ls              - List files\n");
-                uart_puts("  cat <file>      - Display file contents\n");
-                uart_puts("  create <file>   - Create new file\n");
-                uart_puts("  delete <file>   - Delete file\n");
-                uart_puts("  write <file> <text> - Write text to file\n");
-                uart_puts("  run <prog>      - Run program\n");
-                uart_puts("  help            - Show this help\n");
-            }
+        shell_puts(CONSOLE, "> ");
+        shell_read_line(line);
+        shell_puts(CONSOLE, "\n");
+        history_add(line);
 
-            pos = 0;
-            uart_puts("> ");
+        char *right = split_pipe(line);
+        if (right) {
+            shell_pipeline(line, right);
         } else {
-            if (pos < LINE_MAX-1) {
-                uart_putc(c);
-                line[pos++] = c;
-            }
+            shell_exec(line, CONSOLE, CONSOLE);
         }
+        // Output that did not end in a newline
+        con_flush();
     }
 }
@@ -2,12 +2,41 @@
     .globl _start
 
 /* This is the entry point of the kernel. */
+/* OpenSBI enters with a0 = hart id and a1 = physical address of the device tree. */
 _start:
+    /* Read the time first so the boot time covers the whole entry path. */
+    rdtime s2
+
+    /* OpenSBI passes the hart id in a0; keep it in tp for hart_id(). */
+    mv tp, a0
+    /* Keep the device tree pointer in a callee-saved register. */
+    mv s1, a1
+
+    /*
+     * Clear .bss, four doublewords per iteration. link.ld aligns both ends
+     * of the section to 32 bytes, so no tail handling is needed. The boot
+     * stack lives in .bss too, which is fine as nothing uses it yet.
+     */
+    la t0, __bss_start
+    la t1, __bss_end
+2:
+    bgeu t0, t1, 3f
+    sd zero, 0(t0)
+    sd zero, 8(t0)
+    sd zero, 16(t0)
+    sd zero, 24(t0)
+    addi t0, t0, 32
+    j 2b
+3:
+
     /* Set up the initial stack pointer. */
     /* 'la' is a pseudo-instruction that loads the address of _stack_top into sp. */
     la sp, _stack_top
 
-    /* Jump to the main kernel function in C. */
+    /* Jump to the main kernel function in C: kmain(hartid, dtb, boot_time). */
+    mv a0, tp
+    mv a1, s1
+    mv a2, s2
     call kmain
 
 /* If kmain returns (which it shouldn't), enter an infinite loop. */
@@ -20,4 +49,4 @@ _start:
     .balign 16 /* Align the stack to a 16-byte boundary. */
 _stack:
     .space 0x4000   /* Allocate 16 KB for the kernel stack. */
-_stack_top:         /* Label marking the top of the stack. */
\ No newline at end of file
+_stack_top:         /* Label marking the top of the stack. */
@@ -2,36 +2,71 @@
 #include "uart.h"
 #include "scheduler.h"
 #include "fs.h"
+#include "chan.h"
+#include "futex.h"
+#include "timer.h"
+#include "vm.h"
+#include "uaccess.h"
+#include "net.h"
+
+// Pointer arguments are checked against the caller's regions and then used
+// in place, so reads and writes cost no extra copy. Only file names are
+// copied, since their length is not known up front. A bad pointer makes
+// the call return -EFAULT.
+
+// Copy a file name argument into 'buf' (MAX_FILENAME_LEN bytes)
+static long get_name(char *buf, const char *name) {
+    long n = strncpy_from_user(buf, name, MAX_FILENAME_LEN);
+    return n < 0 ? n : 0;
+}
 
 // System call to write a string to the console.
+// The string comes over in small pieces, so a page that can't be mapped
+// faults in the copy rather than in the middle of the UART loop.
 int do_sys_write(const char *s, int len) {
-    for (int i = 0; i < len; i++)
-        uart_putc(s[i]);
+    if (len < 0) return -1;
+    if (uaccess_check(s, len, UACCESS_READ) < 0) return -EFAULT;
+    char chunk[64];
+    for (int done = 0; done < len; ) {
+        int n = len - done < (int)sizeof(chunk) ? len - done : (int)sizeof(chunk);
+        if (__uaccess_copy(chunk, s + done, n) < 0) return done ? done : -EFAULT;
+        for (int i = 0; i < n; i++)
+            uart_putc(chunk[i]);
+        done += n;
+    }
     return len;
 }
 
-// System call to yield the CPU to another process.
+// System call to yield the CPU to another process. For a deadline task
+// this ends the current job: it sleeps until its next release.
 void do_sys_yield(void) {
-    scheduler_yield();
+    if (scheduler_end_job() < 0) scheduler_yield();
 }
 
 // System call to spawn a new process.
+// Only kernel tasks may start kernel functions.
 int do_sys_spawn(void (*entry)(void)) {
+    task_t *task = scheduler_current_task();
+    if (task && task->space) return -1;
     return scheduler_spawn(entry);
 }
 
 // System call to open a file.
 int do_sys_open(const char *name, int flags) {
-    return fs_open(name, flags);
+    char buf[MAX_FILENAME_LEN];
+    long r = get_name(buf, name);
+    return r < 0 ? r : fs_open(buf, flags);
 }
 
 // System call to read from a file descriptor.
 int do_sys_read(int fd, char *buf, int len) {
+    if (len > 0 && uaccess_check(buf, len, UACCESS_WRITE) < 0) return -EFAULT;
     return fs_read(fd, buf, len);
 }
 
 // System call to write to a file descriptor.
 int do_sys_write_fd(int fd, const char *buf, int len) {
+    if (len > 0 && uaccess_check(buf, len, UACCESS_READ) < 0) return -EFAULT;
     return fs_write(fd, buf, len);
 }
 
@@ -42,15 +77,139 @@ int do_sys_close(int fd) {
 
 // System call to create a file.
 int do_sys_create(const char *name) {
-    return fs_create(name);
+    char buf[MAX_FILENAME_LEN];
+    long r = get_name(buf, name);
+    return r < 0 ? r : fs_create(buf);
 }
 
 // System call to delete a file.
 int do_sys_delete(const char *name) {
-    return fs_delete(name);
+    char buf[MAX_FILENAME_LEN];
+    long r = get_name(buf, name);
+    return r < 0 ? r : fs_delete(buf);
 }
 
 // System call to change the file offset.
 int do_sys_seek(int fd, int offset) {
     return fs_seek(fd, offset);
 }
+
+// System call to get the id of the calling task.
+int do_sys_gettid(void) {
+    return scheduler_current();
+}
+
+// System call to end the calling task.
+void do_sys_exit(int status) {
+    scheduler_exit(status);
+}
+
+// System call to duplicate the calling task; returns 0 in the child.
+int do_sys_fork(uint64_t *tf) {
+    return scheduler_fork(tf);
+}
+
+// System call to start a thread in the caller's address space.
+int do_sys_thread_create(uint64_t entry, uint64_t arg, uint64_t stack) {
+    if (uaccess_check((const void *)entry, 4, UACCESS_EXEC) < 0) return -EFAULT;
+    return scheduler_thread_create(entry, arg, stack);
+}
+
+// System call to create a pipe; fds[0] is the read end, fds[1] the write end.
+int do_sys_pipe(int *fds) {
+    int k[2];
+    if (uaccess_check(fds, sizeof(k), UACCESS_WRITE) < 0) return -EFAULT;
+    if (fs_pipe(k) < 0) return -1;
+    if (copy_to_user(fds, k, sizeof(k)) < 0) {
+        fs_close(k[0]);
+        fs_close(k[1]);
+        return -EFAULT;
+    }
+    return 0;
+}
+
+// System call to map a shared-memory channel; returns its address or 0.
+uint64_t do_sys_chan_map(int id) {
+    return chan_map(id);
+}
+
+// System call to sleep while a shared word still holds 'expected'.
+int do_sys_chan_wait(volatile uint32_t *word, uint32_t expected) {
+    if (uaccess_check((const void *)word, 4, UACCESS_READ) < 0) return -EFAULT;
+    return chan_wait(word, expected);
+}
+
+// System call to wake the tasks waiting on a shared word.
+int do_sys_chan_wake(volatile uint32_t *word) {
+    if (uaccess_check((const void *)word, 4, UACCESS_READ) < 0) return -EFAULT;
+    return chan_wake(word);
+}
+
+// System call to wait on or wake a futex word (FUTEX_WAIT / FUTEX_WAKE).
+// For FUTEX_WAIT 'val' is the expected value, for FUTEX_WAKE the number
+// of waiters to wake.
+int do_sys_futex(volatile uint32_t *word, int op, uint32_t val) {
+    if (((uint64_t)word & 3) || uaccess_check((const void *)word, 4, UACCESS_READ) < 0) {
+        return -EFAULT;
+    }
+    if (op == FUTEX_WAIT) return futex_wait(word, val);
+    if (op == FUTEX_WAKE) return futex_wake(word, (int)val);
+    return -1;
+}
+
+// System call to sleep for 'us' microseconds.
+void do_sys_sleep(uint64_t us) {
+    timer_sleep_us(us);
+}
+
+// System call to map an open file read-only; returns its address or 0.
+// The mapping covers 'len' bytes, or the whole file if 'len' is 0.
+uint64_t do_sys_mmap(int fd, uint64_t len) {
+    uint32_t ino;
+    int size = fs_fd_inode(fd, &ino);
+    task_t *task = scheduler_current_task();
+    if (size <= 0 || !task || !task->space) return 0;
+    if (!len || len > (uint64_t)size) len = size;
+    return vm_map_file(task->space, ino, len);
+}
+
+// System call to make the calling task a deadline task (see
+// scheduler_set_deadline); all zeros make it a normal task again.
+int do_sys_sched_deadline(uint64_t runtime_us, uint64_t period_us, uint64_t deadline_us) {
+    return scheduler_set_deadline(scheduler_current(), runtime_us, period_us, deadline_us);
+}
+
+// System call to open a UDP socket on local 'port' (0 for any free one);
+// returns its file descriptor.
+int do_sys_socket(int port) {
+    return fs_socket(port);
+}
+
+// System call to set the address write() on a socket sends to.
+int do_sys_connect(int fd, uint32_t ip, int port) {
+    return net_connect(fs_fd_socket(fd), ip, port);
+}
+
+// System call to send msg->len bytes at msg->buf as one datagram to
+// msg->ip:msg->port. The payload goes to the device from the caller's
+// pages. Returns the bytes sent.
+int do_sys_sendto(int fd, const net_msg_t *msg) {
+    net_msg_t m;
+    if (copy_from_user(&m, msg, sizeof(m)) < 0) return -EFAULT;
+    if (m.len > NET_UDP_MAX) return -1;
+    if (m.len && uaccess_check(m.buf, m.len, UACCESS_READ) < 0) return -EFAULT;
+    return net_sendto(fs_fd_socket(fd), m.buf, m.len, m.ip, m.port);
+}
+
+// System call to receive one datagram into msg->buf (room for msg->len
+// bytes), waiting at most msg->timeout_us if that is not 0. Fills in the
+// sender's msg->ip and msg->port and returns the bytes received.
+int do_sys_recvfrom(int fd, net_msg_t *msg) {
+    net_msg_t m;
+    if (copy_from_user(&m, msg, sizeof(m)) < 0) return -EFAULT;
+    if (m.len > NET_UDP_MAX) m.len = NET_UDP_MAX;
+    if (m.len && uaccess_check(m.buf, m.len, UACCESS_WRITE) < 0) return -EFAULT;
+    int n = net_recvfrom(fs_fd_socket(fd), m.buf, m.len, &m.ip, &m.port, m.timeout_us);
+    if (n >= 0 && copy_to_user(msg, &m, sizeof(m)) < 0) return -EFAULT;
+    return n;
+}
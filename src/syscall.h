@@ -2,6 +2,7 @@
 #define SYSCALL_H
 
 #include <stdint.h>
+#include "net.h"
 
 #define SYS_YIELD 1
 #define SYS_WRITE 2
@@ -13,6 +14,22 @@
 #define SYS_CREATE 8
 #define SYS_DELETE 9
 #define SYS_SEEK 10
+#define SYS_GETTID 11
+#define SYS_EXIT 12
+#define SYS_FORK 13
+#define SYS_THREAD_CREATE 14
+#define SYS_PIPE 15
+#define SYS_CHAN_MAP 16
+#define SYS_CHAN_WAIT 17
+#define SYS_CHAN_WAKE 18
+#define SYS_FUTEX 19
+#define SYS_SLEEP 20
+#define SYS_MMAP 21
+#define SYS_SCHED_DEADLINE 22
+#define SYS_SOCKET 23
+#define SYS_CONNECT 24
+#define SYS_SENDTO 25
+#define SYS_RECVFROM 26
 
 int do_sys_write(const char *s, int len);
 void do_sys_yield(void);
@@ -24,5 +41,21 @@ int do_sys_close(int fd);
 int do_sys_create(const char *name);
 int do_sys_delete(const char *name);
 int do_sys_seek(int fd, int offset);
+int do_sys_gettid(void);
+void do_sys_exit(int status);
+int do_sys_fork(uint64_t *tf);
+int do_sys_thread_create(uint64_t entry, uint64_t arg, uint64_t stack);
+int do_sys_pipe(int *fds);
+uint64_t do_sys_chan_map(int id);
+int do_sys_chan_wait(volatile uint32_t *word, uint32_t expected);
+int do_sys_chan_wake(volatile uint32_t *word);
+int do_sys_futex(volatile uint32_t *word, int op, uint32_t val);
+void do_sys_sleep(uint64_t us);
+uint64_t do_sys_mmap(int fd, uint64_t len);
+int do_sys_sched_deadline(uint64_t runtime_us, uint64_t period_us, uint64_t deadline_us);
+int do_sys_socket(int port);
+int do_sys_connect(int fd, uint32_t ip, int port);
+int do_sys_sendto(int fd, const net_msg_t *msg);
+int do_sys_recvfrom(int fd, net_msg_t *msg);
 
 #endif
@@ -1,18 +1,152 @@
 #include "timer.h"
+#include "sbi.h"
+#include "hart.h"
+#include "fdt.h"
+#include "scheduler.h"
+#include "vdso.h"
 #include <stdint.h>
 
-/* For now, we don't use a hardware timer in S-mode with OpenSBI.
-   We'll rely on cooperative scheduling only. */
+/* sie.STIE enables supervisor timer interrupts. */
+#define SIE_STIE (1UL << 5)
+/* Sstc's stimecmp CSR, written directly instead of through an SBI call. */
+#define CSR_STIMECMP 0x14d
 
+/* Pending events as a binary min-heap on deadline: heap[0] is due first. */
+static timer_event_t *heap[TIMER_MAX_EVENTS];
+static int nevents;
+static int timer_ready;
+
+/* Reads the free-running 'time' CSR. */
 uint64_t timer_now(void) {
-    return 0;
+    uint64_t t;
+    asm volatile("rdtime %0" : "=r"(t));
+    return t;
 }
 
+/* Nothing to do at boot: sie.STIE starts out clear, so no timer interrupt
+   can arrive before the first timer_add() arms the timer. */
 void timer_init(void) {
-    /* no-op for now */
 }
 
-void timer_handle_irq(void) {
-    /* no-op: no timer interrupts configured */
+/* Sets the compare register; writing it also clears a pending interrupt. */
+static void timer_set(uint64_t deadline) {
+    if (boot_fdt.has_sstc) {
+        asm volatile("csrw %0, %1" :: "i"(CSR_STIMECMP), "r"(deadline));
+    } else {
+        sbi_call(SBI_SET_TIMER, deadline);
+    }
+}
+
+/* Program the hardware for the earliest event, or for never. */
+static void timer_program(void) {
+    timer_set(nevents ? heap[0]->deadline : (uint64_t)-1);
+}
+
+static void heap_place(int i, timer_event_t *ev) {
+    heap[i] = ev;
+    ev->slot = i + 1;
+}
+
+/* Move the event at 'i' up or down until the heap order holds again. */
+static void heap_fix(int i) {
+    timer_event_t *ev = heap[i];
+    while (i > 0 && heap[(i - 1) / 2]->deadline > ev->deadline) {
+        heap_place(i, heap[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= nevents) break;
+        if (child + 1 < nevents && heap[child + 1]->deadline < heap[child]->deadline) child++;
+        if (heap[child]->deadline >= ev->deadline) break;
+        heap_place(i, heap[child]);
+        i = child;
+    }
+    heap_place(i, ev);
+}
+
+static void heap_remove(timer_event_t *ev) {
+    int i = ev->slot - 1;
+    ev->slot = 0;
+    if (--nevents > i) {
+        heap[i] = heap[nevents];
+        heap_fix(i);
+    }
+}
+
+/* Arms 'ev' to fire at 'deadline', moving it if it was already pending.
+   Returns -1 if too many events are pending. */
+int timer_add(timer_event_t *ev, uint64_t deadline) {
+    int s = intr_off();
+    if (!timer_ready) {
+        timer_ready = 1;
+        asm volatile("csrs sie, %0" :: "r"(SIE_STIE));
+    }
+    if (ev->slot) {
+        heap_remove(ev);
+    } else if (nevents >= TIMER_MAX_EVENTS) {
+        intr_restore(s);
+        return -1;
+    }
+    ev->deadline = deadline;
+    heap[nevents++] = ev;
+    heap_fix(nevents - 1);
+    if (heap[0] == ev) timer_program();
+    intr_restore(s);
+    return 0;
+}
+
+/* Disarms 'ev'; harmless if it is not pending. */
+void timer_cancel(timer_event_t *ev) {
+    int s = intr_off();
+    if (ev->slot) {
+        int was_first = ev->slot == 1;
+        heap_remove(ev);
+        if (was_first) timer_program();
+    }
+    intr_restore(s);
+}
+
+static void timer_wake_task(timer_event_t *ev, uint64_t *tf) {
+    (void)tf;
+    scheduler_wakeup(ev);
 }
 
+/* Blocks the current task until 'deadline'. Other tasks run meanwhile, and
+   with nothing else to do the hart sleeps in wfi until the deadline. */
+void timer_sleep_until(uint64_t deadline) {
+    timer_event_t ev = {0};
+    ev.fn = timer_wake_task;
+    /* No interrupt between arming and sleeping, or the wakeup could be lost */
+    int s = intr_off();
+    if (timer_add(&ev, deadline) == 0) {
+        while (ev.slot) scheduler_sleep(&ev);
+    }
+    intr_restore(s);
+}
+
+void timer_sleep_us(uint64_t us) {
+    timer_sleep_until(timer_now() + TIMER_US(us));
+}
+
+/* Called from the trap handler on a supervisor timer interrupt.
+   Runs every event that is due, re-arms periodic ones, then programs
+   the next deadline. */
+void timer_handle_irq(uint64_t *tf) {
+    uint64_t now = timer_now();
+    vdso_tick();
+    while (nevents && heap[0]->deadline <= now) {
+        timer_event_t *ev = heap[0];
+        heap_remove(ev);
+        if (ev->period) {
+            /* Skip periods that were missed entirely */
+            ev->deadline += ev->period;
+            if (ev->deadline <= now) ev->deadline = now + ev->period;
+            heap[nevents++] = ev;
+            heap_fix(nevents - 1);
+        }
+        ev->fn(ev, tf);
+        now = timer_now();
+    }
+    timer_program();
+}
@@ -3,8 +3,34 @@
 
 #include <stdint.h>
 
+/* Frequency of the 'time' CSR on the QEMU virt machine (10 MHz). */
+#define TIMER_FREQ 10000000
+/* Converts microseconds to timer ticks. */
+#define TIMER_US(us) ((uint64_t)(us) * (TIMER_FREQ / 1000000))
+
+/* Most events that can be pending at once. */
+#define TIMER_MAX_EVENTS 32
+
+/*
+ * A deadline with a callback, owned by the caller. The timer interrupt is
+ * programmed for the earliest pending event only, so an idle hart sleeps
+ * until something is actually due instead of waking on a periodic tick.
+ * 'fn' runs in interrupt context with the interrupted trap frame.
+ */
+typedef struct timer_event {
+    uint64_t deadline;      /* Absolute time in timer ticks. */
+    uint64_t period;        /* Re-armed this many ticks later, or 0 for one shot. */
+    void (*fn)(struct timer_event *ev, uint64_t *tf);
+    void *arg;
+    int slot;               /* Heap index + 1 while pending, 0 otherwise. */
+} timer_event_t;
+
 void timer_init(void);
-void timer_handle_irq(void);
 uint64_t timer_now(void);
+int timer_add(timer_event_t *ev, uint64_t deadline);
+void timer_cancel(timer_event_t *ev);
+void timer_sleep_until(uint64_t deadline);
+void timer_sleep_us(uint64_t us);
+void timer_handle_irq(uint64_t *tf);
 
 #endif
@@ -1,25 +1,34 @@
 #include "trap.h"
-#include "uart.h"
+#include "klog.h"
 #include "syscall.h"
 #include "timer.h"
 #include "scheduler.h"
+#include "vm.h"
+#include "plic.h"
+#include "uaccess.h"
+#include "fpu.h"
 #include <stdint.h>
 
-// Defines for accessing registers in the trap frame.
-// These are byte offsets from the stack pointer.
-#define TF_A0 48
-#define TF_A1 56
-#define TF_A2 64
-#define TF_A7 104
-#define TF_SEPC 224
-
 // Reads the scause (Supervisor Cause) register.
 static inline uint64_t read_scause(void) {
     uint64_t x; asm volatile("csrr %0, scause":"=r"(x)); return x;
 }
 
-// C-level trap handler called from trap_entry.S
-void handle_trap_from_asm(uint64_t *tf) {
+// Reads the stval (Supervisor Trap Value) register, e.g. the faulting address.
+static inline uint64_t read_stval(void) {
+    uint64_t x; asm volatile("csrr %0, stval":"=r"(x)); return x;
+}
+
+// Returns 1 if the trap returns to a program's own code, where its task
+// holds no kernel state and may be switched out or ended.
+static int trap_to_program(uint64_t *tf) {
+    task_t *task = scheduler_current_task();
+    uint64_t pc = tf[TF_SEPC/8];
+    return task && task->space && pc >= USER_BASE && pc < USER_TOP;
+}
+
+// Dispatch one trap to its handler
+static void trap_dispatch(uint64_t *tf) {
     // Read the cause of the trap and the instruction that caused it.
     uint64_t scause = read_scause();
     uint64_t sepc = tf[TF_SEPC/8];
@@ -31,18 +40,59 @@ void handle_trap_from_asm(uint64_t *tf) {
     if (is_interrupt) {
         // Handle interrupts.
         if (code == 5) {  // Supervisor Timer Interrupt
-            timer_handle_irq();
+            timer_handle_irq(tf);
+            return;
+        }
+        if (code == 9) {  // Supervisor External Interrupt (devices, via the PLIC)
+            plic_handle_irq();
             return;
         }
     } else {
+        // Illegal instruction (2): usually a program's first FP or vector
+        // instruction since it was switched in, which loads its registers
+        if (code == 2) {
+            if (fpu_first_use(tf)) {
+                return;
+            }
+            task_t *task = scheduler_current_task();
+            if (trap_to_program(tf)) {
+                klog(KLOG_ERR, "%s[%d]: illegal instruction at %p", task->name,
+                     scheduler_current(), (void *)sepc);
+                scheduler_exit(TASK_KILLED_STATUS);
+            }
+        }
+
+        // Instruction (12), load (13) and store (15) page faults: demand paging.
+        if (code == 12 || code == 13 || code == 15) {
+            task_t *task = scheduler_current_task();
+            if (task && vm_handle_fault(task->space, read_stval(), code == 15) == 0) {
+                return; // Page is mapped now; retry the access
+            }
+            // A bad pointer met by a uaccess copy: that copy returns -EFAULT
+            if (uaccess_fixup(tf)) {
+                return;
+            }
+            // A program touched memory it doesn't have: end the program, not
+            // the kernel. The same fault in kernel code, outside the uaccess
+            // copies, may hold locks and is a kernel bug: it halts below.
+            if (trap_to_program(tf)) {
+                klog(KLOG_ERR, "%s[%d]: segmentation fault at %p, pc %p", task->name,
+                     scheduler_current(), (void *)read_stval(), (void *)sepc);
+                scheduler_exit(TASK_KILLED_STATUS);
+            }
+        }
+
         // Handle exceptions (e.g., syscalls).
         if (code == 8 || code == 9) { // Environment call from U-mode or S-mode (syscall)
+            // Kernel tasks hold nothing across an ecall either: a killed one ends here
+            scheduler_check_killed();
+
             // Get syscall number from a7.
             uint64_t num = tf[TF_A7/8];
 
             if (num == SYS_YIELD) {
                 tf[TF_SEPC/8] = sepc + 4; // Advance past ecall instruction
-                scheduler_yield_from_trap();
+                do_sys_yield();
                 return;
             } else if (num == SYS_WRITE) {
                 const char *buf = (const char *)tf[TF_A0/8];
@@ -104,12 +154,123 @@ void handle_trap_from_asm(uint64_t *tf) {
                 tf[TF_A0/8] = result; // Return result in a0
                 tf[TF_SEPC/8] = sepc + 4;
                 return;
+            } else if (num == SYS_GETTID) {
+                tf[TF_A0/8] = do_sys_gettid(); // Return task id in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
+            } else if (num == SYS_EXIT) {
+                do_sys_exit(tf[TF_A0/8]); // Does not return
+            } else if (num == SYS_FORK) {
+                // The child resumes from a copy of this frame, so advance sepc first
+                tf[TF_SEPC/8] = sepc + 4;
+                tf[TF_A0/8] = do_sys_fork(tf); // Child id in the parent, 0 in the child
+                return;
+            } else if (num == SYS_THREAD_CREATE) {
+                uint64_t entry = tf[TF_A0/8];
+                uint64_t arg = tf[TF_A1/8];
+                uint64_t stack = tf[TF_A2/8];
+                tf[TF_A0/8] = do_sys_thread_create(entry, arg, stack); // Return task id in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
+            } else if (num == SYS_PIPE) {
+                int *fds = (int *)tf[TF_A0/8];
+                tf[TF_A0/8] = do_sys_pipe(fds); // Return result in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
+            } else if (num == SYS_CHAN_MAP) {
+                int id = tf[TF_A0/8];
+                tf[TF_A0/8] = do_sys_chan_map(id); // Return address in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
+            } else if (num == SYS_CHAN_WAIT) {
+                volatile uint32_t *word = (volatile uint32_t *)tf[TF_A0/8];
+                uint32_t expected = tf[TF_A1/8];
+                // Advance first: the task may block and be resumed much later
+                tf[TF_SEPC/8] = sepc + 4;
+                tf[TF_A0/8] = do_sys_chan_wait(word, expected);
+                return;
+            } else if (num == SYS_SLEEP) {
+                uint64_t us = tf[TF_A0/8];
+                // Advance first: the task blocks until the deadline
+                tf[TF_SEPC/8] = sepc + 4;
+                do_sys_sleep(us);
+                tf[TF_A0/8] = 0;
+                return;
+            } else if (num == SYS_FUTEX) {
+                volatile uint32_t *word = (volatile uint32_t *)tf[TF_A0/8];
+                int op = tf[TF_A1/8];
+                uint32_t val = tf[TF_A2/8];
+                // Advance first: the task may block and be resumed much later
+                tf[TF_SEPC/8] = sepc + 4;
+                tf[TF_A0/8] = do_sys_futex(word, op, val);
+                return;
+            } else if (num == SYS_MMAP) {
+                int fd = tf[TF_A0/8];
+                uint64_t len = tf[TF_A1/8];
+                tf[TF_A0/8] = do_sys_mmap(fd, len); // Return address in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
+            } else if (num == SYS_SCHED_DEADLINE) {
+                uint64_t runtime = tf[TF_A0/8];
+                uint64_t period = tf[TF_A1/8];
+                uint64_t deadline = tf[TF_A2/8];
+                tf[TF_A0/8] = do_sys_sched_deadline(runtime, period, deadline); // Return result in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
+            } else if (num == SYS_SOCKET) {
+                int port = tf[TF_A0/8];
+                tf[TF_A0/8] = do_sys_socket(port); // Return file descriptor in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
+            } else if (num == SYS_CONNECT) {
+                int fd = tf[TF_A0/8];
+                uint32_t ip = tf[TF_A1/8];
+                int port = tf[TF_A2/8];
+                tf[TF_A0/8] = do_sys_connect(fd, ip, port); // Return result in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
+            } else if (num == SYS_SENDTO) {
+                int fd = tf[TF_A0/8];
+                const net_msg_t *msg = (const net_msg_t *)tf[TF_A1/8];
+                // Advance first: the task may wait for an ARP reply
+                tf[TF_SEPC/8] = sepc + 4;
+                tf[TF_A0/8] = do_sys_sendto(fd, msg);
+                return;
+            } else if (num == SYS_RECVFROM) {
+                int fd = tf[TF_A0/8];
+                net_msg_t *msg = (net_msg_t *)tf[TF_A1/8];
+                // Advance first: the task may block and be resumed much later
+                tf[TF_SEPC/8] = sepc + 4;
+                tf[TF_A0/8] = do_sys_recvfrom(fd, msg);
+                return;
+            } else if (num == SYS_CHAN_WAKE) {
+                volatile uint32_t *word = (volatile uint32_t *)tf[TF_A0/8];
+                tf[TF_A0/8] = do_sys_chan_wake(word); // Return number woken in a0
+                tf[TF_SEPC/8] = sepc + 4;
+                return;
             }
         }
     }
 
     // If we get here, it's an unhandled trap.
-    uart_puts("Unhandled trap!\n");
+    klog(KLOG_ERR, "unhandled trap: scause %lx, sepc %p, stval %p", scause,
+         (void *)sepc, (void *)read_stval());
+    klog_flush();
     // Halt the system.
     while (1) asm volatile("wfi");
 }
+
+// C-level trap handler called from trap_entry.S
+void handle_trap_from_asm(uint64_t *tf) {
+    int is_interrupt = (read_scause() >> 63) & 1;
+    trap_dispatch(tf);
+
+    if (trap_to_program(tf)) {
+        // The interrupt may have woken a task, e.g. the shell on a key
+        // press. Let it run rather than wait for the program's next system
+        // call, so a program stuck in a loop can't starve the shell.
+        if (is_interrupt) scheduler_yield_from_trap();
+        scheduler_check_killed();
+    }
+    fpu_trap_return(tf);
+}
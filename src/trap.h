@@ -3,6 +3,28 @@
 
 #include <stdint.h>
 
+// Defines for accessing registers in the trap frame built by trap_entry.S.
+// These are byte offsets from the start of the frame.
+#define TF_A0 48
+#define TF_A1 56
+#define TF_A2 64
+#define TF_A7 104
+#define TF_SEPC 224
+#define TF_SSTATUS 232
+// Stack pointer of the interrupted code
+#define TF_SP 240
+// Value sscratch gets back on return: the top of the task's kernel stack
+// when returning to program code, 0 when returning to kernel code
+#define TF_KSTACK 248
+// A program's own tp, and the hart id the kernel keeps in tp, swapped on
+// each trap from and return to program code
+#define TF_TP 256
+#define TF_KTP 264
+// Size of the whole trap frame in bytes
+#define TF_SIZE (8*34)
+
 void handle_trap_from_asm(uint64_t *tf);
+void trap_enter_program(uint64_t entry, uint64_t arg, uint64_t sp, uint64_t kstack)
+    __attribute__((noreturn));
 
 #endif
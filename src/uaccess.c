@@ -0,0 +1,83 @@
+#include "uaccess.h"
+#include "scheduler.h"
+#include "vm.h"
+#include "trap.h"
+#include "hart.h"
+#include <stdint.h>
+
+// One entry of __ex_table (uaccess_copy.S): a load or store that may fault
+// on a task address, and where to continue if it does
+typedef struct {
+    uint64_t insn;
+    uint64_t fixup;
+} ex_entry_t;
+
+extern const ex_entry_t __ex_table_start[], __ex_table_end[];
+
+// Returns 0 if the current task may access [uptr, uptr + len) in 'mode'
+// (UACCESS_READ/WRITE/EXEC), -EFAULT otherwise. Programs may only name
+// memory their regions cover; kernel tasks may pass any address.
+// Passing it lets a system call use the pointer in place, through
+// __uaccess_copy or between uaccess_enable/disable. It guards the kernel
+// against a program's pointers only: the program itself runs in U-mode and
+// can't touch kernel pages, which lack PTE_U. Kernel tasks are trusted.
+int uaccess_check(const void *uptr, uint64_t len, int mode) {
+    task_t *task = scheduler_current_task();
+    if (!task || !task->space) return 0;
+
+    int prot = 0;
+    if (mode & UACCESS_READ) prot |= VM_READ;
+    if (mode & UACCESS_WRITE) prot |= VM_WRITE;
+    if (mode & UACCESS_EXEC) prot |= VM_EXEC;
+    return vm_check_range(task->space, (uint64_t)uptr, len, prot) < 0 ? -EFAULT : 0;
+}
+
+// Copy 'len' bytes from the caller's memory; returns 0 or -EFAULT
+long copy_from_user(void *dst, const void *usrc, uint64_t len) {
+    if (uaccess_check(usrc, len, UACCESS_READ) < 0) return -EFAULT;
+    return __uaccess_copy(dst, usrc, len);
+}
+
+// Copy 'len' bytes to the caller's memory; returns 0 or -EFAULT
+long copy_to_user(void *udst, const void *src, uint64_t len) {
+    if (uaccess_check(udst, len, UACCESS_WRITE) < 0) return -EFAULT;
+    return __uaccess_copy(udst, src, len);
+}
+
+// Copy a NUL-terminated string of at most max - 1 characters from the
+// caller. Returns its length, -EFAULT for a bad pointer, or -1 if it is
+// too long.
+long strncpy_from_user(char *dst, const char *usrc, long max) {
+    for (long i = 0; i < max; i++) {
+        // Check once per page the string runs into
+        if ((i == 0 || ((uint64_t)(usrc + i) & 4095) == 0) &&
+            uaccess_check(usrc + i, 1, UACCESS_READ) < 0) {
+            return -EFAULT;
+        }
+        if (__uaccess_copy(dst + i, usrc + i, 1) < 0) return -EFAULT;
+        if (dst[i] == 0) return i;
+    }
+    if (max > 0) dst[max - 1] = 0;
+    return -1;
+}
+
+void uaccess_enable(void) {
+    asm volatile("csrs sstatus, %0" :: "r"(SSTATUS_SUM) : "memory");
+}
+
+void uaccess_disable(void) {
+    asm volatile("csrc sstatus, %0" :: "r"(SSTATUS_SUM) : "memory");
+}
+
+// Called for a page fault demand paging could not resolve. If it hit one
+// of the uaccess copies, resume at its fixup and return 1.
+int uaccess_fixup(uint64_t *tf) {
+    uint64_t sepc = tf[TF_SEPC/8];
+    for (const ex_entry_t *e = __ex_table_start; e < __ex_table_end; e++) {
+        if (e->insn == sepc) {
+            tf[TF_SEPC/8] = e->fixup;
+            return 1;
+        }
+    }
+    return 0;
+}
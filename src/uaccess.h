@@ -0,0 +1,31 @@
+#ifndef UACCESS_H
+#define UACCESS_H
+
+#include <stdint.h>
+
+// Returned (negated) by system calls given a pointer the caller can't access
+#define EFAULT 14
+
+// Access modes for uaccess_check
+#define UACCESS_READ 0x1
+#define UACCESS_WRITE 0x2
+#define UACCESS_EXEC 0x4
+
+// Checks a pointer a program passed in; the hardware keeps the program's
+// own loads and stores out of the kernel (U-mode, no PTE_U on kernel pages).
+// Kernel tasks are not checked.
+int uaccess_check(const void *uptr, uint64_t len, int mode);
+long copy_from_user(void *dst, const void *usrc, uint64_t len);
+long copy_to_user(void *udst, const void *src, uint64_t len);
+long strncpy_from_user(char *dst, const char *usrc, long max);
+// The copy behind these, for memory already passed by uaccess_check:
+// returns 0, or -EFAULT if demand paging could not map a page
+long __uaccess_copy(void *dst, const void *src, uint64_t n);
+// Let kernel code read a program's memory in place between these
+// (sstatus.SUM), for code that can't go through __uaccess_copy. Every page
+// touched must be mapped already: a fault in between has no fixup.
+void uaccess_enable(void);
+void uaccess_disable(void);
+int uaccess_fixup(uint64_t *tf);
+
+#endif
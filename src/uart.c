@@ -1,19 +1,27 @@
 #include "uart.h"
+#include "sbi.h"
+#include "scheduler.h"
+#include "hart.h"
+#include "fdt.h"
+#include "plic.h"
+#include "vm.h"
 #include <stdint.h>
 
-// SBI call numbers for console functions.
-#define SBI_CONSOLE_PUTCHAR 1
-#define SBI_CONSOLE_GETCHAR 2
+// ns16550a registers used for interrupt-driven receive
+#define UART_RBR 0          // Receive buffer
+#define UART_IER 1          // Interrupt enable
+#define UART_LSR 5          // Line status
+#define UART_IER_RX 0x01    // Interrupt when received data is available
+#define UART_LSR_DR 0x01    // Data ready
 
-// Makes a Supervisor Binary Interface (SBI) call.
-// 'which' is the SBI call number, 'arg0' is the first argument.
-static inline long sbi_call(long which, long arg0) {
-    register long a0 asm("a0") = arg0;
-    register long a7 asm("a7") = which;
-    // ecall transfers control to the supervisor (M-mode).
-    asm volatile ("ecall" : "=r"(a0) : "0"(a0), "r"(a7) : "memory");
-    return a0;
-}
+// Characters received by the interrupt handler, not yet read.
+// rx_head and rx_tail only grow; their difference is the fill level.
+#define UART_RX_SIZE 64
+static volatile char rx_buf[UART_RX_SIZE];
+static volatile uint32_t rx_head, rx_tail;
+static volatile uint8_t *uart_regs;
+// 0 until the first read, then 1 with receive interrupts, -1 polling SBI
+static int uart_rx_mode;
 
 // Initializes the UART. In this SBI-based implementation, it's a no-op
 // as the supervisor is expected to handle hardware initialization.
@@ -26,21 +34,121 @@ void uart_putc(char c) {
     sbi_call(SBI_CONSOLE_PUTCHAR, c);
 }
 
+// Whether SBI has the debug console extension: 0 not probed yet, 1 yes, -1 no
+static int uart_dbcn;
+
+// Outputs 'len' bytes as they are. With the SBI debug console this is one
+// call for the whole buffer instead of one per character. SBI takes a
+// physical address, so buffers in a program's private slot (its stack,
+// say) still go out a character at a time.
+void uart_write(const char *s, int len) {
+    if (!uart_dbcn) uart_dbcn = sbi_probe(SBI_EXT_DBCN) ? 1 : -1;
+    int identity = (uint64_t)s + len <= USER_BASE || (uint64_t)s >= USER_TOP;
+    while (len > 0 && uart_dbcn > 0 && identity) {
+        sbiret_t ret = sbi_ecall(SBI_EXT_DBCN, SBI_DBCN_WRITE, len, (uint64_t)s, 0);
+        if (ret.error || ret.value <= 0) break;
+        s += ret.value;
+        len -= ret.value;
+    }
+    for (int i = 0; i < len; i++) uart_putc(s[i]);
+}
+
 // Outputs a null-terminated string to the console.
 // Translates '\n' to '\r\n' for proper terminal display.
 void uart_puts(const char *s) {
     while (*s) {
-        if (*s == '\n') uart_putc('\r');
-        uart_putc(*s++);
+        int n = 0;
+        while (s[n] && s[n] != '\n') n++;
+        uart_write(s, n);
+        s += n;
+        if (*s == '\n') {
+            uart_write("\r\n", 2);
+            s++;
+        }
+    }
+}
+
+// Outputs a value as 0x-prefixed hexadecimal.
+void uart_put_hex(uint64_t v) {
+    char buf[19];
+    int pos = 18;
+    buf[pos] = 0;
+    do {
+        buf[--pos] = "0123456789abcdef"[v & 0xf];
+        v >>= 4;
+    } while (v);
+    buf[--pos] = 'x';
+    buf[--pos] = '0';
+    uart_puts(buf + pos);
+}
+
+// Outputs a value as unsigned decimal.
+void uart_put_dec(uint64_t v) {
+    char buf[21];
+    int pos = 20;
+    buf[pos] = 0;
+    do {
+        buf[--pos] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    uart_puts(buf + pos);
+}
+
+// Runs in interrupt context: drain the receive FIFO and wake the reader
+static void uart_handle_irq(void) {
+    while (uart_regs[UART_LSR] & UART_LSR_DR) {
+        char c = uart_regs[UART_RBR];
+        if (rx_head - rx_tail < UART_RX_SIZE) rx_buf[rx_head++ % UART_RX_SIZE] = c;
+    }
+    scheduler_wakeup((void *)&rx_head);
+}
+
+// Switch receiving to interrupts if the device tree shows the UART's
+// interrupt line and a PLIC to route it; otherwise keep polling SBI.
+static void uart_rx_init(void) {
+    const fdt_device_t *dev = fdt_find_device(&boot_fdt, "ns16550a", 0);
+    if (!dev || plic_register(dev->irq, uart_handle_irq) < 0) {
+        uart_rx_mode = -1;
+        return;
     }
+    uart_regs = (volatile uint8_t *)dev->base;
+    uart_regs[UART_IER] = UART_IER_RX;
+    uart_rx_mode = 1;
 }
 
-// Blocks until a character is received from the console via SBI call.
+// Returns a received character, or -1 at once if none is waiting
+int uart_getc_nonblock(void) {
+    if (!uart_rx_mode) uart_rx_init();
+    if (uart_rx_mode > 0) {
+        int s = intr_off();
+        int c = rx_head == rx_tail ? -1 : (unsigned char)rx_buf[rx_tail++ % UART_RX_SIZE];
+        intr_restore(s);
+        return c;
+    }
+    long c = sbi_call(SBI_CONSOLE_GETCHAR, 0);
+    return c < 0 ? -1 : (int)c;
+}
+
+// Blocks until a character is received from the console.
+// With receive interrupts the task sleeps until one arrives, so an idle
+// console costs nothing. Without them it polls SBI, and other tasks get
+// the CPU between polls.
 char uart_getc_block(void) {
+    if (!uart_rx_mode) uart_rx_init();
+    if (uart_rx_mode > 0) {
+        // Check and sleep with interrupts off, so the wakeup cannot be missed
+        int s = intr_off();
+        while (rx_head == rx_tail) scheduler_sleep((void *)&rx_head);
+        char c = rx_buf[rx_tail++ % UART_RX_SIZE];
+        intr_restore(s);
+        return c;
+    }
+
     long c = -1;
     // SBI_CONSOLE_GETCHAR returns -1 if no character is available.
     while (c == -1) {
         c = sbi_call(SBI_CONSOLE_GETCHAR, 0);
+        if (c == -1) scheduler_yield();
     }
     return (char)c;
 }
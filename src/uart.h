@@ -6,6 +6,10 @@
 void uart_init(void);
 void uart_putc(char c);
 void uart_puts(const char *s);
+void uart_write(const char *s, int len);
+void uart_put_hex(uint64_t v);
+void uart_put_dec(uint64_t v);
 char uart_getc_block(void);
+int uart_getc_nonblock(void);
 
 #endif
@@ -2,8 +2,12 @@
 #include "fs.h"
 #include <stdint.h>
 
-const char _prog_hello[] = "Hello from embedded program!\n";
-const char _prog_echo[]  = "Echo program running.\n";
+// Initial contents of the file system: the initramfs archive that
+// initramfs.S includes and link.ld places (initramfs/ and the ELF
+// executables built from user/)
+extern const char __initramfs_start[], __initramfs_end[];
+const char *const fs_initramfs_start = __initramfs_start;
+const char *const fs_initramfs_end = __initramfs_end;
 
 // Helper function to make system calls
 static inline int syscall(int num, uint64_t a0, uint64_t a1, uint64_t a2) {
@@ -0,0 +1,66 @@
+#include "vdso.h"
+#include "vm.h"
+#include "kalloc.h"
+#include "timer.h"
+#include "hart.h"
+#include "scheduler.h"
+#include "syscall.h"
+#include <stdint.h>
+
+extern uint64_t boot_time_start;
+
+// The page, allocated on first use. Writers run with interrupts off on
+// the one hart that schedules, so they never race each other.
+static volatile vdso_data_t *vdso;
+
+static inline void vdso_write_begin(void) {
+    vdso->seq++;
+    asm volatile("fence w, w" ::: "memory");
+}
+
+static inline void vdso_write_end(void) {
+    asm volatile("fence w, w" ::: "memory");
+    vdso->seq++;
+}
+
+// The kernel's view of the page, or 0 if no page could be allocated
+const volatile vdso_data_t *vdso_kernel(void) {
+    if (vdso) return vdso;
+    vdso_data_t *d = kzalloc();
+    if (!d) return 0;
+    d->hart = hart_id();
+    d->timer_freq = TIMER_FREQ;
+    d->clock_base = boot_time_start;
+    d->tid = scheduler_current();
+
+    // The exit stub: li a7, SYS_EXIT; ecall; and should that ever return, j .
+    uint32_t *stub = (uint32_t *)((char *)d + VDSO_EXIT_OFFSET);
+    stub[0] = 0x00000893 | (SYS_EXIT << 20);
+    stub[1] = 0x00000073;
+    stub[2] = 0x0000006f;
+    asm volatile("fence.i" ::: "memory");
+    vdso = d;
+    return vdso;
+}
+
+// Map the page read-only at VDSO_USER_BASE; executable for the exit stub
+int vdso_map(struct vm_space *space) {
+    if (!vdso_kernel()) return -1;
+    return vm_map_shared(space, VDSO_USER_BASE, (uint64_t)vdso, 1, VM_READ | VM_EXEC);
+}
+
+// The scheduler switched to task 'tid' (-1: the idle loop)
+void vdso_switch(int tid) {
+    if (!vdso) return;
+    vdso_write_begin();
+    vdso->tid = tid;
+    vdso->switches++;
+    vdso_write_end();
+}
+
+void vdso_tick(void) {
+    if (!vdso) return;
+    vdso_write_begin();
+    vdso->ticks++;
+    vdso_write_end();
+}
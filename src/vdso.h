@@ -0,0 +1,75 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <stdint.h>
+
+// A page of kernel data mapped read-only into every program, so questions
+// like "what time is it" or "which task am I" need no ecall. Programs read
+// it through user/vdso.h. Kernel tasks run unpaged and use vdso_kernel().
+
+// Where the page appears in a program's address space: the top page of the
+// mmap area (vm.h), right below the channel window
+#define VDSO_USER_BASE 0x6ffff000UL
+// The page also holds a SYS_EXIT stub, the return address programs and
+// their threads start with: returning from their entry point runs it, and
+// it ends the task with the return value as status (trap_enter_program)
+#define VDSO_EXIT_OFFSET 0x800
+
+// The published data. The kernel makes 'seq' odd while it updates the
+// fields below and even again when it is done; readers retry until they
+// see the same even value before and after copying (a seqlock).
+typedef struct {
+    uint32_t seq;
+    uint32_t hart;          // Hart the scheduler runs on
+    uint64_t timer_freq;    // 'time' CSR ticks per second
+    uint64_t clock_base;    // 'time' at boot: uptime is time - clock_base
+    uint64_t ticks;         // Timer interrupts handled so far
+    uint64_t switches;      // Context switches so far
+    int32_t tid;            // Running task, i.e. the reader itself
+} vdso_data_t;
+
+// Consistent copy of 'd' in 'out'; a handful of loads, and a retry in the
+// rare case the kernel was updating it at the same time
+static inline void vdso_read(const volatile vdso_data_t *d, vdso_data_t *out) {
+    uint32_t seq;
+    do {
+        seq = d->seq;
+        asm volatile("fence r, r" ::: "memory");
+        out->hart = d->hart;
+        out->timer_freq = d->timer_freq;
+        out->clock_base = d->clock_base;
+        out->ticks = d->ticks;
+        out->switches = d->switches;
+        out->tid = d->tid;
+        asm volatile("fence r, r" ::: "memory");
+    } while ((seq & 1) || seq != d->seq);
+    out->seq = seq;
+}
+
+// Time CSR ticks since boot
+static inline uint64_t vdso_uptime(const volatile vdso_data_t *d) {
+    uint64_t now, base;
+    uint32_t seq;
+    do {
+        seq = d->seq;
+        asm volatile("fence r, r" ::: "memory");
+        base = d->clock_base;
+        asm volatile("rdtime %0" : "=r"(now));
+        asm volatile("fence r, r" ::: "memory");
+    } while ((seq & 1) || seq != d->seq);
+    return now - base;
+}
+
+// The running task's id: one aligned word, so no retry loop is needed
+static inline int vdso_gettid(const volatile vdso_data_t *d) {
+    return d->tid;
+}
+
+struct vm_space;
+
+const volatile vdso_data_t *vdso_kernel(void);
+int vdso_map(struct vm_space *space);
+void vdso_switch(int tid);
+void vdso_tick(void);
+
+#endif
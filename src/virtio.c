@@ -0,0 +1,74 @@
+#include "virtio.h"
+#include "fdt.h"
+#include <stdint.h>
+
+// Find the first virtio-mmio slot holding a device of type 'device_id'.
+// Only the version 2 (non-legacy) interface is supported; QEMU needs
+// -global virtio-mmio.force-legacy=false for it.
+// Returns the register base and the interrupt line, or 0 if there is none.
+uint64_t virtio_find(uint32_t device_id, uint32_t *irq) {
+    const fdt_device_t *dev;
+    for (int i = 0; (dev = fdt_find_device(&boot_fdt, "virtio,mmio", i)) != 0; i++) {
+        if (*virtio_reg(dev->base, VIRTIO_MMIO_MAGIC) != VIRTIO_MAGIC ||
+            *virtio_reg(dev->base, VIRTIO_MMIO_VERSION) != 2 ||
+            *virtio_reg(dev->base, VIRTIO_MMIO_DEVICE_ID) != device_id) {
+            continue;
+        }
+        *irq = dev->irq;
+        return dev->base;
+    }
+    return 0;
+}
+
+// Reset the device and agree on features: VIRTIO_F_VERSION_1 plus those of
+// the device-specific bits in 'features' (lower word) the device offers.
+// Returns -1 if the device rejects the result.
+int virtio_negotiate(uint64_t base, uint32_t features, uint32_t *accepted) {
+    volatile uint32_t *status = virtio_reg(base, VIRTIO_MMIO_STATUS);
+    *status = 0;
+    *status = VIRTIO_STATUS_ACKNOWLEDGE;
+    *status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
+
+    *virtio_reg(base, VIRTIO_MMIO_DEVICE_FEATURES_SEL) = 0;
+    uint32_t lo = *virtio_reg(base, VIRTIO_MMIO_DEVICE_FEATURES) & features;
+    *virtio_reg(base, VIRTIO_MMIO_DEVICE_FEATURES_SEL) = 1;
+    uint32_t hi = *virtio_reg(base, VIRTIO_MMIO_DEVICE_FEATURES);
+    if (!(hi & (1u << (VIRTIO_F_VERSION_1 - 32)))) return -1;
+
+    *virtio_reg(base, VIRTIO_MMIO_DRIVER_FEATURES_SEL) = 0;
+    *virtio_reg(base, VIRTIO_MMIO_DRIVER_FEATURES) = lo;
+    *virtio_reg(base, VIRTIO_MMIO_DRIVER_FEATURES_SEL) = 1;
+    *virtio_reg(base, VIRTIO_MMIO_DRIVER_FEATURES) = 1u << (VIRTIO_F_VERSION_1 - 32);
+
+    *status |= VIRTIO_STATUS_FEATURES_OK;
+    if (!(*status & VIRTIO_STATUS_FEATURES_OK)) return -1;
+    *accepted = lo;
+    return 0;
+}
+
+// Hand the device the three parts of a split virtqueue. The queue gets at
+// most 'size' entries (a power of two), fewer if the device can't take that
+// many. Returns the size in use, or -1.
+int virtio_setup_queue(uint64_t base, int queue, int size,
+                       void *desc, void *avail, void *used) {
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_SEL) = queue;
+    if (*virtio_reg(base, VIRTIO_MMIO_QUEUE_READY)) return -1;
+    int max = *virtio_reg(base, VIRTIO_MMIO_QUEUE_NUM_MAX);
+    if (max == 0) return -1;
+    while (size > max) size /= 2;
+
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_NUM) = size;
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64_t)desc;
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64_t)desc >> 32;
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_DRIVER_LOW) = (uint64_t)avail;
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_DRIVER_HIGH) = (uint64_t)avail >> 32;
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_DEVICE_LOW) = (uint64_t)used;
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_DEVICE_HIGH) = (uint64_t)used >> 32;
+    *virtio_reg(base, VIRTIO_MMIO_QUEUE_READY) = 1;
+    return size;
+}
+
+// Setup is complete: the device may start using its queues
+void virtio_driver_ok(uint64_t base) {
+    *virtio_reg(base, VIRTIO_MMIO_STATUS) |= VIRTIO_STATUS_DRIVER_OK;
+}
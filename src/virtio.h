@@ -0,0 +1,72 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+
+// virtio-mmio registers (version 2, the virtio 1.x layout)
+#define VIRTIO_MMIO_MAGIC 0x000
+#define VIRTIO_MMIO_VERSION 0x004
+#define VIRTIO_MMIO_DEVICE_ID 0x008
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL 0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX 0x034
+#define VIRTIO_MMIO_QUEUE_NUM 0x038
+#define VIRTIO_MMIO_QUEUE_READY 0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY 0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK 0x064
+#define VIRTIO_MMIO_STATUS 0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW 0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH 0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH 0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW 0x0a0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH 0x0a4
+#define VIRTIO_MMIO_CONFIG 0x100
+
+#define VIRTIO_MAGIC 0x74726976  // "virt"
+
+// Device types
+#define VIRTIO_DEV_NET 1
+#define VIRTIO_DEV_BLK 2
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FEATURES_OK 8
+
+// Feature bit every modern device offers (in the upper feature word)
+#define VIRTIO_F_VERSION_1 32
+
+// Split virtqueue layout
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2      // The device writes the buffer
+#define VIRTQ_USED_F_NO_NOTIFY 1  // The device does not need kicks right now
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc_t;
+
+typedef struct {
+    uint32_t id;    // Head descriptor of the completed chain
+    uint32_t len;   // Bytes the device wrote
+} virtq_used_elem_t;
+
+static inline volatile uint32_t *virtio_reg(uint64_t base, uint32_t off) {
+    return (volatile uint32_t *)(base + off);
+}
+
+uint64_t virtio_find(uint32_t device_id, uint32_t *irq);
+int virtio_negotiate(uint64_t base, uint32_t features, uint32_t *accepted);
+int virtio_setup_queue(uint64_t base, int queue, int size,
+                       void *desc, void *avail, void *used);
+void virtio_driver_ok(uint64_t base);
+
+#endif
@@ -0,0 +1,213 @@
+#include "virtio_blk.h"
+#include "virtio.h"
+#include "plic.h"
+#include "hart.h"
+#include "scheduler.h"
+#include <stdint.h>
+
+// Request types and the status byte the device writes back
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_S_OK 0
+
+// Config space: capacity in sectors
+#define VIRTIO_BLK_CFG_CAPACITY 0x00
+
+// The three parts of the request queue
+static virtq_desc_t desc[VIRTIO_BLK_QSIZE] __attribute__((aligned(4096)));
+static struct {
+    uint16_t flags;
+    volatile uint16_t idx;
+    uint16_t ring[VIRTIO_BLK_QSIZE];
+} avail __attribute__((aligned(2)));
+static volatile struct {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[VIRTIO_BLK_QSIZE];
+} used __attribute__((aligned(4096)));
+
+static uint64_t blk_base;
+static int blk_state;               // 0: not probed, 1: ready, -1: no device
+static int blk_irq_mode;            // Completions arrive by interrupt
+static int qsize;
+static uint64_t capacity;
+static virtio_blk_req_t *inflight[VIRTIO_BLK_QSIZE];  // By head descriptor
+static uint16_t free_head;          // Free descriptors, chained through 'next'
+static int nfree;
+static uint16_t last_used;          // Next used ring entry to look at
+static uint16_t kicked;             // avail.idx when the device was last notified
+
+static void virtio_blk_irq(void);
+
+// Probe for the disk on first use; returns -1 if there is none
+static int virtio_blk_init(void) {
+    if (blk_state) return blk_state > 0 ? 0 : -1;
+    blk_state = -1;
+
+    uint32_t irq, features;
+    blk_base = virtio_find(VIRTIO_DEV_BLK, &irq);
+    if (!blk_base || virtio_negotiate(blk_base, 0, &features) < 0) return -1;
+    qsize = virtio_setup_queue(blk_base, 0, VIRTIO_BLK_QSIZE, desc, &avail, (void *)&used);
+    if (qsize < 0) return -1;
+
+    for (int i = 0; i < qsize; i++) desc[i].next = i + 1;
+    free_head = 0;
+    nfree = qsize;
+
+    volatile uint32_t *cfg = virtio_reg(blk_base, VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CFG_CAPACITY);
+    capacity = cfg[0] | ((uint64_t)cfg[1] << 32);
+
+    // Without a PLIC, waiters poll the used ring instead
+    blk_irq_mode = plic_register(irq, virtio_blk_irq) == 0;
+    virtio_driver_ok(blk_base);
+    blk_state = 1;
+    return 0;
+}
+
+// Size of the disk in sectors, 0 if there is no disk
+uint64_t virtio_blk_capacity(void) {
+    return virtio_blk_init() < 0 ? 0 : capacity;
+}
+
+// Retire every request the device has completed. Called from the
+// interrupt handler, or by waiters when there are no interrupts.
+static void virtio_blk_complete(void) {
+    asm volatile("fence" ::: "memory");
+    while (last_used != used.idx) {
+        uint16_t head = used.ring[last_used % qsize].id;
+        virtio_blk_req_t *req = inflight[head];
+        inflight[head] = 0;
+        last_used++;
+
+        // Return the chain to the free list
+        uint16_t d = head;
+        nfree++;
+        while (desc[d].flags & VIRTQ_DESC_F_NEXT) {
+            d = desc[d].next;
+            nfree++;
+        }
+        desc[d].next = free_head;
+        free_head = head;
+
+        if (req) {
+            req->status = req->dev_status == VIRTIO_BLK_S_OK ? 0 : -1;
+            req->done = 1;
+            scheduler_wakeup(req);
+        }
+    }
+    scheduler_wakeup(&nfree);
+}
+
+static void virtio_blk_irq(void) {
+    volatile uint32_t *status = virtio_reg(blk_base, VIRTIO_MMIO_INTERRUPT_STATUS);
+    *virtio_reg(blk_base, VIRTIO_MMIO_INTERRUPT_ACK) = *status;
+    virtio_blk_complete();
+}
+
+// Notify the device of everything queued since the last kick, unless it
+// said it is still working through the ring anyway. Interrupts are off.
+static void virtio_blk_kick_locked(void) {
+    asm volatile("fence w, w" ::: "memory");
+    if (avail.idx == kicked) return;
+    kicked = avail.idx;
+    asm volatile("fence" ::: "memory");
+    if (!(used.flags & VIRTQ_USED_F_NO_NOTIFY)) {
+        *virtio_reg(blk_base, VIRTIO_MMIO_QUEUE_NOTIFY) = 0;
+    }
+}
+
+// Wait for the device to make progress; interrupts are off
+static void virtio_blk_idle(void *chan) {
+    if (blk_irq_mode) {
+        scheduler_sleep(chan);
+    } else {
+        virtio_blk_complete();
+        scheduler_yield();
+    }
+}
+
+// Queue a request without notifying the device, so several submissions
+// share one kick (virtio_blk_kick or virtio_blk_wait). Blocks only while
+// the queue has no room. Returns -1 for a malformed request or no disk.
+int virtio_blk_submit(virtio_blk_req_t *req) {
+    if (virtio_blk_init() < 0 || req->nseg < 1 || req->nseg > VIRTIO_BLK_MAX_SEGS ||
+        req->nseg + 2 > qsize) {
+        return -1;
+    }
+    uint64_t bytes = 0;
+    for (int i = 0; i < req->nseg; i++) bytes += req->seg[i].len;
+    if (bytes == 0 || bytes % VIRTIO_BLK_SECTOR ||
+        req->sector + bytes / VIRTIO_BLK_SECTOR > capacity) {
+        return -1;
+    }
+
+    req->hdr.type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    req->hdr.reserved = 0;
+    req->hdr.sector = req->sector;
+    req->dev_status = 0xff;
+    req->done = 0;
+    req->status = 0;
+
+    int s = intr_off();
+    while (nfree < req->nseg + 2) {
+        // What is queued must reach the device before waiting for it
+        virtio_blk_kick_locked();
+        virtio_blk_idle(&nfree);
+    }
+
+    // Header, then the data segments, then the status byte
+    uint16_t head = free_head;
+    uint16_t d = head;
+    desc[d].addr = (uint64_t)&req->hdr;
+    desc[d].len = sizeof(req->hdr);
+    desc[d].flags = VIRTQ_DESC_F_NEXT;
+    for (int i = 0; i < req->nseg; i++) {
+        d = desc[d].next;
+        desc[d].addr = (uint64_t)req->seg[i].addr;
+        desc[d].len = req->seg[i].len;
+        desc[d].flags = VIRTQ_DESC_F_NEXT | (req->write ? 0 : VIRTQ_DESC_F_WRITE);
+    }
+    d = desc[d].next;
+    desc[d].addr = (uint64_t)&req->dev_status;
+    desc[d].len = 1;
+    desc[d].flags = VIRTQ_DESC_F_WRITE;
+    free_head = desc[d].next;
+    nfree -= req->nseg + 2;
+
+    inflight[head] = req;
+    avail.ring[avail.idx % qsize] = head;
+    asm volatile("fence w, w" ::: "memory");
+    avail.idx++;
+    intr_restore(s);
+    return 0;
+}
+
+// Notify the device of all requests submitted so far
+void virtio_blk_kick(void) {
+    if (blk_state <= 0) return;
+    int s = intr_off();
+    virtio_blk_kick_locked();
+    intr_restore(s);
+}
+
+// Sleep until 'req' completes (kicking the device first if needed).
+// Returns its status.
+int virtio_blk_wait(virtio_blk_req_t *req) {
+    int s = intr_off();
+    virtio_blk_kick_locked();
+    while (!req->done) virtio_blk_idle(req);
+    intr_restore(s);
+    return req->status;
+}
+
+// Read or write 'len' bytes at 'sector' synchronously
+int virtio_blk_rw(int write, uint64_t sector, void *buf, uint32_t len) {
+    virtio_blk_req_t req;
+    req.write = write;
+    req.sector = sector;
+    req.nseg = 1;
+    req.seg[0].addr = buf;
+    req.seg[0].len = len;
+    if (virtio_blk_submit(&req) < 0) return -1;
+    return virtio_blk_wait(&req);
+}
@@ -0,0 +1,42 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+
+#define VIRTIO_BLK_SECTOR 512
+// Descriptors in the request queue; each request takes nseg + 2
+#define VIRTIO_BLK_QSIZE 128
+#define VIRTIO_BLK_MAX_SEGS 16
+
+// One piece of a scatter-gather buffer (kernel memory)
+typedef struct {
+    void *addr;
+    uint32_t len;
+} virtio_blk_seg_t;
+
+// A block request. The caller fills in the first four fields and keeps the
+// request alive until it is done; the segments are read or written in order
+// starting at 'sector'.
+typedef struct {
+    int write;
+    uint64_t sector;
+    int nseg;
+    virtio_blk_seg_t seg[VIRTIO_BLK_MAX_SEGS];
+    volatile int done;      // Set when the device has completed the request
+    int status;             // 0 on success, -1 on a device error
+    // Owned by the driver while the request is in flight
+    struct {
+        uint32_t type;
+        uint32_t reserved;
+        uint64_t sector;
+    } hdr;
+    volatile uint8_t dev_status;
+} virtio_blk_req_t;
+
+uint64_t virtio_blk_capacity(void);
+int virtio_blk_submit(virtio_blk_req_t *req);
+void virtio_blk_kick(void);
+int virtio_blk_wait(virtio_blk_req_t *req);
+int virtio_blk_rw(int write, uint64_t sector, void *buf, uint32_t len);
+
+#endif
@@ -0,0 +1,232 @@
+#include "virtio_net.h"
+#include "virtio.h"
+#include "plic.h"
+#include "hart.h"
+#include "scheduler.h"
+#include "string.h"
+#include <stdint.h>
+
+// Feature bit: the MAC address is in the config space
+#define VIRTIO_NET_F_MAC 5
+#define VIRTIO_NET_CFG_MAC 0x00
+
+#define RX_QUEUE 0
+#define TX_QUEUE 1
+
+// The three parts of a split virtqueue, and where the driver is in it
+typedef struct {
+    virtq_desc_t desc[VIRTIO_NET_QSIZE] __attribute__((aligned(16)));
+    struct {
+        uint16_t flags;
+        volatile uint16_t idx;
+        uint16_t ring[VIRTIO_NET_QSIZE];
+    } avail __attribute__((aligned(2)));
+    volatile struct {
+        uint16_t flags;
+        uint16_t idx;
+        virtq_used_elem_t ring[VIRTIO_NET_QSIZE];
+    } used __attribute__((aligned(4)));
+    int size;
+    uint16_t last_used;     // Next used ring entry to look at
+} net_queue_t;
+
+static net_queue_t rxq, txq;
+// Receive buffer i sits behind receive descriptor i, for good
+static uint8_t rx_bufs[VIRTIO_NET_RX_BUFS][VIRTIO_NET_BUF_SIZE] __attribute__((aligned(64)));
+
+static uint64_t net_base;
+static int net_state;               // 0: not probed, 1: ready, -1: no device
+static int net_irq_mode;            // Completions arrive by interrupt
+static uint8_t mac[6];
+static virtio_net_rx_fn rx_handler;
+static virtio_net_tx_t *inflight[VIRTIO_NET_QSIZE];  // By head descriptor
+static uint16_t free_head;          // Free transmit descriptors, chained through 'next'
+static int nfree;
+
+static void virtio_net_irq(void);
+
+// Put an entry on a queue's available ring
+static void queue_push(net_queue_t *q, uint16_t head) {
+    q->avail.ring[q->avail.idx % q->size] = head;
+    asm volatile("fence w, w" ::: "memory");
+    q->avail.idx++;
+}
+
+// Tell the device about new entries on queue 'n', unless it said it does
+// not need to hear about them right now
+static void queue_notify(net_queue_t *q, int n) {
+    asm volatile("fence" ::: "memory");
+    if (!(q->used.flags & VIRTQ_USED_F_NO_NOTIFY)) {
+        *virtio_reg(net_base, VIRTIO_MMIO_QUEUE_NOTIFY) = n;
+    }
+}
+
+// Hand receive buffer 'buf' back to the device
+static void rx_post(int buf) {
+    rxq.desc[buf].addr = (uint64_t)rx_bufs[buf];
+    rxq.desc[buf].len = VIRTIO_NET_BUF_SIZE;
+    rxq.desc[buf].flags = VIRTQ_DESC_F_WRITE;
+    queue_push(&rxq, buf);
+}
+
+// Probe for the network device and fill its receive queue. Frames that
+// arrive from then on go to 'rx'. Returns -1 if there is no device.
+int virtio_net_init(virtio_net_rx_fn rx) {
+    if (net_state) return net_state > 0 ? 0 : -1;
+    net_state = -1;
+
+    uint32_t irq, features;
+    net_base = virtio_find(VIRTIO_DEV_NET, &irq);
+    if (!net_base || virtio_negotiate(net_base, 1u << VIRTIO_NET_F_MAC, &features) < 0) return -1;
+    rxq.size = virtio_setup_queue(net_base, RX_QUEUE, VIRTIO_NET_QSIZE, rxq.desc, &rxq.avail, (void *)&rxq.used);
+    txq.size = virtio_setup_queue(net_base, TX_QUEUE, VIRTIO_NET_QSIZE, txq.desc, &txq.avail, (void *)&txq.used);
+    if (rxq.size < 0 || txq.size < 0) return -1;
+
+    for (int i = 0; i < txq.size; i++) txq.desc[i].next = i + 1;
+    free_head = 0;
+    nfree = txq.size;
+
+    if (features & (1u << VIRTIO_NET_F_MAC)) {
+        volatile uint8_t *cfg = (volatile uint8_t *)virtio_reg(net_base, VIRTIO_MMIO_CONFIG + VIRTIO_NET_CFG_MAC);
+        for (int i = 0; i < 6; i++) mac[i] = cfg[i];
+    } else {
+        // A locally administered address in QEMU's range
+        static const uint8_t fallback[6] = {0x52, 0x54, 0x00, 0x12, 0x34, 0x56};
+        memcpy(mac, fallback, sizeof(mac));
+    }
+
+    // Without a PLIC, waiters poll the used rings instead
+    rx_handler = rx;
+    net_irq_mode = plic_register(irq, virtio_net_irq) == 0;
+    virtio_driver_ok(net_base);
+    net_state = 1;
+
+    int s = intr_off();
+    for (int i = 0; i < rxq.size; i++) rx_post(i);
+    queue_notify(&rxq, RX_QUEUE);
+    intr_restore(s);
+    return 0;
+}
+
+const uint8_t *virtio_net_mac(void) {
+    return mac;
+}
+
+// Deliver every frame received so far and retire every frame sent.
+// Called from the interrupt handler, or by waiters when there are no
+// interrupts; interrupts are off.
+static void virtio_net_complete(void) {
+    asm volatile("fence" ::: "memory");
+    int posted = 0;
+    while (rxq.last_used != rxq.used.idx) {
+        uint16_t buf = rxq.used.ring[rxq.last_used % rxq.size].id;
+        uint32_t len = rxq.used.ring[rxq.last_used % rxq.size].len;
+        rxq.last_used++;
+        // The frame is handed on where the device put it, without a copy
+        if (len > VIRTIO_NET_HDR_LEN && len <= VIRTIO_NET_BUF_SIZE &&
+            rx_handler(buf, rx_bufs[buf] + VIRTIO_NET_HDR_LEN, len - VIRTIO_NET_HDR_LEN)) {
+            continue;
+        }
+        rx_post(buf);
+        posted = 1;
+    }
+    if (posted) queue_notify(&rxq, RX_QUEUE);
+
+    while (txq.last_used != txq.used.idx) {
+        uint16_t head = txq.used.ring[txq.last_used % txq.size].id;
+        virtio_net_tx_t *tx = inflight[head];
+        inflight[head] = 0;
+        txq.last_used++;
+
+        // Return the chain to the free list
+        uint16_t d = head;
+        nfree++;
+        while (txq.desc[d].flags & VIRTQ_DESC_F_NEXT) {
+            d = txq.desc[d].next;
+            nfree++;
+        }
+        txq.desc[d].next = free_head;
+        free_head = head;
+
+        if (tx) {
+            tx->done = 1;
+            scheduler_wakeup(tx);
+        }
+    }
+    scheduler_wakeup(&nfree);
+}
+
+static void virtio_net_irq(void) {
+    volatile uint32_t *status = virtio_reg(net_base, VIRTIO_MMIO_INTERRUPT_STATUS);
+    *virtio_reg(net_base, VIRTIO_MMIO_INTERRUPT_ACK) = *status;
+    virtio_net_complete();
+}
+
+// Wait for the device to make progress; interrupts are off. 'chan' is
+// what a completion wakes: the frame sent, the free descriptor count, or
+// whatever the receive handler wakes.
+void virtio_net_idle(void *chan) {
+    if (net_irq_mode) {
+        scheduler_sleep(chan);
+    } else {
+        virtio_net_complete();
+        scheduler_yield();
+    }
+}
+
+// Send a frame made of the header and tx->seg. The device reads the
+// segments in place, so they must stay untouched until tx->done. With
+// 'wait' the call blocks while the queue is full and then until the frame
+// is out; without it, it never blocks (interrupt handlers may use it) and
+// returns -1 if the queue has no room. Returns -1 with no device too.
+int virtio_net_send(virtio_net_tx_t *tx, int wait) {
+    if (net_state <= 0 || tx->nseg < 0 || tx->nseg > VIRTIO_NET_MAX_SEGS ||
+        tx->nseg + 1 > txq.size) {
+        return -1;
+    }
+    // No checksum offload and no segmentation: all zeros
+    memset(tx->hdr, 0, sizeof(tx->hdr));
+    tx->done = 0;
+
+    int s = intr_off();
+    while (nfree < tx->nseg + 1) {
+        if (!wait) {
+            intr_restore(s);
+            return -1;
+        }
+        virtio_net_idle(&nfree);
+    }
+
+    // Header, then the segments; the device only reads them
+    uint16_t head = free_head;
+    uint16_t d = head;
+    txq.desc[d].addr = (uint64_t)tx->hdr;
+    txq.desc[d].len = sizeof(tx->hdr);
+    txq.desc[d].flags = tx->nseg ? VIRTQ_DESC_F_NEXT : 0;
+    for (int i = 0; i < tx->nseg; i++) {
+        d = txq.desc[d].next;
+        txq.desc[d].addr = tx->seg[i].addr;
+        txq.desc[d].len = tx->seg[i].len;
+        txq.desc[d].flags = i + 1 < tx->nseg ? VIRTQ_DESC_F_NEXT : 0;
+    }
+    free_head = txq.desc[d].next;
+    nfree -= tx->nseg + 1;
+
+    inflight[head] = tx;
+    queue_push(&txq, head);
+    queue_notify(&txq, TX_QUEUE);
+    if (wait) {
+        while (!tx->done) virtio_net_idle(tx);
+    }
+    intr_restore(s);
+    return 0;
+}
+
+// Give back a receive buffer the handler kept
+void virtio_net_rx_release(int buf) {
+    if (net_state <= 0 || buf < 0 || buf >= rxq.size) return;
+    int s = intr_off();
+    rx_post(buf);
+    queue_notify(&rxq, RX_QUEUE);
+    intr_restore(s);
+}
@@ -0,0 +1,43 @@
+#ifndef VIRTIO_NET_H
+#define VIRTIO_NET_H
+
+#include <stdint.h>
+
+// Descriptors in each of the receive and transmit queues
+#define VIRTIO_NET_QSIZE 16
+// Receive buffers, one descriptor each, all posted at start-up. Each holds
+// the virtio-net header and a whole Ethernet frame.
+#define VIRTIO_NET_RX_BUFS VIRTIO_NET_QSIZE
+#define VIRTIO_NET_BUF_SIZE 1536
+// Header in front of every frame (virtio 1.x layout, with num_buffers)
+#define VIRTIO_NET_HDR_LEN 12
+// Pieces of a frame to send, after the header
+#define VIRTIO_NET_MAX_SEGS 4
+
+// One piece of a scatter-gather frame, by physical address
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+} virtio_net_seg_t;
+
+// A frame to send: the segments go out in order behind a header the
+// driver fills in. The caller keeps it alive until it is done.
+typedef struct {
+    int nseg;
+    virtio_net_seg_t seg[VIRTIO_NET_MAX_SEGS];
+    volatile int done;      // Set when the device has read every segment
+    uint8_t hdr[VIRTIO_NET_HDR_LEN];    // Owned by the driver
+} virtio_net_tx_t;
+
+// Called with interrupts off for each frame received into buffer 'buf'.
+// Returning 1 keeps the buffer until virtio_net_rx_release(buf); with 0 it
+// goes straight back to the device.
+typedef int (*virtio_net_rx_fn)(int buf, const uint8_t *frame, int len);
+
+int virtio_net_init(virtio_net_rx_fn rx);
+const uint8_t *virtio_net_mac(void);
+int virtio_net_send(virtio_net_tx_t *tx, int wait);
+void virtio_net_rx_release(int buf);
+void virtio_net_idle(void *chan);
+
+#endif
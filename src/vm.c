@@ -0,0 +1,399 @@
+#include "vm.h"
+#include "kalloc.h"
+#include "string.h"
+#include "scheduler.h"
+#include "pcache.h"
+#include <stdint.h>
+
+// Sv39 page table entry bits
+#define PTE_V (1UL << 0)
+#define PTE_R (1UL << 1)
+#define PTE_W (1UL << 2)
+#define PTE_X (1UL << 3)
+#define PTE_U (1UL << 4)
+#define PTE_A (1UL << 6)
+#define PTE_D (1UL << 7)
+// Software bits (RSW): page belongs to the page cache (pinned), or is a
+// private page shared copy-on-write after fork (PTE_W is cleared meanwhile)
+#define PTE_SHARED (1UL << 8)
+#define PTE_COW (1UL << 9)
+#define PTE_FLAGS 0x3ffUL
+
+#define PA2PTE(pa) ((((uint64_t)(pa)) >> 12) << 10)
+#define PTE2PA(pte) (((pte) >> 10) << 12)
+#define VPN(va, level) ((((uint64_t)(va)) >> (12 + 9 * (level))) & 0x1ff)
+#define SATP_SV39 (8UL << 60)
+
+// Gigapage slots of the root table that identity-map the kernel view:
+// 0 covers MMIO (UART, virtio, PLIC), 2 and 3 cover RAM.
+#define ROOT_MMIO 0
+#define ROOT_USER 1
+#define ROOT_RAM_LO 2
+#define ROOT_RAM_HI 3
+
+static vm_space_t spaces[MAX_TASKS];
+
+static vm_region_t *vm_find_region(vm_space_t *space, uint64_t va);
+static vm_region_t *vm_range_used(vm_space_t *space, uint64_t start, uint64_t end);
+
+// Returns the PTE for 'va', creating intermediate tables if 'alloc' is set
+static uint64_t *vm_walk(uint64_t *root, uint64_t va, int alloc) {
+    uint64_t *table = root;
+    for (int level = 2; level > 0; level--) {
+        uint64_t *pte = &table[VPN(va, level)];
+        if (*pte & PTE_V) {
+            table = (uint64_t *)PTE2PA(*pte);
+        } else {
+            if (!alloc) return 0;
+            uint64_t *next = kzalloc();
+            if (!next) return 0;
+            *pte = PA2PTE(next) | PTE_V;
+            table = next;
+        }
+    }
+    return &table[VPN(va, 0)];
+}
+
+// Create an empty address space: only the identity-mapped kernel view.
+// Its pages lack PTE_U, so programs, which run in U-mode, can't touch it;
+// every page of the private slot has PTE_U, and the kernel reaches those
+// only through the uaccess routines, which set sstatus.SUM.
+vm_space_t *vm_space_create(void) {
+    vm_space_t *space = 0;
+    for (uint64_t i = 0; i < sizeof(spaces) / sizeof(spaces[0]); i++) {
+        if (!spaces[i].refs) {
+            space = &spaces[i];
+            break;
+        }
+    }
+    if (!space) return 0;
+
+    uint64_t *root = kzalloc();
+    if (!root) return 0;
+
+    uint64_t kernel_flags = PTE_V | PTE_R | PTE_W | PTE_A | PTE_D;
+    root[ROOT_MMIO] = PA2PTE(0x00000000UL) | kernel_flags;
+    root[ROOT_RAM_LO] = PA2PTE(0x80000000UL) | kernel_flags | PTE_X;
+    root[ROOT_RAM_HI] = PA2PTE(0xc0000000UL) | kernel_flags | PTE_X;
+
+    space->root = root;
+    space->refs = 1;
+    space->nregions = 0;
+    return space;
+}
+
+// Release an address space once the last task using it is gone
+void vm_space_put(vm_space_t *space) {
+    if (!space || --space->refs > 0) return;
+
+    uint64_t l1_pte = space->root[ROOT_USER];
+    if (l1_pte & PTE_V) {
+        uint64_t *l1 = (uint64_t *)PTE2PA(l1_pte);
+        for (int i = 0; i < 512; i++) {
+            if (!(l1[i] & PTE_V)) continue;
+            uint64_t *l0 = (uint64_t *)PTE2PA(l1[i]);
+            for (int j = 0; j < 512; j++) {
+                if (!(l0[j] & PTE_V)) continue;
+                if (l0[j] & PTE_SHARED) pcache_unpin(PTE2PA(l0[j]));
+                else kpage_put(PTE2PA(l0[j]));
+            }
+            kfree(l0);
+        }
+        kfree(l1);
+    }
+    kfree(space->root);
+    space->root = 0;
+    space->nregions = 0;
+}
+
+// Another task starts using the address space (a thread)
+void vm_space_get(vm_space_t *space) {
+    if (space) space->refs++;
+}
+
+// Duplicate 'parent' for fork. Writable pages become copy-on-write in both
+// spaces, read-only pages are simply shared. Stacks are copy-on-write like
+// every other private page: traps are taken on the task's kernel stack, so
+// a store fault on a program stack is handled like any other.
+vm_space_t *vm_space_fork(vm_space_t *parent) {
+    vm_space_t *child = vm_space_create();
+    if (!child) return 0;
+    child->nregions = parent->nregions;
+    for (int i = 0; i < parent->nregions; i++) child->regions[i] = parent->regions[i];
+
+    uint64_t l1_pte = parent->root[ROOT_USER];
+    if (l1_pte & PTE_V) {
+        uint64_t *l1 = (uint64_t *)PTE2PA(l1_pte);
+        for (int i = 0; i < 512; i++) {
+            if (!(l1[i] & PTE_V)) continue;
+            uint64_t *l0 = (uint64_t *)PTE2PA(l1[i]);
+            for (int j = 0; j < 512; j++) {
+                uint64_t pte = l0[j];
+                if (!(pte & PTE_V)) continue;
+                uint64_t va = USER_BASE + ((uint64_t)i << 21) + ((uint64_t)j << 12);
+                uint64_t *cpte = vm_walk(child->root, va, 1);
+                if (!cpte) {
+                    vm_space_put(child);
+                    return 0;
+                }
+                uint64_t pa = PTE2PA(pte);
+                vm_region_t *r = vm_find_region(parent, va);
+                if (pte & PTE_SHARED) {
+                    pcache_dup(pa);
+                } else if (r && (r->prot & VM_SHARED)) {
+                    kpage_get(pa);
+                } else {
+                    if (pte & (PTE_W | PTE_COW)) {
+                        pte = (pte & ~PTE_W) | PTE_COW;
+                        l0[j] = pte;
+                    }
+                    kpage_get(pa);
+                }
+                *cpte = pte;
+            }
+        }
+    }
+    // The parent lost write access to its private pages
+    asm volatile("sfence.vma" ::: "memory");
+    return child;
+}
+
+// Set up the stack of a new thread and return its top, or 0 on failure.
+// With top == 0 a fresh stack region is placed below the lowest one in use,
+// and its pages are mapped on first touch, like any others. A stack the
+// caller supplies only has to be writable memory; it usually lives in the
+// program's data, so it is left as it is and is not a VM_STACK region that
+// later stacks would be placed below.
+uint64_t vm_thread_stack(vm_space_t *space, uint64_t top) {
+    if (top) {
+        vm_region_t *r = vm_find_region(space, top - 1);
+        return r && (r->prot & VM_WRITE) ? top : 0;
+    }
+    uint64_t lowest = USER_STACK_TOP;
+    for (int i = 0; i < space->nregions; i++) {
+        vm_region_t *r = &space->regions[i];
+        if ((r->prot & VM_STACK) && r->start < lowest) lowest = r->start;
+    }
+    // Leave one unmapped guard page between neighbouring stacks; anything
+    // else in the way (vm_add_region checks the whole range) fails the call
+    top = lowest - PAGE_SIZE;
+    uint64_t base = top - USER_STACK_PAGES * PAGE_SIZE;
+    if (base < USER_BASE ||
+        vm_add_region(space, base, top, VM_READ | VM_WRITE | VM_STACK, 0, 0, 0) < 0) {
+        return 0;
+    }
+    return top;
+}
+
+// Map 'npages' pages starting at physical address 'pa' at 'va' with 'prot'
+// (VM_READ plus VM_WRITE or VM_EXEC), shared with whoever else maps them.
+// Mapping the same range twice is a no-op.
+int vm_map_shared(vm_space_t *space, uint64_t va, uint64_t pa, int npages, int prot) {
+    uint64_t end = va + (uint64_t)npages * PAGE_SIZE;
+    vm_region_t *r = vm_find_region(space, va);
+    if (r) {
+        return (r->prot & VM_SHARED) && r->start == va && r->end == end ? 0 : -1;
+    }
+    if (vm_add_region(space, va, end, prot | VM_SHARED, 0, 0, 0) < 0) {
+        return -1;
+    }
+    uint64_t flags = PTE_V | PTE_U | PTE_R | PTE_A | PTE_D;
+    if (prot & VM_WRITE) flags |= PTE_W;
+    if (prot & VM_EXEC) flags |= PTE_X;
+    for (int i = 0; i < npages; i++) {
+        uint64_t *pte = vm_walk(space->root, va + i * PAGE_SIZE, 1);
+        if (!pte) return -1;
+        kpage_get(pa + i * PAGE_SIZE);
+        *pte = PA2PTE(pa + i * PAGE_SIZE) | flags;
+    }
+    asm volatile("sfence.vma" ::: "memory");
+    return 0;
+}
+
+// Map the first 'len' bytes of file 'ino' read-only into the mmap area.
+// Pages are the page cache's own, shared with read() and other mappings.
+// Returns the address, or 0 if there is no room.
+uint64_t vm_map_file(vm_space_t *space, uint32_t ino, uint64_t len) {
+    uint64_t size = PAGE_ROUND_UP(len);
+    if (!size) return 0;
+    uint64_t va = VM_MMAP_BASE;
+    vm_region_t *r;
+    while (va + size <= VM_MMAP_TOP && (r = vm_range_used(space, va, va + size))) {
+        va = PAGE_ROUND_UP(r->end);
+    }
+    // The cache zero-fills past the end of the file, so all of it is file data
+    if (va + size > VM_MMAP_TOP ||
+        vm_add_region(space, va, va + size, VM_READ, ino, 0, size) < 0) {
+        return 0;
+    }
+    return va;
+}
+
+// Returns 0 if every byte of [va, va + len) lies in regions that allow
+// all of 'prot', -1 otherwise
+int vm_check_range(vm_space_t *space, uint64_t va, uint64_t len, int prot) {
+    if (va + len < va) return -1;
+    uint64_t end = va + len;
+    while (va < end) {
+        vm_region_t *r = vm_find_region(space, va);
+        if (!r || (r->prot & prot) != prot) return -1;
+        va = r->end;
+    }
+    return 0;
+}
+
+// Physical address behind 'va', or 0 if it is not mapped.
+// Outside the private slot, and for kernel tasks (space == 0), addresses
+// are identity-mapped.
+uint64_t vm_translate(vm_space_t *space, uint64_t va) {
+    if (!space || va < USER_BASE || va >= USER_TOP) return va;
+    uint64_t *pte = vm_walk(space->root, va, 0);
+    if (!pte || !(*pte & PTE_V)) return 0;
+    return PTE2PA(*pte) | (va & (PAGE_SIZE - 1));
+}
+
+// Describe a range of the address space; nothing is mapped until first touch.
+// The range must not overlap any region already there. A file-backed region
+// must be placed so that each of its pages covers exactly one page of the file.
+int vm_add_region(vm_space_t *space, uint64_t start, uint64_t end, int prot,
+                  uint32_t file_ino, uint64_t file_off, uint64_t file_size) {
+    if (space->nregions >= VM_MAX_REGIONS || start >= end ||
+        start < USER_BASE || end > USER_TOP ||
+        (file_ino && (start - file_off) % PAGE_SIZE) ||
+        vm_range_used(space, start, end)) {
+        return -1;
+    }
+    vm_region_t *r = &space->regions[space->nregions++];
+    r->start = start;
+    r->end = end;
+    r->prot = prot;
+    r->file_off = file_off;
+    r->file_size = file_size;
+    r->file_ino = file_ino;
+    return 0;
+}
+
+static vm_region_t *vm_find_region(vm_space_t *space, uint64_t va) {
+    for (int i = 0; i < space->nregions; i++) {
+        if (va >= space->regions[i].start && va < space->regions[i].end) {
+            return &space->regions[i];
+        }
+    }
+    return 0;
+}
+
+// A region overlapping [start, end) anywhere, not just at its ends, or 0
+static vm_region_t *vm_range_used(vm_space_t *space, uint64_t start, uint64_t end) {
+    for (int i = 0; i < space->nregions; i++) {
+        if (space->regions[i].start < end && space->regions[i].end > start) {
+            return &space->regions[i];
+        }
+    }
+    return 0;
+}
+
+// Copy the file-backed bytes of the page at 'page_va' into 'page'; the rest
+// is zero. The bytes come from the page cache, so a file that was compressed
+// or rewritten since still reads right. Returns -1 if the file is gone.
+static int vm_fill_page(vm_region_t *r, uint64_t page_va, char *page) {
+    memset(page, 0, PAGE_SIZE);
+    uint64_t lo = page_va > r->start ? page_va : r->start;
+    uint64_t hi = page_va + PAGE_SIZE;
+    if (hi > r->start + r->file_size) hi = r->start + r->file_size;
+    if (!r->file_ino || lo >= hi) return 0;
+
+    uint64_t off = r->file_off + (page_va - r->start);
+    uint64_t src = pcache_pin(r->file_ino, off / PAGE_SIZE);
+    if (!src) return -1;
+    memcpy(page + (lo - page_va), (const char *)src + (lo - page_va), hi - lo);
+    pcache_unpin(src);
+    return 0;
+}
+
+// Whether the page at 'page_va' can come straight from the page cache:
+// a read-only page that lines up with a file page, and is file data
+// throughout unless the region has no zero-filled tail at all.
+static int vm_page_cacheable(vm_region_t *r, uint64_t page_va) {
+    if (!r->file_ino || (r->prot & VM_WRITE)) return 0;
+    if ((r->file_off + page_va - r->start) % PAGE_SIZE) return 0;
+    return page_va + PAGE_SIZE <= r->start + r->file_size ||
+           r->file_size == r->end - r->start;
+}
+
+// Map the page containing 'va' of region 'r'
+static int vm_map_page(vm_space_t *space, vm_region_t *r, uint64_t va) {
+    uint64_t page_va = PAGE_ROUND_DOWN(va);
+    uint64_t *pte = vm_walk(space->root, page_va, 1);
+    if (!pte) return -1;
+    if (*pte & PTE_V) return -1;  // Already mapped: a real protection fault
+
+    uint64_t flags = PTE_V | PTE_U | PTE_A | PTE_D;
+    if (r->prot & VM_READ) flags |= PTE_R;
+    if (r->prot & VM_WRITE) flags |= PTE_W;
+    if (r->prot & VM_EXEC) flags |= PTE_X;
+
+    uint64_t pa;
+    if (vm_page_cacheable(r, page_va)) {
+        // Read-only file pages map the page cache directly, so every
+        // instance of a program and every reader share one copy
+        pa = pcache_pin(r->file_ino, (r->file_off + page_va - r->start) / PAGE_SIZE);
+        if (!pa) return -1;
+        flags |= PTE_SHARED;
+    } else {
+        void *page = kalloc();
+        if (!page) return -1;
+        if (vm_fill_page(r, page_va, page) < 0) {
+            kfree(page);
+            return -1;
+        }
+        pa = (uint64_t)page;
+    }
+
+    *pte = PA2PTE(pa) | flags;
+    asm volatile("sfence.vma %0" :: "r"(page_va) : "memory");
+    if (flags & PTE_X) asm volatile("fence.i" ::: "memory");
+    return 0;
+}
+
+// Give 'space' its own writable copy of a copy-on-write page.
+// The last space holding the page just takes it over.
+static int vm_cow_break(vm_space_t *space, uint64_t va) {
+    uint64_t page_va = PAGE_ROUND_DOWN(va);
+    uint64_t *pte = vm_walk(space->root, page_va, 0);
+    if (!pte || !(*pte & PTE_V) || !(*pte & PTE_COW)) return -1;
+
+    uint64_t pa = PTE2PA(*pte);
+    uint64_t flags = (*pte & PTE_FLAGS & ~PTE_COW) | PTE_W | PTE_D;
+    if (kpage_refs(pa) > 1) {
+        void *page = kalloc();
+        if (!page) return -1;
+        memcpy(page, (void *)pa, PAGE_SIZE);
+        kpage_put(pa);
+        pa = (uint64_t)page;
+    }
+    *pte = PA2PTE(pa) | flags;
+    asm volatile("sfence.vma %0" :: "r"(page_va) : "memory");
+    return 0;
+}
+
+// Demand paging: map the page behind a fault at 'va', or give the task its
+// own copy of a copy-on-write page it writes to.
+// Returns 0 if the access can be retried, -1 for a genuine fault.
+int vm_handle_fault(vm_space_t *space, uint64_t va, int is_write) {
+    // The kernel view is mapped by gigapage leaves, not tables to walk
+    if (!space || va < USER_BASE || va >= USER_TOP) return -1;
+    if (is_write) {
+        uint64_t *pte = vm_walk(space->root, va, 0);
+        if (pte && (*pte & PTE_V) && (*pte & PTE_COW)) return vm_cow_break(space, va);
+    }
+    vm_region_t *r = vm_find_region(space, va);
+    if (!r) return -1;
+    if (is_write && !(r->prot & VM_WRITE)) return -1;
+    return vm_map_page(space, r, va);
+}
+
+// satp value for running in 'space'; kernel tasks (space == 0) run unpaged
+uint64_t vm_satp(vm_space_t *space) {
+    if (!space) return 0;
+    return SATP_SV39 | ((uint64_t)space->root >> 12);
+}
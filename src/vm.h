@@ -0,0 +1,67 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+
+// Task address spaces use the second gigabyte of the Sv39 address space;
+// everything else is an identity mapping of the kernel view.
+#define USER_BASE 0x40000000UL
+#define USER_TOP 0x80000000UL
+// Stacks of loaded programs sit at the top of the user range. Traps are
+// taken on the task's kernel stack, so these fill in on first touch and
+// only the pages a program actually uses take memory.
+#define USER_STACK_TOP USER_TOP
+#define USER_STACK_PAGES 16
+
+// mmap'ed files are placed here, below the kernel data page (vdso.h) and
+// the channel window (chan.h)
+#define VM_MMAP_BASE 0x60000000UL
+#define VM_MMAP_TOP 0x6ffff000UL
+
+#define VM_MAX_REGIONS 16
+
+// Region protection flags
+#define VM_READ 0x1
+#define VM_WRITE 0x2
+#define VM_EXEC 0x4
+// Region holds a task stack; new thread stacks go below the lowest one
+#define VM_STACK 0x8
+// Region maps memory shared with other tasks: never copy-on-write
+#define VM_SHARED 0x10
+
+// A range of a task address space, filled in on first touch.
+// File-backed regions copy from the file's pages in the page cache, looked
+// up by inode number, so they never point into a buffer the file system may
+// free or replace; everything past file_size is zero. Read-only regions map
+// page-cache pages instead of copying where the file layout allows it.
+typedef struct {
+    uint64_t start;         // First virtual address
+    uint64_t end;           // One past the last virtual address
+    int prot;               // VM_READ | VM_WRITE | VM_EXEC
+    uint64_t file_off;      // Offset of 'start' within the file
+    uint64_t file_size;     // Bytes of the region backed by the file
+    uint32_t file_ino;      // Inode of the backing file, 0 for anonymous memory
+} vm_region_t;
+
+typedef struct vm_space {
+    uint64_t *root;         // Sv39 root page table
+    int refs;               // Tasks sharing this address space
+    int nregions;
+    vm_region_t regions[VM_MAX_REGIONS];
+} vm_space_t;
+
+vm_space_t *vm_space_create(void);
+vm_space_t *vm_space_fork(vm_space_t *parent);
+void vm_space_get(vm_space_t *space);
+void vm_space_put(vm_space_t *space);
+int vm_add_region(vm_space_t *space, uint64_t start, uint64_t end, int prot,
+                  uint32_t file_ino, uint64_t file_off, uint64_t file_size);
+uint64_t vm_thread_stack(vm_space_t *space, uint64_t top);
+uint64_t vm_map_file(vm_space_t *space, uint32_t ino, uint64_t len);
+int vm_map_shared(vm_space_t *space, uint64_t va, uint64_t pa, int npages, int prot);
+int vm_check_range(vm_space_t *space, uint64_t va, uint64_t len, int prot);
+uint64_t vm_translate(vm_space_t *space, uint64_t va);
+int vm_handle_fault(vm_space_t *space, uint64_t va, int is_write);
+uint64_t vm_satp(vm_space_t *space);
+
+#endif
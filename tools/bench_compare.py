@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+"""Compare 'make bench' results against a stored baseline.
+
+The benchmark kernel prints one line per result:
+
+    BENCH <name> <value> <unit>
+
+Units ending in '/s' are throughputs (higher is better); all other units
+are costs (lower is better). A result that is worse than the baseline by
+more than --threshold percent, or that is missing, fails the run. So does
+a missing or empty baseline, unless BENCH_ALLOW_NO_BASELINE=1 is set in the
+environment (e.g. to run the benchmarks before recording the first one).
+"""
+import argparse
+import os
+import sys
+
+
+def parse(path):
+    results, done = {}, False
+    with open(path, errors="replace") as f:
+        for line in f:
+            parts = line.strip().split()
+            if not parts or parts[0] != "BENCH":
+                continue
+            if parts[1:] == ["done"]:
+                done = True
+            elif len(parts) == 4:
+                results[parts[1]] = (int(parts[2]), parts[3])
+    return results, done
+
+
+def write_baseline(path, results):
+    with open(path, "w") as f:
+        for name, (value, unit) in sorted(results.items()):
+            f.write("BENCH %s %d %s\n" % (name, value, unit))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("output", help="console output of the benchmark kernel")
+    ap.add_argument("--baseline", default="tools/bench_baseline.txt")
+    ap.add_argument("--threshold", type=float, default=10.0,
+                    help="allowed regression in percent (default: 10)")
+    ap.add_argument("--update", action="store_true",
+                    help="store the results as the new baseline")
+    args = ap.parse_args()
+
+    results, done = parse(args.output)
+    if not done:
+        sys.exit("FAIL: benchmark kernel did not finish (no 'BENCH done' line)")
+
+    if args.update:
+        write_baseline(args.baseline, results)
+        print("baseline updated: %s (%d results)" % (args.baseline, len(results)))
+        return
+
+    try:
+        baseline, _ = parse(args.baseline)
+    except FileNotFoundError:
+        baseline = {}
+    if not baseline:
+        msg = ("no baseline results in %s, record them with --update "
+               "(make bench-baseline)" % args.baseline)
+        if os.environ.get("BENCH_ALLOW_NO_BASELINE") == "1":
+            print("SKIP: %s" % msg)
+            return
+        sys.exit("FAIL: %s" % msg)
+
+    failed = False
+    print("%-20s %12s %12s %8s" % ("benchmark", "baseline", "current", "change"))
+    for name, (base, unit) in sorted(baseline.items()):
+        if name not in results:
+            print("%-20s %12d %12s %8s  MISSING" % (name, base, "-", "-"))
+            failed = True
+            continue
+        cur = results[name][0]
+        change = 100.0 * (cur - base) / base if base else 0.0
+        worse = -change if unit.endswith("/s") else change
+        verdict = "REGRESSION" if worse > args.threshold else ""
+        failed |= bool(verdict)
+        print("%-20s %12d %12d %+7.1f%%  %s %s" % (name, base, cur, change, unit, verdict))
+
+    if failed:
+        sys.exit("FAIL: benchmark regression beyond %.1f%%" % args.threshold)
+    print("OK: no regressions beyond %.1f%%" % args.threshold)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+"""Print image sizes and benchmark results for several build profiles.
+
+Each argument is PROFILE=BUILDDIR. The report reads BUILDDIR/kernel.elf
+for section sizes and BUILDDIR/bench/output.txt for the 'BENCH' lines
+written by 'make bench-run', and prints one column per profile.
+"""
+import argparse
+import subprocess
+import sys
+
+sys.path.insert(0, __file__.rsplit("/", 1)[0])
+from bench_compare import parse  # noqa: E402
+
+
+def image_size(size_tool, elf):
+    out = subprocess.run([size_tool, elf], check=True,
+                         capture_output=True, text=True).stdout
+    text, data, bss = out.splitlines()[1].split()[:3]
+    return {"text": int(text), "data": int(data), "bss": int(bss)}
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("profiles", nargs="+", metavar="PROFILE=BUILDDIR")
+    ap.add_argument("--size", default="riscv64-unknown-elf-size")
+    args = ap.parse_args()
+
+    columns, rows, units = [], {}, {}
+    for spec in args.profiles:
+        profile, build = spec.split("=", 1)
+        columns.append(profile)
+        for name, value in image_size(args.size, build + "/kernel.elf").items():
+            rows.setdefault("size_" + name, {})[profile] = value
+            units["size_" + name] = "bytes"
+        results, done = parse(build + "/bench/output.txt")
+        if not done:
+            print("warning: %s benchmark run did not finish" % profile, file=sys.stderr)
+        for name, (value, unit) in results.items():
+            rows.setdefault(name, {})[profile] = value
+            units[name] = unit
+
+    print("%-20s" % "metric" + "".join("%14s" % c for c in columns) + "  unit")
+    for name in rows:
+        cells = "".join("%14s" % rows[name].get(c, "-") for c in columns)
+        print("%-20s%s  %s" % (name, cells, units[name]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,340 @@
+/*
+ * Host-native throughput benchmarks for src/fs.c, src/lz4.c and src/string.c.
+ *
+ * Built by 'make host-bench' with the host compiler. The kernel's string
+ * functions are renamed to k* on the command line so they don't collide
+ * with the host libc, which this driver still uses for stdio and timing.
+ *
+ * Each benchmark runs in growing batches until it has run for at least
+ * BENCH_MIN_NS, then reports the per-operation cost in the same
+ * 'BENCH <name> <value> <unit>' format as the QEMU benchmark kernel. The
+ * results are only reported, not checked against a baseline: absolute
+ * numbers from the host say more about its CPU than about the code, so
+ * compare runs on one machine, e.g. against host_memcpy_4k. The parallel
+ * read benchmarks run the file system from several threads at once, the
+ * way tasks on several harts would. The kernel stubs and the initramfs
+ * it starts with are in tools/host_stubs.c.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "fs.h"
+#include "pcache.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* Kernel string functions under their host names (see HOST_KCFLAGS). */
+void *kmemcpy(void *dst, const void *src, uint64_t n);
+void *kmemset(void *dst, int c, uint64_t n);
+
+#define BENCH_MIN_NS 200000000ULL
+#define BUF_SIZE MAX_FILE_SIZE
+#define PAR_MAX_THREADS 4
+
+static char src_buf[BUF_SIZE];
+static char dst_buf[BUF_SIZE];
+static int bench_fd;
+static uint32_t bench_ino;
+static int pipe_fds[2];
+
+/* Compressed files are filled with ZFILE_SIZE bytes of each kind of content. */
+#define ZFILE_SIZE (4 * FS_ZBLOCK_SIZE)
+static char zdata[ZFILE_SIZE];
+static char zread_buf[ZFILE_SIZE];
+static int zfd;
+static uint32_t zino;
+static uint32_t rng = 12345;
+
+static uint32_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* English-like text: words from a small vocabulary. */
+static void fill_text(char *p, int n) {
+    static const char *const words[] = {
+        "the", "file", "page", "cache", "of", "a", "kernel", "task", "and",
+        "reads", "block", "to", "is", "in", "scheduler", "memory", "write",
+    };
+    int i = 0;
+    while (i < n) {
+        const char *w = words[next_rand() % (sizeof(words) / sizeof(words[0]))];
+        while (*w && i < n) p[i++] = *w++;
+        if (i < n) p[i++] = next_rand() % 12 ? ' ' : '\n';
+    }
+}
+
+/* Machine code: instructions on a handful of registers with small offsets,
+ * mostly in recurring sequences (prologues, loads and stores, branches). */
+static uint32_t random_insn(void) {
+    static const uint32_t ops[] = {0x13, 0x33, 0x03, 0x23, 0x63, 0x6f, 0x67, 0x1b};
+    static const uint32_t regs[] = {1, 2, 8, 10, 11, 12, 14, 15};
+    uint32_t r = next_rand();
+    return ops[r % 8] | regs[(r >> 3) % 8] << 7 | regs[(r >> 6) % 8] << 15 |
+           ((r >> 9) % 16) * 8 << 20;
+}
+
+static void fill_code(char *p, int n) {
+    uint32_t snippets[32][4];
+    for (int s = 0; s < 32; s++)
+        for (int k = 0; k < 4; k++) snippets[s][k] = random_insn();
+    int i = 0;
+    while (i + 16 <= n) {
+        if (next_rand() % 4) {
+            kmemcpy(p + i, snippets[next_rand() % 32], 16);
+            i += 16;
+        } else {
+            uint32_t insn = random_insn();
+            kmemcpy(p + i, &insn, 4);
+            i += 4;
+        }
+    }
+    kmemset(p + i, 0, n - i);
+}
+
+static void fill_zeros(char *p, int n) {
+    kmemset(p, 0, n);
+}
+
+static void fill_random(char *p, int n) {
+    for (int i = 0; i < n; i++) p[i] = next_rand() >> 24;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void op_open_close(void) {
+    fs_close(fs_open("hello", FD_READ));
+}
+
+/* Worst case for the linear name lookup: the file in the last slot. */
+static void op_open_last(void) {
+    fs_close(fs_open("file15", FD_READ));
+}
+
+static void op_create_delete(void) {
+    fs_create("scratch");
+    fs_delete("scratch");
+}
+
+static void op_write_4k(void) {
+    fs_seek(bench_fd, 0);
+    fs_write(bench_fd, src_buf, BUF_SIZE);
+}
+
+static void op_read_4k(void) {
+    fs_seek(bench_fd, 0);
+    fs_read(bench_fd, dst_buf, BUF_SIZE);
+}
+
+static void op_read_64(void) {
+    fs_seek(bench_fd, 0);
+    fs_read(bench_fd, dst_buf, 64);
+}
+
+/* Handoff through a pipe: what a producer/consumer pair pays per message. */
+static void op_pipe_512(void) {
+    fs_write(pipe_fds[1], src_buf, 512);
+    fs_read(pipe_fds[0], dst_buf, 512);
+}
+
+/* A cold read: the page has to be filled from the file again. */
+static void op_read_4k_cold(void) {
+    pcache_invalidate(bench_ino);
+    op_read_4k();
+}
+
+/* Reads of a whole compressed file with an empty cache, so every block
+ * is decompressed, and with every block already cached. */
+static void op_zread_cold(void) {
+    pcache_invalidate(zino);
+    fs_seek(zfd, 0);
+    fs_read(zfd, zread_buf, ZFILE_SIZE);
+}
+
+static void op_zread_cached(void) {
+    fs_seek(zfd, 0);
+    fs_read(zfd, zread_buf, ZFILE_SIZE);
+}
+
+static void op_memcpy_4k(void) {
+    kmemcpy(dst_buf, src_buf, BUF_SIZE);
+}
+
+static void op_memset_4k(void) {
+    kmemset(dst_buf, 0, BUF_SIZE);
+}
+
+/*
+ * Runs 'op' until BENCH_MIN_NS have passed, doubling the batch size each
+ * round, and prints ns/op or, when 'bytes' is set, MiB/s.
+ */
+static void run(const char *name, void (*op)(void), uint64_t bytes) {
+    uint64_t iters = 1, elapsed = 0;
+    while (1) {
+        uint64_t start = now_ns();
+        for (uint64_t i = 0; i < iters; i++) op();
+        elapsed = now_ns() - start;
+        if (elapsed >= BENCH_MIN_NS) break;
+        iters *= 2;
+    }
+    if (bytes)
+        printf("BENCH %s %llu MiB/s\n", name,
+               (unsigned long long)(bytes * iters * 1000000000ULL / elapsed / (1024 * 1024)));
+    else
+        printf("BENCH %s %llu ns\n", name, (unsigned long long)(elapsed / iters));
+}
+
+/* A thread of the parallel read benchmark: 4KiB reads of 'file' through a
+ * descriptor of its own until told to stop. */
+typedef struct {
+    const char *file;
+    uint64_t reads;
+    char buf[BUF_SIZE];
+} par_reader_t;
+
+static par_reader_t par_readers[PAR_MAX_THREADS];
+static int par_stop;
+
+static void *par_reader(void *arg) {
+    par_reader_t *r = arg;
+    int fd = fs_open(r->file, FD_READ);
+    while (!__atomic_load_n(&par_stop, __ATOMIC_RELAXED)) {
+        fs_seek(fd, 0);
+        fs_read(fd, r->buf, BUF_SIZE);
+        r->reads++;
+    }
+    fs_close(fd);
+    return NULL;
+}
+
+/*
+ * Aggregate read throughput of 'nthreads' threads for BENCH_MIN_NS, all on
+ * "bench" when 'same' is set, else each on a file of its own.
+ */
+static void run_parallel(const char *name, int nthreads, int same) {
+    static const char *const files[PAR_MAX_THREADS] = {"bench", "file2", "file3", "file4"};
+    pthread_t threads[PAR_MAX_THREADS];
+    struct timespec wait = {0, BENCH_MIN_NS};
+
+    __atomic_store_n(&par_stop, 0, __ATOMIC_RELAXED);
+    uint64_t start = now_ns();
+    for (int i = 0; i < nthreads; i++) {
+        par_readers[i].file = same ? files[0] : files[i];
+        par_readers[i].reads = 0;
+        pthread_create(&threads[i], NULL, par_reader, &par_readers[i]);
+    }
+    nanosleep(&wait, NULL);
+    __atomic_store_n(&par_stop, 1, __ATOMIC_RELAXED);
+    uint64_t reads = 0;
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(threads[i], NULL);
+        reads += par_readers[i].reads;
+    }
+    uint64_t elapsed = now_ns() - start;
+    printf("BENCH %s %llu MiB/s\n", name,
+           (unsigned long long)(reads * BUF_SIZE * 1000000000ULL / elapsed / (1024 * 1024)));
+}
+
+static void bench_parallel(void) {
+    char name[64];
+    for (int i = 1; i < PAR_MAX_THREADS; i++) {
+        snprintf(name, sizeof(name), "file%d", i + 1);
+        int fd = fs_open(name, FD_WRITE);
+        fs_write(fd, src_buf, BUF_SIZE);
+        fs_close(fd);
+    }
+    for (int n = 1; n <= PAR_MAX_THREADS; n *= 2) {
+        snprintf(name, sizeof(name), "host_fs_read_4k_same_%dt", n);
+        run_parallel(name, n, 1);
+        if (n == 1) continue;  /* Same as the one above */
+        snprintf(name, sizeof(name), "host_fs_read_4k_diff_%dt", n);
+        run_parallel(name, n, 0);
+    }
+}
+
+/*
+ * Compression ratio (as the percentage of the original size that is stored)
+ * and read throughput, cold and cached, for a compressed file of each type.
+ */
+static void bench_compressed(void) {
+    static const struct {
+        const char *type;
+        void (*fill)(char *p, int n);
+    } types[] = {
+        {"text", fill_text},
+        {"code", fill_code},
+        {"zeros", fill_zeros},
+        {"random", fill_random},
+    };
+    char name[64];
+    for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+        types[t].fill(zdata, ZFILE_SIZE);
+        fs_create("zfile");
+        fs_compress("zfile", 1);
+        zfd = fs_open("zfile", FD_READ | FD_WRITE);
+        fs_write(zfd, zdata, ZFILE_SIZE);
+        fs_fd_inode(zfd, &zino);
+
+        fs_zinfo_t z;
+        fs_compress_info("zfile", &z);
+        printf("BENCH host_lz4_stored_%s %d %%\n", types[t].type,
+               z.stored * 100 / z.size);
+        snprintf(name, sizeof(name), "host_lz4_read_cold_%s", types[t].type);
+        run(name, op_zread_cold, ZFILE_SIZE);
+        snprintf(name, sizeof(name), "host_lz4_read_cached_%s", types[t].type);
+        run(name, op_zread_cached, ZFILE_SIZE);
+
+        fs_close(zfd);
+        fs_delete("zfile");
+    }
+}
+
+int main(void) {
+    char name[MAX_FILENAME_LEN];
+
+    fs_init();
+    /* Fill the remaining slots so lookups walk a full table. */
+    for (int i = 2; i < MAX_FILES - 1; i++) {
+        snprintf(name, sizeof(name), "file%d", i);
+        fs_create(name);
+    }
+    fs_create("file15");
+    kmemset(src_buf, 'x', BUF_SIZE);
+
+    run("host_fs_open_close", op_open_close, 0);
+    run("host_fs_open_last", op_open_last, 0);
+
+    fs_delete("file14"); /* Make room for the create/delete and I/O files. */
+    fs_delete("file13");
+    run("host_fs_create_delete", op_create_delete, 0);
+
+    fs_create("bench");
+    bench_fd = fs_open("bench", FD_READ | FD_WRITE);
+    run("host_fs_write_4k", op_write_4k, BUF_SIZE);
+    run("host_fs_read_4k", op_read_4k, BUF_SIZE);
+    run("host_fs_read_64", op_read_64, 0);
+    fs_fd_inode(bench_fd, &bench_ino);
+    run("host_fs_read_4k_cold", op_read_4k_cold, BUF_SIZE);
+    bench_parallel();
+    fs_close(bench_fd);
+    fs_delete("bench");
+
+    bench_compressed();
+
+    fs_pipe(pipe_fds);
+    run("host_pipe_512", op_pipe_512, 512);
+    fs_close(pipe_fds[0]);
+    fs_close(pipe_fds[1]);
+
+    run("host_memcpy_4k", op_memcpy_4k, BUF_SIZE);
+    run("host_memset_4k", op_memset_4k, BUF_SIZE);
+
+    printf("BENCH done\n");
+    return 0;
+}
@@ -0,0 +1,379 @@
+/*
+ * libFuzzer entry point for src/fs.c: each input is a sequence of create,
+ * delete, open, close, read, write, seek, compress and pipe calls, checked
+ * against a simple model of what every call must return and what every
+ * read must see.
+ *
+ * 'make host-fuzz' builds it with clang's libFuzzer and AddressSanitizer.
+ * Built with -DFUZZ_STANDALONE instead, it has its own main that runs the
+ * files named on the command line, or a number of random inputs, which
+ * 'make host-test' does with the host compiler.
+ */
+#include "fs.h"
+#include "pcache.h"
+#include "pipe.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NAMES 4
+#define FUZZ_MAX_WRITE 5000
+#define ZFILE_MAX (FS_ZMAX_BLOCKS * FS_ZBLOCK_SIZE)
+
+/* Kernel string functions under their host names (see HOST_KCFLAGS). */
+void *kmemcpy(void *dst, const void *src, uint64_t n);
+
+static const char *const names[NAMES] = {"a", "b", "c", "d"};
+
+/* What the file system should hold */
+static struct {
+    int exists;
+    int compressed;
+    int size;
+    char data[ZFILE_MAX];
+} files[NAMES];
+
+/* Open descriptors, by fd - 3 */
+static struct {
+    int open;
+    int file;       /* Index into files[], or -1 for a pipe end */
+    int flags;
+    int pos;
+    int pipe;       /* Index into pipes[] for a pipe end */
+} fds[MAX_OPEN_FDS];
+
+static struct {
+    int readers, writers;
+    int used;       /* Bytes in the pipe */
+    char data[PIPE_SIZE];
+} pipes[MAX_PIPES];
+
+static char buf[ZFILE_MAX];
+static char src[FUZZ_MAX_WRITE];
+
+/* The input, consumed a byte at a time; zeros once it runs out */
+static const uint8_t *in;
+static size_t in_left;
+static int op_index;
+
+static unsigned next8(void) {
+    if (!in_left) return 0;
+    in_left--;
+    return *in++;
+}
+
+static unsigned next16(void) {
+    unsigned lo = next8();
+    return lo | next8() << 8;
+}
+
+#define EXPECT(cond)                                                         \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "op %d: %s:%d: expected %s\n", op_index,         \
+                    __FILE__, __LINE__, #cond);                              \
+            abort();                                                         \
+        }                                                                    \
+    } while (0)
+
+static int count_open(void) {
+    int n = 0;
+    for (int i = 0; i < MAX_OPEN_FDS; i++) n += fds[i].open;
+    return n;
+}
+
+static int free_pipe(void) {
+    for (int i = 0; i < MAX_PIPES; i++) {
+        if (!pipes[i].readers && !pipes[i].writers) return i;
+    }
+    return -1;
+}
+
+static void model_close(int slot) {
+    if (fds[slot].file < 0) {
+        if (fds[slot].flags & FD_WRITE) pipes[fds[slot].pipe].writers--;
+        else pipes[fds[slot].pipe].readers--;
+    }
+    fds[slot].open = 0;
+}
+
+/* Descriptor picked by the input: one of the table's, or one just outside */
+static int pick_fd(void) {
+    return 2 + next8() % (MAX_OPEN_FDS + 2);
+}
+
+static int fd_slot(int fd) {
+    return fd >= 3 && fd < 3 + MAX_OPEN_FDS && fds[fd - 3].open ? fd - 3 : -1;
+}
+
+static void do_create(void) {
+    int k = next8() % NAMES;
+    int r = fs_create(names[k]);
+    EXPECT(r == (files[k].exists ? -1 : 0));
+    if (r == 0) {
+        files[k].exists = 1;
+        files[k].compressed = 0;
+        files[k].size = 0;
+    }
+}
+
+static void do_delete(void) {
+    int k = next8() % NAMES;
+    EXPECT(fs_delete(names[k]) == (files[k].exists ? 0 : -1));
+    if (!files[k].exists) return;
+    files[k].exists = 0;
+    for (int i = 0; i < MAX_OPEN_FDS; i++) {
+        if (fds[i].open && fds[i].file == k) fds[i].open = 0;
+    }
+}
+
+static void do_open(void) {
+    int k = next8() % NAMES;
+    int flags = 1 + next8() % 3;
+    int fd = fs_open(names[k], flags);
+    if (!files[k].exists || count_open() == MAX_OPEN_FDS) {
+        EXPECT(fd == -1);
+        return;
+    }
+    EXPECT(fd >= 3 && fd < 3 + MAX_OPEN_FDS && !fds[fd - 3].open);
+    fds[fd - 3].open = 1;
+    fds[fd - 3].file = k;
+    fds[fd - 3].flags = flags;
+    fds[fd - 3].pos = 0;
+}
+
+static void do_close(void) {
+    int fd = pick_fd();
+    int slot = fd_slot(fd);
+    EXPECT(fs_close(fd) == (slot < 0 ? -1 : 0));
+    if (slot >= 0) model_close(slot);
+}
+
+static void do_read(void) {
+    int fd = pick_fd();
+    int slot = fd_slot(fd);
+    int len = next16() % (ZFILE_MAX + 2);
+    if (slot < 0 || !(fds[slot].flags & FD_READ)) {
+        EXPECT(fs_read(fd, buf, len) == -1);
+        return;
+    }
+    if (fds[slot].file < 0) {
+        int p = fds[slot].pipe;
+        if (len == 0) {
+            EXPECT(fs_read(fd, buf, len) == -1);
+            return;
+        }
+        if (!pipes[p].used && pipes[p].writers) return;  /* Would block */
+        int n = len < pipes[p].used ? len : pipes[p].used;
+        EXPECT(fs_read(fd, buf, len) == n);
+        for (int i = 0; i < n; i++) EXPECT(buf[i] == pipes[p].data[i]);
+        pipes[p].used -= n;
+        for (int i = 0; i < pipes[p].used; i++) pipes[p].data[i] = pipes[p].data[i + n];
+        return;
+    }
+
+    int k = fds[slot].file;
+    int n = files[k].size - fds[slot].pos;
+    if (n > len) n = len;
+    if (n < 0) n = 0;
+    int r = fs_read(fd, buf, len);
+    if (len == 0) {
+        EXPECT(r == -1);
+        return;
+    }
+    EXPECT(r == n);
+    for (int i = 0; i < n; i++) EXPECT(buf[i] == files[k].data[fds[slot].pos + i]);
+    fds[slot].pos += n;
+}
+
+static void do_write(void) {
+    int fd = pick_fd();
+    int slot = fd_slot(fd);
+    int len = next16() % (FUZZ_MAX_WRITE + 1);
+    unsigned seed = next8();
+    for (int i = 0; i < len; i++) src[i] = (char)(seed + ((i * 7) ^ (i >> 5)) * (seed & 3));
+    if (slot < 0 || !(fds[slot].flags & FD_WRITE) || len == 0) {
+        EXPECT(fs_write(fd, src, len) == -1);
+        return;
+    }
+    if (fds[slot].file < 0) {
+        int p = fds[slot].pipe;
+        if (!pipes[p].readers) {
+            EXPECT(fs_write(fd, src, len) == -1);
+            return;
+        }
+        if (len > PIPE_SIZE - pipes[p].used) return;  /* Would block */
+        EXPECT(fs_write(fd, src, len) == len);
+        kmemcpy(pipes[p].data + pipes[p].used, src, len);
+        pipes[p].used += len;
+        return;
+    }
+
+    int k = fds[slot].file;
+    int pos = fds[slot].pos;
+    int room = (files[k].compressed ? ZFILE_MAX : MAX_FILE_SIZE) - pos;
+    int n = len < room ? len : room;
+    int r = fs_write(fd, src, len);
+    if (n <= 0) {
+        EXPECT(r == -1);
+        return;
+    }
+    /* A full compressed store can cut a write short */
+    EXPECT(files[k].compressed ? r == -1 || (r > 0 && r <= n) : r == n);
+    if (r < 0) return;
+    kmemcpy(files[k].data + pos, src, r);
+    if (pos + r > files[k].size) files[k].size = pos + r;
+    fds[slot].pos += r;
+}
+
+static void do_seek(void) {
+    int fd = pick_fd();
+    int slot = fd_slot(fd);
+    int off = (int16_t)next16();
+    int r = fs_seek(fd, off);
+    if (slot < 0 || fds[slot].file < 0) {
+        EXPECT(r == -1);
+        return;
+    }
+    int size = files[fds[slot].file].size;
+    int want = off < 0 ? 0 : off > size ? size : off;
+    EXPECT(r == want);
+    fds[slot].pos = want;
+}
+
+static void do_compress(void) {
+    int k = next8() % NAMES;
+    int on = next8() & 1;
+    int r = fs_compress(names[k], on);
+    if (!files[k].exists) {
+        EXPECT(r == -1);
+    } else if (!on == !files[k].compressed) {
+        EXPECT(r == 0);
+    } else if (!on && files[k].size > MAX_FILE_SIZE) {
+        EXPECT(r == -1);
+    } else {
+        /* Compressing can run out of store; going back can't fail */
+        EXPECT(on ? r == 0 || r == -1 : r == 0);
+        if (r == 0) files[k].compressed = on;
+    }
+}
+
+static void do_pipe(void) {
+    int p = free_pipe();
+    int k[2];
+    int r = fs_pipe(k);
+    if (p < 0 || count_open() > MAX_OPEN_FDS - 2) {
+        EXPECT(r == -1);
+        return;
+    }
+    EXPECT(r == 0);
+    for (int end = 0; end < 2; end++) {
+        EXPECT(k[end] >= 3 && k[end] < 3 + MAX_OPEN_FDS && !fds[k[end] - 3].open);
+        fds[k[end] - 3].open = 1;
+        fds[k[end] - 3].file = -1;
+        fds[k[end] - 3].flags = end ? FD_WRITE : FD_READ;
+        fds[k[end] - 3].pipe = p;
+    }
+    pipes[p].readers = pipes[p].writers = 1;
+    pipes[p].used = 0;
+}
+
+/* Drop the file's cached pages, so the next reads fill them again */
+static void do_drop_cache(void) {
+    int k = next8() % NAMES;
+    uint32_t ino = fs_get_inode(names[k]);
+    EXPECT(!ino == !files[k].exists);
+    if (ino) pcache_invalidate(ino);
+}
+
+/* Every file reads back whole through a fresh descriptor, once the
+ * input's own are closed */
+static void check_files(void) {
+    for (int i = 0; i < MAX_OPEN_FDS; i++) {
+        if (fds[i].open) EXPECT(fs_close(i + 3) == 0);
+    }
+    for (int k = 0; k < NAMES; k++) {
+        EXPECT(fs_get_file_size(names[k]) == (files[k].exists ? files[k].size : -1));
+        if (!files[k].exists) continue;
+        int fd = fs_open(names[k], FD_READ);
+        EXPECT(fd >= 3);
+        int total = 0, n;
+        while ((n = fs_read(fd, buf + total, ZFILE_MAX - total)) > 0) total += n;
+        EXPECT(n == 0 && total == files[k].size);
+        for (int i = 0; i < total; i++) EXPECT(buf[i] == files[k].data[i]);
+        EXPECT(fs_close(fd) == 0);
+    }
+}
+
+/* Start every input from an empty file system */
+static void reset(void) {
+    static int ready;
+    if (!ready) {
+        fs_init();
+        ready = 1;
+    }
+    for (int fd = 3; fd < 3 + MAX_OPEN_FDS; fd++) fs_close(fd);
+    for (int i = 0; i < MAX_FILES; i++) {
+        char name[MAX_FILENAME_LEN];
+        const char *n = fs_file_name(i);
+        if (!n) continue;
+        snprintf(name, sizeof(name), "%s", n);
+        fs_delete(name);
+    }
+    EXPECT(fs_zstore_used() == 0);
+    for (int k = 0; k < NAMES; k++) files[k].exists = 0;
+    for (int i = 0; i < MAX_OPEN_FDS; i++) fds[i].open = 0;
+    for (int i = 0; i < MAX_PIPES; i++) pipes[i].readers = pipes[i].writers = 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    static void (*const ops[])(void) = {
+        do_create, do_delete, do_open, do_close, do_read, do_write,
+        do_seek, do_compress, do_pipe, do_drop_cache,
+    };
+    reset();
+    in = data;
+    in_left = size;
+    for (op_index = 0; in_left; op_index++) ops[next8() % (sizeof(ops) / sizeof(ops[0]))]();
+    check_files();
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static uint8_t input[4096];
+
+int main(int argc, char **argv) {
+    /* Replay the inputs named on the command line */
+    if (argc > 1 && argv[1][0] != '-') {
+        for (int i = 1; i < argc; i++) {
+            FILE *f = fopen(argv[i], "rb");
+            if (!f) {
+                perror(argv[i]);
+                return 1;
+            }
+            size_t n = fread(input, 1, sizeof(input), f);
+            fclose(f);
+            LLVMFuzzerTestOneInput(input, n);
+        }
+        printf("fuzz: %d inputs replayed\n", argc - 1);
+        return 0;
+    }
+
+    /* Or run random ones: fs_fuzz -<count> */
+    int runs = argc > 1 ? atoi(argv[1] + 1) : 2000;
+    uint32_t rng = 88172645u;
+    for (int r = 0; r < runs; r++) {
+        size_t n = 1 + r % sizeof(input);
+        for (size_t i = 0; i < n; i++) {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            input[i] = (uint8_t)rng;
+        }
+        LLVMFuzzerTestOneInput(input, n);
+    }
+    printf("fuzz: %d random inputs passed\n", runs);
+    return 0;
+}
+#endif
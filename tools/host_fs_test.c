@@ -0,0 +1,395 @@
+/*
+ * Host-native tests of the file system semantics in src/fs.c, src/pipe.c
+ * and src/lz4.c: end of file, capacity limits, seek clamping, delete and
+ * reuse of names and slots, pipe EOF, and LZ4 round-trips at block edges.
+ *
+ * Built and run by 'make host-test' together with the kernel stubs in
+ * tools/host_stubs.c. Every failed check prints its line and the run
+ * exits non-zero.
+ */
+#include "fs.h"
+#include "lz4.h"
+#include "pcache.h"
+#include "pipe.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/* Kernel string functions under their host names (see HOST_KCFLAGS). */
+void *kmemcpy(void *dst, const void *src, uint64_t n);
+void *kmemset(void *dst, int c, uint64_t n);
+
+static int failures;
+static int checks;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        checks++;                                                            \
+        if (!(cond)) {                                                       \
+            failures++;                                                      \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);           \
+        }                                                                    \
+    } while (0)
+
+#define ZFILE_MAX (FS_ZMAX_BLOCKS * FS_ZBLOCK_SIZE)
+
+static char buf[ZFILE_MAX + FS_ZBLOCK_SIZE];
+static char model[ZFILE_MAX];
+static uint32_t rng = 2463534242u;
+
+static uint32_t next_rand(void) {
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* Compressible text with a pattern that changes every few hundred bytes */
+static void fill_text(char *p, int n, int seed) {
+    static const char words[] = "the page cache fills blocks on demand ";
+    for (int i = 0; i < n; i++) p[i] = words[(i + seed + i / 300) % (sizeof(words) - 1)];
+}
+
+static void fill_random(char *p, int n) {
+    for (int i = 0; i < n; i++) p[i] = (char)next_rand();
+}
+
+static int same(const char *a, const char *b, int n) {
+    for (int i = 0; i < n; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+/* Read all of 'fd' from the start into 'out'; returns the bytes read */
+static int read_all(int fd, char *out, int cap) {
+    int total = 0, n;
+    fs_seek(fd, 0);
+    while (total < cap && (n = fs_read(fd, out + total, cap - total)) > 0) total += n;
+    return total;
+}
+
+static void test_eof(void) {
+    CHECK(fs_create("eof") == 0);
+    int fd = fs_open("eof", FD_READ | FD_WRITE);
+    CHECK(fd >= 3);
+    fill_text(model, 100, 0);
+    CHECK(fs_write(fd, model, 100) == 100);
+    CHECK(fs_seek(fd, 0) == 0);
+    CHECK(fs_read(fd, buf, 200) == 100);
+    CHECK(same(buf, model, 100));
+    CHECK(fs_read(fd, buf, 200) == 0);
+    CHECK(fs_read(fd, buf, 1) == 0);
+
+    /* A read that ends exactly at the end, then EOF */
+    CHECK(fs_seek(fd, 60) == 60);
+    CHECK(fs_read(fd, buf, 40) == 40);
+    CHECK(same(buf, model + 60, 40));
+    CHECK(fs_read(fd, buf, 40) == 0);
+
+    /* An empty file is at EOF right away */
+    CHECK(fs_create("empty") == 0);
+    int efd = fs_open("empty", FD_READ);
+    CHECK(fs_read(efd, buf, 10) == 0);
+    CHECK(fs_close(efd) == 0);
+    CHECK(fs_delete("empty") == 0);
+
+    CHECK(fs_close(fd) == 0);
+    CHECK(fs_read(fd, buf, 10) == -1);
+    CHECK(fs_close(fd) == -1);
+    CHECK(fs_delete("eof") == 0);
+}
+
+static void test_capacity(void) {
+    CHECK(fs_create("cap") == 0);
+    int fd = fs_open("cap", FD_READ | FD_WRITE);
+    fill_random(model, MAX_FILE_SIZE);
+    CHECK(fs_write(fd, model, MAX_FILE_SIZE) == MAX_FILE_SIZE);
+    CHECK(fs_get_file_size("cap") == MAX_FILE_SIZE);
+    CHECK(fs_write(fd, model, 1) == -1);  /* Full */
+
+    /* A write running past the end comes up short */
+    CHECK(fs_seek(fd, MAX_FILE_SIZE - 96) == MAX_FILE_SIZE - 96);
+    CHECK(fs_write(fd, model, 200) == 96);
+    kmemcpy(model + MAX_FILE_SIZE - 96, model, 96);
+    CHECK(read_all(fd, buf, sizeof(buf)) == MAX_FILE_SIZE);
+    CHECK(same(buf, model, MAX_FILE_SIZE));
+
+    /* Access modes */
+    int ro = fs_open("cap", FD_READ);
+    int wo = fs_open("cap", FD_WRITE);
+    CHECK(fs_write(ro, model, 1) == -1);
+    CHECK(fs_read(wo, buf, 1) == -1);
+    CHECK(fs_read(fd, 0, 1) == -1);
+    CHECK(fs_read(fd, buf, 0) == -1);
+    fs_close(ro);
+    fs_close(wo);
+
+    /* Descriptors run out at MAX_OPEN_FDS */
+    int fds[MAX_OPEN_FDS + 1], n = 0;
+    while (n <= MAX_OPEN_FDS && (fds[n] = fs_open("cap", FD_READ)) >= 0) n++;
+    CHECK(n == MAX_OPEN_FDS - 1);  /* 'fd' holds one */
+    while (n > 0) CHECK(fs_close(fds[--n]) == 0);
+
+    /* And file slots at MAX_FILES */
+    char name[MAX_FILENAME_LEN];
+    int created = 0;
+    for (int i = 0; i <= MAX_FILES; i++) {
+        snprintf(name, sizeof(name), "slot%d", i);
+        if (fs_create(name) == 0) created++;
+    }
+    CHECK(created < MAX_FILES && created > 0);
+    CHECK(fs_create("one_too_many") == -1);
+    for (int i = 0; i < created; i++) {
+        snprintf(name, sizeof(name), "slot%d", i);
+        CHECK(fs_delete(name) == 0);
+    }
+
+    /* Names must fit, with their terminator */
+    char longname[MAX_FILENAME_LEN + 1];
+    kmemset(longname, 'n', MAX_FILENAME_LEN);
+    longname[MAX_FILENAME_LEN] = 0;
+    CHECK(fs_create(longname) == -1);
+    longname[MAX_FILENAME_LEN - 1] = 0;
+    CHECK(fs_create(longname) == 0);
+    CHECK(fs_get_file_size(longname) == 0);
+    CHECK(fs_delete(longname) == 0);
+    CHECK(fs_create("") == -1);
+    CHECK(fs_create("cap") == -1);  /* Exists */
+
+    fs_close(fd);
+    CHECK(fs_delete("cap") == 0);
+}
+
+static void test_seek(void) {
+    CHECK(fs_create("seek") == 0);
+    int fd = fs_open("seek", FD_READ | FD_WRITE);
+    CHECK(fs_seek(fd, 10) == 0);  /* Clamped to the empty file */
+    fill_text(model, 1000, 1);
+    CHECK(fs_write(fd, model, 1000) == 1000);
+    CHECK(fs_seek(fd, -5) == 0);
+    CHECK(fs_seek(fd, 1000) == 1000);
+    CHECK(fs_seek(fd, 1001) == 1000);
+    CHECK(fs_seek(fd, 0x7fffffff) == 1000);
+    CHECK(fs_read(fd, buf, 10) == 0);
+    CHECK(fs_seek(fd, 999) == 999);
+    CHECK(fs_read(fd, buf, 10) == 1);
+    CHECK(buf[0] == model[999]);
+
+    /* Overwriting in the middle keeps the size */
+    CHECK(fs_seek(fd, 500) == 500);
+    CHECK(fs_write(fd, "XY", 2) == 2);
+    CHECK(fs_get_file_size("seek") == 1000);
+    model[500] = 'X';
+    model[501] = 'Y';
+    CHECK(read_all(fd, buf, sizeof(buf)) == 1000);
+    CHECK(same(buf, model, 1000));
+
+    CHECK(fs_seek(2, 0) == -1);
+    CHECK(fs_seek(3 + MAX_OPEN_FDS, 0) == -1);
+    fs_close(fd);
+    CHECK(fs_seek(fd, 0) == -1);
+    CHECK(fs_delete("seek") == 0);
+}
+
+static void test_delete_reuse(void) {
+    CHECK(fs_create("reuse") == 0);
+    int fd = fs_open("reuse", FD_READ | FD_WRITE);
+    fill_random(model, 3000);
+    CHECK(fs_write(fd, model, 3000) == 3000);
+    CHECK(read_all(fd, buf, sizeof(buf)) == 3000);  /* Now cached */
+    uint32_t ino = fs_get_inode("reuse");
+    CHECK(ino != 0);
+
+    /* Deleting closes its descriptors and forgets the name */
+    CHECK(fs_delete("reuse") == 0);
+    CHECK(fs_read(fd, buf, 10) == -1);
+    CHECK(fs_write(fd, model, 10) == -1);
+    CHECK(fs_close(fd) == -1);
+    CHECK(fs_get_inode("reuse") == 0);
+    CHECK(fs_get_file_size("reuse") == -1);
+    CHECK(fs_open("reuse", FD_READ) == -1);
+    CHECK(fs_delete("reuse") == -1);
+
+    /* The same name comes back empty, under a new inode, with none of the
+     * old cached pages */
+    CHECK(fs_create("reuse") == 0);
+    CHECK(fs_get_inode("reuse") != ino);
+    fd = fs_open("reuse", FD_READ | FD_WRITE);
+    CHECK(fs_get_file_size("reuse") == 0);
+    CHECK(fs_read(fd, buf, 10) == 0);
+    CHECK(fs_write(fd, "ab", 2) == 2);
+    CHECK(fs_seek(fd, 0) == 0);
+    kmemset(buf, 0, 16);
+    CHECK(fs_read(fd, buf, 16) == 2);
+    CHECK(same(buf, "ab\0\0", 4));
+    fs_close(fd);
+    CHECK(fs_delete("reuse") == 0);
+
+    /* Initramfs files are copied out of the image on the first write */
+    int len;
+    const char *image = fs_get_file_content("hello", &len);
+    CHECK(image != 0 && len > 0);
+    kmemcpy(model, image, len);
+    fd = fs_open("hello", FD_READ | FD_WRITE);
+    CHECK(read_all(fd, buf, sizeof(buf)) == len);
+    CHECK(same(buf, model, len));
+    CHECK(fs_seek(fd, 0) == 0);
+    CHECK(fs_write(fd, "J", 1) == 1);
+    CHECK(same(image, model, len));  /* The image is untouched */
+    model[0] = 'J';
+    CHECK(read_all(fd, buf, sizeof(buf)) == len);
+    CHECK(same(buf, model, len));
+    fs_close(fd);
+}
+
+static void test_pipe(void) {
+    int fds[2];
+    CHECK(fs_pipe(fds) == 0);
+    fill_text(model, 3 * PIPE_SIZE, 2);
+    CHECK(fs_write(fds[1], model, 10) == 10);
+    CHECK(fs_write(fds[1], model + 10, PIPE_SIZE - 10) == PIPE_SIZE - 10);  /* Full */
+    CHECK(fs_read(fds[0], buf, 7) == 7);
+    CHECK(fs_read(fds[0], buf + 7, sizeof(buf)) == PIPE_SIZE - 7);
+    CHECK(same(buf, model, PIPE_SIZE));
+
+    /* Across the end of the ring */
+    CHECK(fs_write(fds[1], model, 700) == 700);
+    CHECK(fs_read(fds[0], buf, 700) == 700);
+    CHECK(fs_write(fds[1], model + 700, 700) == 700);
+    CHECK(fs_read(fds[0], buf + 700, 700) == 700);
+    CHECK(same(buf, model, 1400));
+
+    /* Wrong ends and seeks */
+    CHECK(fs_read(fds[1], buf, 1) == -1);
+    CHECK(fs_write(fds[0], model, 1) == -1);
+    CHECK(fs_seek(fds[0], 0) == -1);
+
+    /* What was written before the write end closed, then EOF */
+    CHECK(fs_write(fds[1], model, 5) == 5);
+    CHECK(fs_close(fds[1]) == 0);
+    CHECK(fs_read(fds[0], buf, 100) == 5);
+    CHECK(fs_read(fds[0], buf, 100) == 0);
+    CHECK(fs_read(fds[0], buf, 100) == 0);
+    CHECK(fs_close(fds[0]) == 0);
+
+    /* Writing with the read end gone fails */
+    CHECK(fs_pipe(fds) == 0);
+    CHECK(fs_close(fds[0]) == 0);
+    CHECK(fs_write(fds[1], model, 5) == -1);
+    CHECK(fs_close(fds[1]) == 0);
+}
+
+/* Compress 'len' bytes of 'src' and check they decompress to the same */
+static void lz4_roundtrip(const char *src, int len) {
+    static char packed[LZ4_MAX_INPUT + LZ4_MAX_INPUT / 255 + 16];
+    static char out[LZ4_MAX_INPUT + 1];
+    int clen = lz4_compress(src, len, packed, sizeof(packed));
+    CHECK(clen >= 0);
+    if (clen < 0) return;
+    CHECK(lz4_decompress(packed, clen, out, sizeof(out)) == len);
+    CHECK(same(out, src, len));
+    /* One byte short of room for the output is an error, not an overrun */
+    if (len > 0) CHECK(lz4_decompress(packed, clen, out, len - 1) == -1);
+    /* As is a truncated block */
+    if (clen > 1) CHECK(lz4_decompress(packed, clen - 1, out, sizeof(out)) != len ||
+                        !same(out, src, len));
+}
+
+static void test_lz4(void) {
+    static char data[LZ4_MAX_INPUT];
+    static const int sizes[] = {0, 1, 4, 5, 12, 13, 15, 16, 19, 255, 256,
+                                FS_ZBLOCK_SIZE - 1, FS_ZBLOCK_SIZE, FS_ZBLOCK_SIZE + 1,
+                                LZ4_MAX_INPUT - 1, LZ4_MAX_INPUT};
+    for (unsigned i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        fill_text(data, sizes[i], i);
+        lz4_roundtrip(data, sizes[i]);
+        kmemset(data, 0, sizes[i]);
+        lz4_roundtrip(data, sizes[i]);
+        fill_random(data, sizes[i]);
+        lz4_roundtrip(data, sizes[i]);
+    }
+    CHECK(lz4_compress(data, LZ4_MAX_INPUT + 1, buf, sizeof(buf)) == -1);
+    fill_random(data, 1000);
+    CHECK(lz4_compress(data, 1000, buf, 999) == -1);  /* Does not shrink */
+    kmemset(data, 0, 1000);
+    int clen = lz4_compress(data, 1000, buf, 999);
+    CHECK(clen > 0 && clen < 100);
+}
+
+/* Compressed files: writes that straddle block edges, growth to the block
+ * limit, and the way back to plain storage */
+static void test_compressed(void) {
+    CHECK(fs_create("z") == 0);
+    int fd = fs_open("z", FD_READ | FD_WRITE);
+    fill_text(model, 2 * FS_ZBLOCK_SIZE, 3);
+    CHECK(fs_write(fd, model, FS_ZBLOCK_SIZE - 1) == FS_ZBLOCK_SIZE - 1);
+    CHECK(fs_compress("z", 1) == 0);
+    CHECK(fs_compress("z", 1) == 0);  /* Already */
+    int len;
+    CHECK(fs_get_file_content("z", &len) == 0 && len == 0);
+
+    /* Across the first block edge */
+    CHECK(fs_seek(fd, FS_ZBLOCK_SIZE - 3) == FS_ZBLOCK_SIZE - 3);
+    CHECK(fs_write(fd, model + FS_ZBLOCK_SIZE - 3, 6) == 6);
+    CHECK(fs_get_file_size("z") == FS_ZBLOCK_SIZE + 3);
+    CHECK(read_all(fd, buf, sizeof(buf)) == FS_ZBLOCK_SIZE + 3);
+    CHECK(same(buf, model, FS_ZBLOCK_SIZE + 3));
+
+    /* Reads that start and end at block edges, cold and cached */
+    pcache_invalidate(fs_get_inode("z"));
+    CHECK(fs_seek(fd, FS_ZBLOCK_SIZE - 1) == FS_ZBLOCK_SIZE - 1);
+    CHECK(fs_read(fd, buf, 2) == 2);
+    CHECK(same(buf, model + FS_ZBLOCK_SIZE - 1, 2));
+    CHECK(fs_seek(fd, FS_ZBLOCK_SIZE) == FS_ZBLOCK_SIZE);
+    CHECK(fs_read(fd, buf, 10) == 3);
+
+    /* Fill every block with data that doesn't compress, then hit the limit */
+    fill_random(model + FS_ZBLOCK_SIZE + 3, ZFILE_MAX - FS_ZBLOCK_SIZE - 3);
+    CHECK(fs_write(fd, model + FS_ZBLOCK_SIZE + 3, ZFILE_MAX) == ZFILE_MAX - FS_ZBLOCK_SIZE - 3);
+    CHECK(fs_get_file_size("z") == ZFILE_MAX);
+    CHECK(fs_write(fd, model, 1) == -1);
+    pcache_invalidate(fs_get_inode("z"));
+    CHECK(read_all(fd, buf, sizeof(buf)) == ZFILE_MAX);
+    CHECK(same(buf, model, ZFILE_MAX));
+
+    fs_zinfo_t info;
+    CHECK(fs_compress_info("z", &info) == 0);
+    CHECK(info.size == ZFILE_MAX && info.blocks == FS_ZMAX_BLOCKS);
+    CHECK(info.raw > 0 && info.stored <= fs_zstore_used());
+    CHECK(fs_compress_info("hello", &info) == -1);
+
+    /* Too big for a plain file now */
+    CHECK(fs_compress("z", 0) == -1);
+    CHECK(read_all(fd, buf, sizeof(buf)) == ZFILE_MAX);
+    CHECK(same(buf, model, ZFILE_MAX));
+    fs_close(fd);
+    CHECK(fs_delete("z") == 0);
+    CHECK(fs_zstore_used() == 0);
+
+    /* A small one goes back to plain storage intact */
+    CHECK(fs_create("z") == 0);
+    fd = fs_open("z", FD_READ | FD_WRITE);
+    CHECK(fs_compress("z", 1) == 0);
+    fill_text(model, FS_ZBLOCK_SIZE, 4);
+    CHECK(fs_write(fd, model, FS_ZBLOCK_SIZE) == FS_ZBLOCK_SIZE);
+    CHECK(fs_compress("z", 0) == 0);
+    CHECK(fs_zstore_used() == 0);
+    CHECK(fs_get_file_content("z", &len) != 0 && len == FS_ZBLOCK_SIZE);
+    CHECK(read_all(fd, buf, sizeof(buf)) == FS_ZBLOCK_SIZE);
+    CHECK(same(buf, model, FS_ZBLOCK_SIZE));
+    fs_close(fd);
+    CHECK(fs_delete("z") == 0);
+}
+
+int main(void) {
+    CHECK(fs_init() == 0);
+    test_eof();
+    test_capacity();
+    test_seek();
+    test_delete_reuse();
+    test_pipe();
+    test_lz4();
+    test_compressed();
+    printf("%s: %d of %d checks failed\n", failures ? "FAIL" : "OK", failures, checks);
+    return failures != 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * What the host-native builds of src/fs.c, src/pcache.c and src/pipe.c need
+ * from the rest of the kernel, shared by the benchmark, test and fuzz
+ * drivers in tools/.
+ */
+#define _POSIX_C_SOURCE 200112L
+#include "initramfs.h"
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* fs_init seeds the filesystem from an initramfs archive; user_programs.c
+ * and the kernel's archive are not built here, so this is a small one with
+ * the same two text files. */
+#define PROG_HELLO "Hello from embedded program!\n"
+#define PROG_ECHO "Echo program running.\n"
+static const struct {
+    initramfs_header_t hdr;
+    initramfs_entry_t ent[2];
+    char hello[sizeof(PROG_HELLO) - 1];
+    char echo[sizeof(PROG_ECHO) - 1];
+} host_initramfs = {
+    {INITRAMFS_MAGIC, 2, sizeof(host_initramfs)},
+    {{"hello", offsetof(__typeof__(host_initramfs), hello), sizeof(PROG_HELLO) - 1},
+     {"echo", offsetof(__typeof__(host_initramfs), echo), sizeof(PROG_ECHO) - 1}},
+    PROG_HELLO,
+    PROG_ECHO,
+};
+const char *const fs_initramfs_start = (const char *)&host_initramfs;
+const char *const fs_initramfs_end = (const char *)&host_initramfs + sizeof(host_initramfs);
+
+/* pipe.c and the file system locks block through the scheduler. The
+ * drivers never read an empty pipe or fill a full one, and a lock waiter
+ * only needs to let the holder run, since it tries again after every
+ * wakeup. */
+void scheduler_sleep(void *chan) { (void)chan; sched_yield(); }
+int scheduler_wakeup(void *chan) { (void)chan; return 0; }
+
+/* Host buffers are never a program's, so copies to and from them can't
+ * fault, and there is no sstatus.SUM to set for reading them in place. */
+long __uaccess_copy(void *dst, const void *src, uint64_t n) {
+    __builtin_memcpy(dst, src, n);
+    return 0;
+}
+void uaccess_enable(void) {}
+void uaccess_disable(void) {}
+
+/* fs.c hands socket descriptors to net.c; the drivers open none. */
+int net_socket(int port) { (void)port; return -1; }
+int net_send(int s, const void *buf, int len) { (void)s; (void)buf; (void)len; return -1; }
+int net_recv(int s, void *buf, int len) { (void)s; (void)buf; (void)len; return -1; }
+void net_close(int s) { (void)s; }
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+"""Pack files into an initramfs archive for the kernel image.
+
+Usage: mkinitramfs.py -o <archive> <dir or file>...
+
+Every regular file below a directory is added under its path relative to
+that directory; a file given directly is added under its base name. The
+layout is described in src/initramfs.h: a header and entry table, then
+each file's data on a page boundary, zero-padded to the next one, so the
+kernel can map the pages in place.
+"""
+import argparse
+import os
+import struct
+import sys
+
+MAGIC = 0x31534652
+NAME_LEN = 32
+ALIGN = 4096
+HEADER = struct.Struct("<IIQ")
+ENTRY = struct.Struct("<%dsQQ" % NAME_LEN)
+
+
+def align(n):
+    return (n + ALIGN - 1) // ALIGN * ALIGN
+
+
+def collect(paths):
+    files = []
+    for path in paths:
+        if os.path.isdir(path):
+            for root, dirs, names in os.walk(path):
+                dirs.sort()
+                for name in sorted(names):
+                    full = os.path.join(root, name)
+                    files.append((os.path.relpath(full, path).replace(os.sep, "/"), full))
+        elif os.path.isfile(path):
+            files.append((os.path.basename(path), path))
+        else:
+            sys.exit("mkinitramfs: %s: no such file or directory" % path)
+    return files
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-o", "--output", required=True)
+    parser.add_argument("--max-files", type=int, default=16,
+                        help="file slots in the kernel (MAX_FILES in src/fs.h)")
+    parser.add_argument("paths", nargs="*")
+    args = parser.parse_args()
+
+    files = collect(args.paths)
+    names = set()
+    for name, _ in files:
+        if len(name.encode()) >= NAME_LEN:
+            sys.exit("mkinitramfs: %s: name longer than %d bytes" % (name, NAME_LEN - 1))
+        if name in names:
+            sys.exit("mkinitramfs: %s: added twice" % name)
+        names.add(name)
+    if len(files) > args.max_files:
+        sys.exit("mkinitramfs: %d files, but the file system holds %d" % (len(files), args.max_files))
+
+    offset = align(HEADER.size + ENTRY.size * len(files))
+    entries = []
+    blobs = []
+    for name, path in files:
+        with open(path, "rb") as f:
+            data = f.read()
+        entries.append(ENTRY.pack(name.encode(), offset, len(data)))
+        blobs.append(data + b"\0" * (align(len(data)) - len(data)))
+        offset += align(len(data))
+
+    table = HEADER.pack(MAGIC, len(files), offset) + b"".join(entries)
+    with open(args.output, "wb") as out:
+        out.write(table + b"\0" * (align(len(table)) - len(table)))
+        for blob in blobs:
+            out.write(blob)
+    total = sum(os.path.getsize(p) for _, p in files)
+    print("mkinitramfs: %d files, %d bytes of data, %d byte archive" % (len(files), total, offset))
+
+
+if __name__ == "__main__":
+    main()
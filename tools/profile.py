@@ -0,0 +1,76 @@
+#!/usr/bin/env python3
+"""Symbolize 'profile dump' samples against the kernel ELF.
+
+Reads a console log, keeps the lines of the form
+
+    P <hart> <task> <pc>
+
+and maps each pc to the enclosing function using `nm -n`. Prints a flat
+profile to stdout and, with --folded, writes 'task;function count' lines
+that flamegraph.pl (or speedscope) turns into a flame graph.
+"""
+import argparse
+import bisect
+import collections
+import subprocess
+import sys
+
+
+def load_symbols(nm, elf):
+    out = subprocess.run([nm, "-n", elf], check=True,
+                         capture_output=True, text=True).stdout
+    addrs, names = [], []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) != 3 or parts[1] not in "tTwW":
+            continue
+        addrs.append(int(parts[0], 16))
+        names.append(parts[2])
+    return addrs, names
+
+
+def symbolize(addrs, names, pc):
+    i = bisect.bisect_right(addrs, pc) - 1
+    return names[i] if i >= 0 else "[unknown]"
+
+
+def read_samples(path):
+    with open(path, errors="replace") as f:
+        for line in f:
+            parts = line.strip().split()
+            if len(parts) == 4 and parts[0] == "P":
+                yield int(parts[1]), int(parts[2]), int(parts[3], 16)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("log", help="console log containing 'profile dump' output")
+    ap.add_argument("--elf", default="build/kernel.elf")
+    ap.add_argument("--nm", default="riscv64-unknown-elf-nm")
+    ap.add_argument("--folded", help="write folded stacks for flamegraph.pl")
+    args = ap.parse_args()
+
+    addrs, names = load_symbols(args.nm, args.elf)
+    flat = collections.Counter()
+    folded = collections.Counter()
+    for _hart, task, pc in read_samples(args.log):
+        fn = symbolize(addrs, names, pc)
+        flat[fn] += 1
+        folded["idle" if task < 0 else "task%d" % task, fn] += 1
+
+    total = sum(flat.values())
+    if not total:
+        sys.exit("no samples found in %s" % args.log)
+
+    print("%8s %7s  %s" % ("samples", "%", "function"))
+    for fn, n in flat.most_common():
+        print("%8d %6.2f%%  %s" % (n, 100.0 * n / total, fn))
+
+    if args.folded:
+        with open(args.folded, "w") as f:
+            for (task, fn), n in sorted(folded.items()):
+                f.write("%s;%s %d\n" % (task, fn, n))
+
+
+if __name__ == "__main__":
+    main()
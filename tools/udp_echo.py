@@ -0,0 +1,26 @@
+#!/usr/bin/env python3
+"""UDP echo server for the udpecho program.
+
+Sends every datagram back to where it came from. Under QEMU's user-mode
+networking the guest reaches the host as 10.0.2.2, so the guest's
+datagrams arrive here from localhost.
+"""
+import socket
+import sys
+
+
+def main():
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 7777
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("0.0.0.0", port))
+    print(f"udp echo on port {port}", flush=True)
+    while True:
+        data, addr = sock.recvfrom(65535)
+        sock.sendto(data, addr)
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except KeyboardInterrupt:
+        pass
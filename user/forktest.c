@@ -0,0 +1,52 @@
+#include "usys.h"
+
+// Exercises fork and threads: the forked child writes to its copy-on-write
+// view of 'shared', the threads write to the one the parent sees.
+static volatile long shared = 1;
+static volatile int threads_done;
+
+static void put_dec(uint64_t v) {
+    char buf[21];
+    int pos = 20;
+    buf[pos] = 0;
+    do {
+        buf[--pos] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    uputs(buf + pos);
+}
+
+static void worker(long arg) {
+    shared += arg;
+    threads_done++;
+}
+
+int main(void) {
+    int child = ufork();
+    if (child < 0) {
+        uputs("fork failed\n");
+        return 1;
+    }
+    if (child == 0) {
+        shared = 100;
+        uputs("child: shared = ");
+        put_dec(shared);
+        uputs("\n");
+        return 0;
+    }
+
+    uyield();  // Let the child run first; its write must not show up here
+    uputs("parent: shared = ");
+    put_dec(shared);
+    uputs("\n");
+
+    if (uthread_create(worker, 10, 0) < 0 || uthread_create(worker, 20, 0) < 0) {
+        uputs("thread_create failed\n");
+        return 1;
+    }
+    while (threads_done < 2) uyield();
+    uputs("parent: after threads shared = ");
+    put_dec(shared);
+    uputs("\n");
+    return 0;
+}
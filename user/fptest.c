@@ -0,0 +1,48 @@
+#include "usys.h"
+
+// Two tasks keep values in FP (and, with the vector extension, vector)
+// registers across yields, while the other one runs and uses its own.
+// Each must get exactly its own results back. Built with ISA=gc or gcv.
+#define ROUNDS 1000
+
+// Sums 'step' ROUNDS times; every partial sum is exact in a double
+static int fp_check(double step) {
+    double x = 0;
+    for (int i = 0; i < ROUNDS; i++) {
+        x += step;
+        if (i % 10 == 0) uyield();
+    }
+    return x == ROUNDS * step;
+}
+
+#ifdef __riscv_vector
+// Leaves 'val' in all lanes of v8 across yields and reads it back
+static int vec_check(uint32_t val) {
+    uint32_t out[4];
+    asm volatile("vsetivli zero, 4, e32, m1, ta, ma\n"
+                 "vmv.v.x v8, %0" :: "r"(val));
+    for (int i = 0; i < ROUNDS / 10; i++) uyield();
+    asm volatile("vsetivli zero, 4, e32, m1, ta, ma\n"
+                 "vse32.v v8, (%0)" :: "r"(out) : "memory");
+    for (int i = 0; i < 4; i++) {
+        if (out[i] != val) return 0;
+    }
+    return 1;
+}
+#endif
+
+int main(void) {
+    int child = ufork();
+    if (child < 0) {
+        uputs("fork failed\n");
+        return 1;
+    }
+    const char *who = child ? "parent" : "child";
+    int ok = fp_check(child ? 0.5 : 0.25);
+#ifdef __riscv_vector
+    ok = ok && vec_check(child ? 0x12345678 : 0x9abcdef0);
+#endif
+    uputs(who);
+    uputs(ok ? ": registers survived task switches\n" : ": registers corrupted\n");
+    return !ok;
+}
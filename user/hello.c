@@ -0,0 +1,6 @@
+#include "usys.h"
+
+int main(void) {
+    uputs("Hello from an ELF program loaded from the file system!\n");
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "usys.h"
+#include "ulock.h"
+
+// Exercises the futex-based locks: threads increment a counter under a
+// mutex (yielding while holding it, to force contention), then pass items
+// through a one-slot buffer guarded by a condition variable. A semaphore
+// tells main when each worker is done.
+#define WORKERS 3
+#define ROUNDS 200
+#define ITEMS 50
+
+static umutex_t lock = UMUTEX_INIT;
+static ucond_t changed = UCOND_INIT;
+static usem_t done = USEM_INIT(0);
+static long counter;
+static long slot;
+static int slot_full;
+
+static void put_dec(uint64_t v) {
+    char buf[21];
+    int pos = 20;
+    buf[pos] = 0;
+    do {
+        buf[--pos] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    uputs(buf + pos);
+}
+
+static void counter_worker(long arg) {
+    (void)arg;
+    for (int i = 0; i < ROUNDS; i++) {
+        umutex_lock(&lock);
+        long v = counter;
+        if ((i & 15) == 0) uyield();  // Others now find the mutex held
+        counter = v + 1;
+        umutex_unlock(&lock);
+    }
+    usem_post(&done);
+}
+
+static void producer(long arg) {
+    (void)arg;
+    for (long i = 1; i <= ITEMS; i++) {
+        umutex_lock(&lock);
+        while (slot_full) ucond_wait(&changed, &lock);
+        slot = i;
+        slot_full = 1;
+        ucond_broadcast(&changed);
+        umutex_unlock(&lock);
+    }
+    usem_post(&done);
+}
+
+int main(void) {
+    for (int i = 0; i < WORKERS; i++) {
+        if (uthread_create(counter_worker, i, 0) < 0) {
+            uputs("thread_create failed\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < WORKERS; i++) usem_wait(&done);
+    uputs("counter = ");
+    put_dec(counter);
+    uputs(" (expected ");
+    put_dec(WORKERS * ROUNDS);
+    uputs(")\n");
+
+    if (uthread_create(producer, 0, 0) < 0) {
+        uputs("thread_create failed\n");
+        return 1;
+    }
+    long sum = 0;
+    for (int i = 0; i < ITEMS; i++) {
+        umutex_lock(&lock);
+        while (!slot_full) ucond_wait(&changed, &lock);
+        sum += slot;
+        slot_full = 0;
+        ucond_broadcast(&changed);
+        umutex_unlock(&lock);
+    }
+    usem_wait(&done);
+    uputs("sum = ");
+    put_dec(sum);
+    uputs(" (expected ");
+    put_dec(ITEMS * (ITEMS + 1) / 2);
+    uputs(")\n");
+    return 0;
+}
@@ -0,0 +1,48 @@
+#include "usys.h"
+#include "uvdso.h"
+
+// A periodic real-time job run as a deadline task: every 10 ms, 1 ms of
+// work that must be done within 5 ms of its release. Start a CPU-bound
+// program first (run primes &) to see it keep its deadlines under load.
+#define PERIOD_US 10000
+#define DEADLINE_US 5000
+#define RUNTIME_US 2000
+#define WORK_US 1000
+#define JOBS 100
+
+static void put_dec(uint64_t v) {
+    char buf[21];
+    int pos = 20;
+    buf[pos] = 0;
+    do {
+        buf[--pos] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    uputs(buf + pos);
+}
+
+int main(void) {
+    uint64_t first = uvdso_uptime_us();
+    if (usched_deadline(RUNTIME_US, PERIOD_US, DEADLINE_US) < 0) {
+        uputs("periodic: not admitted\n");
+        return 1;
+    }
+    uint64_t misses = 0, worst = 0;
+    for (uint64_t job = 0; job < JOBS; job++) {
+        uint64_t start = uvdso_uptime_us();
+        while (uvdso_uptime_us() - start < WORK_US) {
+        }
+        // Time from the job's release until it finished
+        uint64_t response = uvdso_uptime_us() - (first + job * PERIOD_US);
+        if (response > worst) worst = response;
+        if (response > DEADLINE_US) misses++;
+        uyield();  // End of the job: sleep until the next release
+    }
+    put_dec(JOBS);
+    uputs(" jobs, ");
+    put_dec(misses);
+    uputs(" missed, worst response ");
+    put_dec(worst);
+    uputs(" us\n");
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include "usys.h"
+#include "uvdso.h"
+
+// Sieve of Eratosthenes over a 256 KiB table. The table lives in .bss and
+// is paged in as the sieve walks it, so starting the program costs a few
+// pages, not the whole table.
+#define LIMIT (256 * 1024)
+
+static char composite[LIMIT];
+
+static void put_dec(uint64_t v) {
+    char buf[21];
+    int pos = 20;
+    buf[pos] = 0;
+    do {
+        buf[--pos] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    uputs(buf + pos);
+}
+
+int main(void) {
+    uint64_t start = uvdso_uptime_us();
+    uint64_t count = 0;
+    for (uint64_t i = 2; i < LIMIT; i++) {
+        if (composite[i]) continue;
+        count++;
+        for (uint64_t j = i * i; j < LIMIT; j += i) composite[j] = 1;
+        if ((count & 1023) == 0) uyield();
+    }
+    uputs("primes below 262144: ");
+    put_dec(count);
+    uputs(" (");
+    put_dec(uvdso_uptime_us() - start);
+    uputs(" us)\n");
+    return 0;
+}
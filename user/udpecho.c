@@ -0,0 +1,70 @@
+#include "usys.h"
+#include "uvdso.h"
+
+// Round trips through a UDP echo server on the host: start 'make udp-echo'
+// beside 'make run', then run udpecho. QEMU's user-mode network passes
+// datagrams for the gateway on to the host.
+#ifndef ECHO_PORT
+#define ECHO_PORT 7777
+#endif
+#define ROUNDS 20
+#define PAYLOAD 1024
+#define TIMEOUT_US 500000
+
+static char out[PAYLOAD];
+static char in[PAYLOAD];
+
+static void put_dec(uint64_t v) {
+    char buf[21];
+    int pos = 20;
+    buf[pos] = 0;
+    do {
+        buf[--pos] = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+    uputs(buf + pos);
+}
+
+int main(void) {
+    int fd = usocket(0);
+    if (fd < 0) {
+        uputs("udpecho: no network\n");
+        return 1;
+    }
+    uint64_t ok = 0, lost = 0, total = 0, worst = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < PAYLOAD; i++) out[i] = 'a' + (round + i) % 26;
+        uint64_t start = uvdso_uptime_us();
+        if (usendto(fd, out, PAYLOAD, NET_GATEWAY, ECHO_PORT) != PAYLOAD) {
+            uputs("udpecho: send failed\n");
+            break;
+        }
+        uint32_t ip;
+        uint16_t port;
+        int n = urecvfrom(fd, in, PAYLOAD, &ip, &port, TIMEOUT_US);
+        uint64_t rtt = uvdso_uptime_us() - start;
+        int same = n == PAYLOAD && ip == NET_GATEWAY && port == ECHO_PORT;
+        for (int i = 0; same && i < PAYLOAD; i++) same = in[i] == out[i];
+        if (!same) {
+            lost++;
+            continue;
+        }
+        ok++;
+        total += rtt;
+        if (rtt > worst) worst = rtt;
+    }
+    uclose(fd);
+    put_dec(ok);
+    uputs(" echoed, ");
+    put_dec(lost);
+    uputs(" lost or wrong");
+    if (ok) {
+        uputs(", round trip avg ");
+        put_dec(total / ok);
+        uputs(" us, worst ");
+        put_dec(worst);
+        uputs(" us");
+    }
+    uputs("\n");
+    return ok ? 0 : 1;
+}
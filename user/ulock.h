@@ -0,0 +1,98 @@
+#ifndef ULOCK_H
+#define ULOCK_H
+
+#include "usys.h"
+#include <stdint.h>
+
+// Mutex, condition variable and semaphore for the threads of a program,
+// built on SYS_FUTEX. The fast paths are a single atomic instruction; the
+// kernel is only entered to sleep when contended, or to wake a sleeper.
+
+// Mutex states: 0 unlocked, 1 locked, 2 locked and someone may be sleeping
+typedef struct {
+    volatile uint32_t state;
+} umutex_t;
+
+#define UMUTEX_INIT {0}
+
+static inline void umutex_lock(umutex_t *m) {
+    uint32_t c = 0;
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+    // Contended: mark the lock as having sleepers, then sleep until it is free
+    if (c != 2) c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        ufutex_wait(&m->state, 2);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline int umutex_trylock(umutex_t *m) {
+    uint32_t c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void umutex_unlock(umutex_t *m) {
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) {
+        ufutex_wake(&m->state, 1);
+    }
+}
+
+// Condition variable: waiters sleep on a sequence number that every signal
+// bumps, so a signal between unlocking and sleeping is not lost.
+typedef struct {
+    volatile uint32_t seq;
+} ucond_t;
+
+#define UCOND_INIT {0}
+
+static inline void ucond_wait(ucond_t *c, umutex_t *m) {
+    uint32_t seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+    umutex_unlock(m);
+    ufutex_wait(&c->seq, seq);
+    umutex_lock(m);
+}
+
+static inline void ucond_signal(ucond_t *c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    ufutex_wake(&c->seq, 1);
+}
+
+static inline void ucond_broadcast(ucond_t *c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    ufutex_wake(&c->seq, 0x7fffffff);
+}
+
+// Counting semaphore. 'waiters' lets usem_post skip the system call when
+// nobody is asleep.
+typedef struct {
+    volatile uint32_t count;
+    volatile uint32_t waiters;
+} usem_t;
+
+#define USEM_INIT(n) {(n), 0}
+
+static inline void usem_wait(usem_t *s) {
+    while (1) {
+        uint32_t v = __atomic_load_n(&s->count, __ATOMIC_RELAXED);
+        if (v > 0) {
+            if (__atomic_compare_exchange_n(&s->count, &v, v - 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return;
+            }
+            continue;
+        }
+        __atomic_fetch_add(&s->waiters, 1, __ATOMIC_RELAXED);
+        ufutex_wait(&s->count, 0);
+        __atomic_fetch_sub(&s->waiters, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static inline void usem_post(usem_t *s) {
+    __atomic_fetch_add(&s->count, 1, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&s->waiters, __ATOMIC_ACQUIRE)) {
+        ufutex_wake(&s->count, 1);
+    }
+}
+
+#endif
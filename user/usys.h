@@ -0,0 +1,146 @@
+#ifndef USYS_H
+#define USYS_H
+
+#include "syscall.h"
+#include "futex.h"
+#include "net.h"
+#include <stdint.h>
+
+// System call stubs for programs loaded from the file system. These run in
+// their own address space and can only reach the kernel through ecall.
+
+static inline long usys(long num, uint64_t a0, uint64_t a1, uint64_t a2) {
+    register long a7 asm("a7") = num;
+    register long a0_reg asm("a0") = a0;
+    register long a1_reg asm("a1") = a1;
+    register long a2_reg asm("a2") = a2;
+    asm volatile("ecall" : "+r"(a0_reg) : "r"(a7), "r"(a1_reg), "r"(a2_reg) : "memory");
+    return a0_reg;
+}
+
+static inline uint64_t ustrlen(const char *s) {
+    uint64_t n = 0;
+    while (s[n]) n++;
+    return n;
+}
+
+static inline void uputs(const char *s) {
+    usys(SYS_WRITE, (uint64_t)s, ustrlen(s), 0);
+}
+
+static inline void uyield(void) {
+    usys(SYS_YIELD, 0, 0, 0);
+}
+
+static inline int ugettid(void) {
+    return usys(SYS_GETTID, 0, 0, 0);
+}
+
+// Returns the child's task id in the parent and 0 in the child
+static inline int ufork(void) {
+    return usys(SYS_FORK, 0, 0, 0);
+}
+
+// Runs fn(arg) in a new thread of this program. With stack == 0 the kernel
+// maps a fresh stack; the thread ends when fn returns.
+static inline int uthread_create(void (*fn)(long), long arg, void *stack) {
+    return usys(SYS_THREAD_CREATE, (uint64_t)fn, arg, (uint64_t)stack);
+}
+
+// Creates a pipe: fds[0] reads what is written to fds[1]
+static inline int upipe(int fds[2]) {
+    return usys(SYS_PIPE, (uint64_t)fds, 0, 0);
+}
+
+static inline int uopen(const char *name, int flags) {
+    return usys(SYS_OPEN, (uint64_t)name, flags, 0);
+}
+
+static inline int uread(int fd, void *buf, int len) {
+    return usys(SYS_READ, fd, (uint64_t)buf, len);
+}
+
+static inline int uwrite(int fd, const void *buf, int len) {
+    return usys(SYS_WRITE_FD, fd, (uint64_t)buf, len);
+}
+
+static inline int uclose(int fd) {
+    return usys(SYS_CLOSE, fd, 0, 0);
+}
+
+// Maps the first 'len' bytes of open file 'fd' read-only (all of it if
+// 'len' is 0) and returns the address, or 0
+static inline const void *ummap(int fd, uint64_t len) {
+    return (const void *)usys(SYS_MMAP, fd, len, 0);
+}
+
+// Maps shared-memory channel 'id' (CHAN_SIZE bytes) and returns its address
+static inline void *uchan_map(int id) {
+    return (void *)usys(SYS_CHAN_MAP, id, 0, 0);
+}
+
+// Sleeps until uchan_wake(word), unless *word != expected already
+static inline int uchan_wait(volatile uint32_t *word, uint32_t expected) {
+    return usys(SYS_CHAN_WAIT, (uint64_t)word, expected, 0);
+}
+
+static inline int uchan_wake(volatile uint32_t *word) {
+    return usys(SYS_CHAN_WAKE, (uint64_t)word, 0, 0);
+}
+
+// Sleeps until ufutex_wake(word), unless *word != expected already
+static inline int ufutex_wait(volatile uint32_t *word, uint32_t expected) {
+    return usys(SYS_FUTEX, (uint64_t)word, FUTEX_WAIT, expected);
+}
+
+// Wakes up to 'count' tasks sleeping on word; returns how many
+static inline int ufutex_wake(volatile uint32_t *word, int count) {
+    return usys(SYS_FUTEX, (uint64_t)word, FUTEX_WAKE, count);
+}
+
+// Sleeps for 'us' microseconds
+static inline void usleep(uint64_t us) {
+    usys(SYS_SLEEP, us, 0, 0);
+}
+
+// Runs this program as a deadline task: a job of at most 'runtime_us' every
+// 'period_us', due 'deadline_us' after its release (0: the period). uyield
+// ends a job. Returns -1 if the CPU cannot take it on.
+static inline int usched_deadline(uint64_t runtime_us, uint64_t period_us, uint64_t deadline_us) {
+    return usys(SYS_SCHED_DEADLINE, runtime_us, period_us, deadline_us);
+}
+
+// Opens a UDP socket on local 'port' (0 for any); returns its descriptor.
+// uread and uwrite on it move one datagram each once it is connected.
+static inline int usocket(int port) {
+    return usys(SYS_SOCKET, port, 0, 0);
+}
+
+// Sets where uwrite on socket 'fd' sends to
+static inline int uconnect(int fd, uint32_t ip, int port) {
+    return usys(SYS_CONNECT, fd, ip, port);
+}
+
+// Sends 'len' bytes at 'buf' as one datagram to 'ip':'port'
+static inline int usendto(int fd, const void *buf, int len, uint32_t ip, int port) {
+    net_msg_t m = {(void *)buf, len, ip, port, 0};
+    return usys(SYS_SENDTO, fd, (uint64_t)&m, 0);
+}
+
+// Receives one datagram into 'buf', waiting at most 'timeout_us' (0:
+// forever). Returns its length, or -1 on a timeout; 'ip' and 'port' get
+// the sender if not 0.
+static inline int urecvfrom(int fd, void *buf, int len, uint32_t *ip, uint16_t *port,
+                            uint32_t timeout_us) {
+    net_msg_t m = {buf, len, 0, 0, timeout_us};
+    int n = usys(SYS_RECVFROM, fd, (uint64_t)&m, 0);
+    if (n >= 0 && ip) *ip = m.ip;
+    if (n >= 0 && port) *port = m.port;
+    return n;
+}
+
+static inline void uexit(void) {
+    usys(SYS_EXIT, 0, 0, 0);
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef UVDSO_H
+#define UVDSO_H
+
+#include "vdso.h"
+#include <stdint.h>
+
+// Trap-free queries for programs, answered from the kernel's read-only
+// data page at VDSO_USER_BASE instead of through an ecall.
+
+#define UVDSO ((const volatile vdso_data_t *)VDSO_USER_BASE)
+
+// The calling task's id, like SYS_GETTID
+static inline int uvdso_gettid(void) {
+    return vdso_gettid(UVDSO);
+}
+
+// Microseconds since boot
+static inline uint64_t uvdso_uptime_us(void) {
+    return vdso_uptime(UVDSO) / (UVDSO->timer_freq / 1000000);
+}
+
+// Timer interrupts and context switches so far, read consistently
+static inline void uvdso_stats(uint64_t *ticks, uint64_t *switches) {
+    vdso_data_t d;
+    vdso_read(UVDSO, &d);
+    *ticks = d.ticks;
+    *switches = d.switches;
+}
+
+#endif